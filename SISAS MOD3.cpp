@@ -8,6 +8,43 @@
 #include <iomanip>
 #include <ctime>
 #include <memory> // Para smart pointers si decidimos usarlos, aunque por ahora no se usan directamente para ownership de personajes/items en vectors.
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdio>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <memory_resource>
+#include <string_view>
+#include <cmath>
+#if defined(__linux__) // game server (--serve): epoll and ucontext fibers
+#define SISAS_SERVER 1
+#include <ucontext.h>
+#include <csignal>
+#include <utility>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#else
+#define SISAS_SERVER 0
+#endif
 
 using namespace std;
 
@@ -19,6 +56,7 @@ class Item;
 class Weapon;
 class Armor;
 class Potion;
+class ItemCatalog;
 class Inventory;
 class Battle;
 class Room;
@@ -27,1348 +65,8087 @@ class ScoreManager;
 class Game;
 
 
-// Utility function for user input
-int getValidatedInput(int min, int max) {
-    int choice;
-    while (!(cin >> choice) || choice < min || choice > max) {
-        wcout << "Entrada inválida. Por favor, ingresa un número entre " << min << " y " << max << ": ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    }
-    cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear remaining input
-    return choice;
-}
+// ===== MESSAGE SINKS =====
+// Everything the game tells the player goes through the active MessageSink
+// instead of straight to cout: free text via gameText() << ..., and the
+// notable moments of a run as GameEvents via emitEvent(). The terminal sink
+// batches text and writes it only when the game is about to wait for input,
+// the null sink drops text without formatting it, and the event sink records
+// one JSON object per event for tools.
+enum EventType : uint8_t {
+    EVENT_RUN_STARTED,
+    EVENT_ROOM_ENTERED,
+    EVENT_BATTLE_STARTED,
+    EVENT_ATTACK,
+    EVENT_CRITICAL_HIT,
+    EVENT_MISS,
+    EVENT_DEFEATED,
+    EVENT_POTION_USED,
+    EVENT_BATTLE_ENDED,
+    EVENT_ITEM_EQUIPPED,
+    EVENT_RUN_ENDED,
+    EVENT_TURN_STARTED, // value: 0 hero turn, 1 enemy turn
+    EVENT_ROOM_CLEARED,
+    EVENT_EFFECT_EXPIRED,
+    EVENT_COUNT
+};
 
-// ===== CHARACTER CLASS (BASE ABSTRACT CLASS) =====
-class Character {
-protected:
-    string name;
-    int hp;
-    int maxHp;
-    int atk;
-    int def;
-    int spd;
-    int lck;
+constexpr const char* EVENT_NAMES[EVENT_COUNT] = {
+    "run_started", "room_entered", "battle_started", "attack", "critical_hit", "miss",
+    "defeated", "potion_used", "battle_ended", "item_equipped", "run_ended", "turn_started",
+    "room_cleared", "effect_expired"
+};
+
+// actor/target are only valid during the event() call
+struct GameEvent {
+    EventType type;
+    string_view actor;
+    string_view target;
+    int value;
+};
 
+class MessageSink {
 public:
-    Character(const string& name, int hp, int atk, int def, int spd, int lck)
-        : name(name), hp(hp), maxHp(hp), atk(atk), def(def), spd(spd), lck(lck) {}
-    
-    virtual ~Character() = default;
-    
-    // Getters
-    string getName() const { return name; }
-    int getHp() const { return hp; }
-    int getMaxHp() const { return maxHp; }
-    int getAtk() const { return atk; }
-    int getDef() const { return def; }
-    int getSpd() const { return spd; }
-    int getLck() const { return lck; }
-    
-    // Setters (for stat boosts)
-    void setAtk(int val) { atk = val; }
-    void setDef(int val) { def = val; }
-    void setSpd(int val) { spd = val; }
-    void setLck(int val) { lck = val; }
-    void setHp(int val) { hp = val; }
-    void setMaxHp(int val) { maxHp = val; }
+    virtual ~MessageSink() = default;
 
+    // Stream for player-facing text, or nullptr to skip formatting it
+    virtual ostream* text() { return nullptr; }
 
-    // Health management
-    virtual void takeDamage(int damage) {
-        hp = max(0, hp - damage);
-    }
-    
-    void heal(int amount) {
-        hp = min(maxHp, hp + amount);
-    }
-    
-    bool isAlive() const {
-        return hp > 0;
+    virtual void event(const GameEvent&) {}
+
+    // Writes out everything collected so far
+    virtual void flush() {}
+
+    // Called right before the game blocks on input
+    virtual void awaitInput() { flush(); }
+};
+
+// Text collected in a fixed buffer and written with one fwrite per prompt
+// (or whenever the buffer fills up); endl does not force a write. When
+// stdin is not a terminal nobody is reading the prompts, so it only writes
+// when the buffer is full.
+class TerminalSink : public MessageSink, private streambuf {
+private:
+    char buffer[64 * 1024];
+    ostream stream;
+    bool interactive;
+
+    int overflow(int c) override {
+        flush();
+        if (c != EOF) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return c;
     }
-    
-    // Combat methods
-    bool calculateHitChance(const Character* defender) const {
-        random_device rd;
-        mt19937 gen(rd());
-        uniform_int_distribution<> dis(1, 100);
-        
-        int hitChance = 85 + (lck - defender->lck) * 2;
-        hitChance = max(10, min(95, hitChance)); // Clamp between 10-95%
-        
-        return dis(gen) <= hitChance;
+
+    int sync() override { return 0; }
+
+public:
+    TerminalSink() : stream(this) {
+        setp(buffer, buffer + sizeof(buffer));
+#ifdef _WIN32
+        interactive = _isatty(_fileno(stdin)) != 0;
+#else
+        interactive = isatty(fileno(stdin)) != 0;
+#endif
     }
-    
-    int calculateDamage(const Character* defender) const {
-        int baseDamage = max(1, atk - defender->def);
-        
-        // Critical hit chance based on luck
-        random_device rd;
-        mt19937 gen(rd());
-        uniform_int_distribution<> critRoll(1, 100);
-        
-        if (critRoll(gen) <= lck) {
-            baseDamage = static_cast<int>(baseDamage * 1.5);
-            wcout << "¡Golpe crítico!" << endl;
+
+    ~TerminalSink() override { flush(); }
+
+    ostream* text() override { return &stream; }
+
+    void flush() override {
+        if (pptr() > pbase()) {
+            fwrite(pbase(), 1, pptr() - pbase(), stdout);
+            setp(buffer, buffer + sizeof(buffer));
         }
-        
-        return baseDamage;
+        fflush(stdout);
     }
-    
-    void displayStats() const {
-        cout << name << " - HP: " << hp << "/" << maxHp 
-             << " ATK: " << atk << " DEF: " << def 
-             << " SPD: " << spd << " LCK: " << lck << endl;
+
+    void awaitInput() override {
+        if (interactive) flush();
     }
 };
 
-// ===== ITEM CLASS (BASE ABSTRACT CLASS) =====
-class Item {
-protected:
-    string name;
-    string rarity;
-    int statBoost1;
-    int statBoost2;
-    string affectedStat1;
-    string affectedStat2;
+// Drops everything: scripted and batch playthroughs at full speed
+class NullSink : public MessageSink {};
 
-public:
-    Item(const string& name, const string& rarity, int boost1, int boost2, 
-         const string& stat1, const string& stat2)
-        : name(name), rarity(rarity), statBoost1(boost1), statBoost2(boost2),
-          affectedStat1(stat1), affectedStat2(stat2) {}
-    
-    virtual ~Item() = default;
-    
-    // Getters
-    string getName() const { return name; }
-    string getRarity() const { return rarity; }
-    int getStatBoost1() const { return statBoost1; }
-    int getStatBoost2() const { return statBoost2; }
-    string getAffectedStat1() const { return affectedStat1; }
-    string getAffectedStat2() const { return affectedStat2; }
-    
-    virtual void displayInfo() const {
-        cout << name << " (" << rarity << ") - " 
-             << affectedStat1 << " +" << statBoost1;
-        if (statBoost2 > 0 && !affectedStat2.empty()) { // Ensure second stat is meaningful
-            cout << ", " << affectedStat2 << " +" << statBoost2;
+// One JSON object per line for every GameEvent; free text is dropped
+class EventSink : public MessageSink {
+private:
+    ostream& out;
+    uint64_t sequence = 0;
+
+    void writeString(string_view text) {
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\') out << '\\';
+            out << c;
         }
-        wcout << endl;
+        out << '"';
     }
-};
 
-// ===== WEAPON CLASS =====
-class Weapon : public Item {
 public:
-    Weapon(const string& name, const string& rarity, int atkBoost, int secondaryBoost, const string& secondaryStat)
-        : Item(name, rarity, atkBoost, secondaryBoost, "ATK", secondaryStat) {}
-    
-    string getWeaponType() const { return "Weapon"; }
-};
+    explicit EventSink(ostream& out) : out(out) {}
 
-// ===== ARMOR CLASS =====
-class Armor : public Item {
-public:
-    Armor(const string& name, const string& rarity, int defBoost, int secondaryBoost, const string& secondaryStat)
-        : Item(name, rarity, defBoost, secondaryBoost, "DEF", secondaryStat) {}
-    
-    string getArmorType() const { return "Armor"; }
-};
+    ~EventSink() override { out.flush(); }
 
-// ===== POTION CLASS =====
-class Potion : public Item {
-private:
-    bool used;
+    void event(const GameEvent& e) override {
+        out << "{\"seq\":" << sequence++ << ",\"event\":\"" << EVENT_NAMES[e.type] << '"';
+        if (!e.actor.empty()) {
+            out << ",\"actor\":";
+            writeString(e.actor);
+        }
+        if (!e.target.empty()) {
+            out << ",\"target\":";
+            writeString(e.target);
+        }
+        out << ",\"value\":" << e.value << "}\n";
+    }
 
-public:
-    Potion(const string& name, int boost1, int boost2, const string& stat1, const string& stat2)
-        : Item(name, "Consumible", boost1, boost2, stat1, stat2), used(false) {}
-    
-    bool isUsed() const { return used; }
-    void setUsed(bool usedState) { used = usedState; }
-    void resetUsage() { used = false; }
+    void flush() override { out.flush(); }
 };
 
-// ===== HERO CLASS =====
-class Hero : public Character {
+TerminalSink terminalSink;
+MessageSink* activeSink = &terminalSink;
+
+// Set while a thread plays one server session: that session's output wins
+// over the process-wide sink
+thread_local MessageSink* sessionSink = nullptr;
+
+MessageSink* currentSink() { return sessionSink ? sessionSink : activeSink; }
+
+void setMessageSink(MessageSink* sink) {
+    activeSink->flush();
+    activeSink = sink ? sink : &terminalSink;
+}
+
+// One message: forwards to the sink's text stream, or does nothing at all
+class MessageLine {
 private:
-    Weapon* weapon;
-    Armor* armor;
-    vector<Potion*> potions;
-    int totalHealthLost;
-    vector<int> originalStats; // To store initial stats for potion removal
+    ostream* out;
 
 public:
-    Hero(const string& name, int hp, int atk, int def, int spd, int lck)
-        : Character(name, hp, atk, def, spd, lck), weapon(nullptr), armor(nullptr), totalHealthLost(0) {
-            originalStats = {hp, atk, def, spd, lck}; // Store initial stats
-        }
-    
-    // Equipment management
-    void equipWeapon(Weapon* newWeapon) {
-        // Remove old weapon bonuses if exists
-        if (weapon) {
-            removeItemBonuses(weapon);
-        }
-        weapon = newWeapon;
-        if (weapon) {
-            applyItemBonuses(weapon);
-        }
-    }
-    
-    void equipArmor(Armor* newArmor) {
-        // Remove old armor bonuses if exists
-        if (armor) {
-            removeItemBonuses(armor);
-        }
-        armor = newArmor;
-        if (armor) {
-            applyItemBonuses(armor);
-        }
+    explicit MessageLine(ostream* out) : out(out) {}
+
+    template <typename T>
+    MessageLine& operator<<(const T& value) {
+        if (out) *out << value;
+        return *this;
     }
-    
-    void addPotion(Potion* potion) {
-        potions.push_back(potion);
+
+    MessageLine& operator<<(ostream& (*manipulator)(ostream&)) {
+        if (out) manipulator(*out);
+        return *this;
     }
-    
-    void usePotion(int index) {
-        if (index >= 0 && index < potions.size() && !potions[index]->isUsed()) {
-            applyItemBonuses(potions[index]);
-            potions[index]->setUsed(true);
-            cout << name << " usa " << potions[index]->getName() << "!" << endl;
-        } else {
-             wcout << "No puedes usar esa poción." << endl;
-        }
+};
+
+MessageLine gameText() { return MessageLine(currentSink()->text()); }
+
+void emitEvent(EventType type, string_view actor = {}, string_view target = {}, int value = 0) {
+    currentSink()->event({type, actor, target, value});
+}
+
+void flushMessages() { currentSink()->flush(); }
+
+void awaitPlayerInput() { currentSink()->awaitInput(); }
+
+// ===== INPUT PROVIDERS =====
+// Every answer the game asks for (menu and hero picks, market yes/no,
+// action, target, potion, treasure recipient, the player's name and the
+// pause between rooms) comes from the active InputProvider: the console by
+// default, a script (a recorded session), code (bots, AI players) or a
+// server session's connection.
+class InputProvider {
+public:
+    virtual ~InputProvider() = default;
+
+    // Next answer to a numeric prompt, false when the input has run out.
+    // Answers outside [min, max] get the usual complaint and are asked again.
+    virtual bool nextChoice(int min, int max, int& choice) = 0;
+
+    // Next line of text (the player's name)
+    virtual bool nextLine(string& line) = 0;
+
+    // The "press Enter" pause between rooms
+    virtual bool pause() {
+        string ignored;
+        return nextLine(ignored);
     }
+};
 
-    // This method is crucial to reset potion effects after battle or specific events
-    void resetPotionEffects() {
-        for (Potion* p : potions) {
-            if (p->isUsed()) {
-                // For simplicity, we just reset the usage flag.
-                // A more robust system would involve tracking temporary boosts.
-                p->resetUsage();
-            }
-        }
-        // Reapply equipment bonuses to ensure they are active after potion reset
-        // This is a simplified approach, a more complex one would involve storing base stats
-        // and only applying/removing temporary buffs.
-        // For this current implementation, we'll assume stats reset to their *base*
-        // and then equipped items are reapplied.
-        
-        // Reset to original character stats
-        hp = originalStats[0];
-        maxHp = originalStats[0];
-        atk = originalStats[1];
-        def = originalStats[2];
-        spd = originalStats[3];
-        lck = originalStats[4];
-
-        // Reapply equipment bonuses
-        if (weapon) {
-            applyItemBonuses(weapon);
-        }
-        if (armor) {
-            applyItemBonuses(armor);
+// Reads stdin; a line that is not a number counts as an invalid answer
+class ConsoleInput : public InputProvider {
+public:
+    bool nextChoice(int min, int, int& choice) override {
+        if (!(cin >> choice)) {
+            if (cin.eof()) return false;
+            cin.clear();
+            choice = min - 1;
         }
+        cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear remaining input
+        return true;
     }
-    
-    // Getters
-    Weapon* getEquippedWeapon() const { return weapon; }
-    Armor* getEquippedArmor() const { return armor; }
-    vector<Potion*> getPotions() const { return potions; }
-    int getTotalHealthLost() const { return totalHealthLost; }
-    
-    // Stat management
-    void takeDamage(int damage) override {
-        int healthBefore = hp;
-        Character::takeDamage(damage);
-        totalHealthLost += (healthBefore - hp);
-    }
-    
-    void boostStats(float percentage) {
-        atk = static_cast<int>(atk * (1.0f + percentage / 100.0f));
-        def = static_cast<int>(def * (1.0f + percentage / 100.0f));
-        cout << name << " ha mejorado sus estadísticas (ATK y DEF +" << percentage << "%)." << endl;
-    }
-    
-    void displayEquipment() const {
-        cout << "\n=== Equipamiento de " << name << " ===" << endl;
-        if (weapon) {
-            wcout << "Arma: ";
-            weapon->displayInfo();
-        } else {
-            wcout << "Arma: Ninguna" << endl;
-        }
-        
-        if (armor) {
-            wcout << "Armadura: ";
-            armor->displayInfo();
-        } else {
-            wcout << "Armadura: Ninguna" << endl;
-        }
-        
-        wcout << "Pociones: " << potions.size() << endl;
-        bool hasPotions = false;
-        for (size_t i = 0; i < potions.size(); ++i) {
-            if (!potions[i]->isUsed()) {
-                cout << "  " << (i + 1) << ". ";
-                potions[i]->displayInfo();
-                hasPotions = true;
-            }
-        }
-        if (!hasPotions) {
-            cout << "  Ninguna poción disponible." << endl;
-        }
-        cout << "--------------------------------" << endl;
+
+    bool nextLine(string& line) override { return static_cast<bool>(getline(cin, line)); }
+
+    bool pause() override {
+        cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Consume pending newline
+        cin.get(); // Wait for user to press enter
+        return !cin.eof();
     }
+};
 
+// Plays a recorded session: one answer per line (an empty line for each
+// pause). Lines starting with '#' are comments; "#seed N" gives the master
+// seed the session was recorded with.
+class ScriptInput : public InputProvider {
 private:
-    void applyItemBonuses(Item* item) {
-        if (item->getAffectedStat1() == "ATK") atk += item->getStatBoost1();
-        else if (item->getAffectedStat1() == "DEF") def += item->getStatBoost1();
-        else if (item->getAffectedStat1() == "HP") { 
-            maxHp += item->getStatBoost1(); 
-            hp += item->getStatBoost1(); 
-        }
-        else if (item->getAffectedStat1() == "SPD") spd += item->getStatBoost1();
-        else if (item->getAffectedStat1() == "LCK") lck += item->getStatBoost1();
-        
-        if (item->getStatBoost2() > 0 && !item->getAffectedStat2().empty()) {
-            if (item->getAffectedStat2() == "ATK") atk += item->getStatBoost2();
-            else if (item->getAffectedStat2() == "DEF") def += item->getStatBoost2();
-            else if (item->getAffectedStat2() == "HP") { 
-                maxHp += item->getStatBoost2(); 
-                hp += item->getStatBoost2(); 
+    string text;
+    size_t position = 0;
+    uint64_t recordedSeed = 0;
+    bool seedKnown = false;
+
+    bool next(string_view& line) {
+        while (position < text.size()) {
+            size_t end = text.find('\n', position);
+            if (end == string::npos) end = text.size();
+            line = string_view(text).substr(position, end - position);
+            position = end + 1;
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (line.empty() || line[0] != '#') return true;
+            if (line.substr(0, 6) == "#seed ") {
+                recordedSeed = strtoull(string(line.substr(6)).c_str(), nullptr, 10);
+                seedKnown = true;
             }
-            else if (item->getAffectedStat2() == "SPD") spd += item->getStatBoost2();
-            else if (item->getAffectedStat2() == "LCK") lck += item->getStatBoost2();
         }
+        return false;
     }
-    
-    void removeItemBonuses(Item* item) {
-        if (item->getAffectedStat1() == "ATK") atk -= item->getStatBoost1();
-        else if (item->getAffectedStat1() == "DEF") def -= item->getStatBoost1();
-        else if (item->getAffectedStat1() == "HP") { 
-            maxHp -= item->getStatBoost1(); 
-            hp = min(hp, maxHp); // Cap current HP at new maxHp
-        }
-        else if (item->getAffectedStat1() == "SPD") spd -= item->getStatBoost1();
-        else if (item->getAffectedStat1() == "LCK") lck -= item->getStatBoost1();
-        
-        if (item->getStatBoost2() > 0 && !item->getAffectedStat2().empty()) {
-            if (item->getAffectedStat2() == "ATK") atk -= item->getStatBoost2();
-            else if (item->getAffectedStat2() == "DEF") def -= item->getStatBoost2();
-            else if (item->getAffectedStat2() == "HP") { 
-                maxHp -= item->getStatBoost2(); 
-                hp = min(hp, maxHp); // Cap current HP at new maxHp
-            }
-            else if (item->getAffectedStat2() == "SPD") spd -= item->getStatBoost2();
-            else if (item->getAffectedStat2() == "LCK") lck -= item->getStatBoost2();
-        }
+
+public:
+    explicit ScriptInput(string script) : text(move(script)) {
+        // Read past the header comments now so seed() is known before the game starts
+        string_view first;
+        next(first);
+        position = 0;
+    }
+
+    bool hasSeed() const { return seedKnown; }
+    uint64_t seed() const { return recordedSeed; }
+
+    bool nextChoice(int min, int, int& choice) override {
+        string_view line;
+        if (!next(line)) return false;
+        string number(line);
+        char* parsed = nullptr;
+        long value = strtol(number.c_str(), &parsed, 10);
+        choice = (parsed != number.c_str() && *parsed == '\0') ? static_cast<int>(value) : min - 1;
+        return true;
+    }
+
+    bool nextLine(string& line) override {
+        string_view next;
+        if (!this->next(next)) return false;
+        line.assign(next);
+        return true;
     }
 };
 
-// ===== ENEMY CLASS =====
-class Enemy : public Character {
+// Answers come from code: a bot, an AI player or a test harness. Either
+// callback may return false to end the input.
+class CallbackInput : public InputProvider {
+public:
+    using ChoiceCallback = function<bool(int min, int max, int& choice)>;
+    using LineCallback = function<bool(string& line)>;
+
 private:
-    string type;
+    ChoiceCallback choose;
+    LineCallback line;
 
 public:
-    Enemy(const string& name, int hp, int atk, int def, int spd, int lck, const string& type)
-        : Character(name, hp, atk, def, spd, lck), type(type) {}
-    
-    string getType() const { return type; }
+    CallbackInput(ChoiceCallback choose, LineCallback line) : choose(move(choose)), line(move(line)) {}
+
+    bool nextChoice(int min, int max, int& choice) override { return choose(min, max, choice); }
+    bool nextLine(string& text) override { return line(text); }
 };
 
-// ===== INVENTORY CLASS =====
-class Inventory {
+// Passes another provider's answers through and writes them down as a
+// script ScriptInput can play back
+class RecordingInput : public InputProvider {
 private:
-    vector<Weapon*> weapons;
-    vector<Armor*> armors;
-    vector<Potion*> potions;
-    random_device rd;
-    mt19937 gen;
+    InputProvider& source;
+    ostream& out;
 
 public:
-    Inventory() {
-        gen.seed(rd());
-        initializeItems();
+    RecordingInput(InputProvider& source, ostream& out, uint64_t seed) : source(source), out(out) {
+        out << "#seed " << seed << '\n';
     }
-    
-    ~Inventory() {
-        for (auto weapon : weapons) delete weapon;
-        for (auto armor : armors) delete armor;
-        for (auto potion : potions) delete potion;
+
+    bool nextChoice(int min, int max, int& choice) override {
+        if (!source.nextChoice(min, max, choice)) return false;
+        out << choice << '\n';
+        return true;
     }
-    
-    void initializeItems() {
-        // Weapon names
-        vector<string> weaponNames = {
-            "Machete del Llanero", "Lanza de Totumo", "Botella vacía", "Caña de Pescar Oxidada",
-            "Argolla de sapo", "Chancla Voladora", "Cruceta del carro", "Cuchillo de carnicero",
-            "Pesa de gimnasio", "Sombrero Vueltiao Cortante", "Paraguas de TransMilenio", 
-            "Látigo del Amazonas", "Lapicero PaperMate", "Balón de Microfútbol Golty",
-            "Arepa Caliente", "Alcancía", "Destapador Inmortal", "Bandera de la Selección",
-            "Acordeón Bendecido", "El florero de Llorente"
-        };
-        
-        // Armor names
-        vector<string> armorNames = {
-            "Chaleco de Moto Ratera", "Ruana de la Abuela", "Capa de Lluvia Bogotana",
-            "Camisa de Lino Carretero", "Protección de Baloto", "Armadura de Buseta",
-            "Gabán Antiviral", "Camiseta de Fútbol Sudada", "Chubasquero del Amazonas",
-            "Coraza de Tusa", "Poncho Cafetero", "Protección de Tambores", "Overol de Obrero",
-            "Chaleco de Pesca Urbana", "Cáscara de Bananazo", "Traje de Baile del Carnaval",
-            "Placa de TransMi", "Camiseta del Once Caldas", "Uniforme Escolar Inmortal",
-            "Protector de Cerveza Artesanal"
-        };
+
+    bool nextLine(string& line) override {
+        if (!source.nextLine(line)) return false;
+        out << line << '\n';
+        return true;
+    }
+
+    bool pause() override {
+        if (!source.pause()) return false;
+        out << '\n';
+        return true;
+    }
+};
+
+// Thrown when the active provider runs out of answers; whoever started the
+// game catches it and ends the run there
+struct InputExhausted {};
+
+ConsoleInput consoleInput;
+InputProvider* activeInput = &consoleInput;
+
+// Set while a thread plays one server session, like sessionSink
+thread_local InputProvider* sessionInput = nullptr;
+
+InputProvider* currentInput() { return sessionInput ? sessionInput : activeInput; }
+
+void setInputProvider(InputProvider* input) { activeInput = input ? input : &consoleInput; }
+
+// Utility function for user input
+int getValidatedInput(int min, int max) {
+    int choice;
+    awaitPlayerInput();
+    while (true) {
+        if (!currentInput()->nextChoice(min, max, choice)) throw InputExhausted();
+        if (choice >= min && choice <= max) return choice;
+        gameText() << "Entrada inválida. Por favor, ingresa un número entre " << min << " y " << max << ": ";
+        awaitPlayerInput();
+    }
+}
+
+string getInputLine() {
+    string line;
+    awaitPlayerInput();
+    if (!currentInput()->nextLine(line)) throw InputExhausted();
+    return line;
+}
+
+void waitForEnter() {
+    awaitPlayerInput();
+    if (!currentInput()->pause()) throw InputExhausted();
+}
+
+// ===== TELEMETRY RING =====
+// Live event stream for tools in another process. The game is the only
+// writer of a ring of fixed 64-byte records in a memory-mapped file and
+// never waits for anyone: when the ring is full the oldest records are
+// overwritten. Readers map the same file, attach or detach whenever they
+// like, and follow the published counter. Each record carries its own
+// sequence number, cleared while the record is rewritten, so a reader that
+// fell a full lap behind notices instead of reading a torn record. The
+// payload is moved as relaxed atomic 64-bit words (a seqlock), so a read
+// racing a rewrite is discarded rather than being a data race.
+// Publishing is a handful of plain stores, no syscall and no clock read:
+// readers that want times stamp records when they see them.
+//
+// File: TelemetryHeader (128 bytes), then capacity records.
+const char TELEMETRY_MAGIC[8] = {'S', 'I', 'S', 'A', 'S', 'T', 'L', '1'};
+const uint32_t TELEMETRY_DEFAULT_CAPACITY = 1 << 16;
+const int TELEMETRY_NAME_BYTES = 24;
+
+struct TelemetryHeader {
+    char magic[8];
+    uint32_t recordSize;
+    uint32_t capacity;                  // power of two
+    atomic<uint32_t> closed;            // set when the writer goes away
+    alignas(64) atomic<uint64_t> published; // records written so far
+};
+
+// What a record carries, as laid out in its payload words
+struct TelemetryPayload {
+    uint8_t type;              // EventType
+    uint8_t reserved[3];
+    int32_t value;
+    char actor[TELEMETRY_NAME_BYTES];  // NUL-padded, truncated
+    char target[TELEMETRY_NAME_BYTES];
+};
+
+const int TELEMETRY_PAYLOAD_WORDS = sizeof(TelemetryPayload) / sizeof(uint64_t);
+
+struct TelemetryRecord {
+    atomic<uint64_t> sequence; // index + 1 once complete, 0 while being written
+    atomic<uint64_t> payload[TELEMETRY_PAYLOAD_WORDS];
+};
+
+static_assert(sizeof(TelemetryPayload) % sizeof(uint64_t) == 0, "telemetry payload is whole words");
+static_assert(sizeof(TelemetryRecord) == 64, "telemetry records are one cache line");
+static_assert(sizeof(TelemetryHeader) == 128, "telemetry header layout");
+static_assert(atomic<uint64_t>::is_always_lock_free, "telemetry needs lock-free 64-bit atomics");
+
+// A record copied out of the ring
+struct TelemetryEvent {
+    uint64_t index;
+    EventType type;
+    int value;
+    string actor;
+    string target;
+};
+
+class TelemetryRing {
+private:
+    void* mapping = nullptr;
+    size_t mappedBytes = 0;
+    bool writer = false;
+    TelemetryHeader* header = nullptr;
+    TelemetryRecord* records = nullptr;
+    uint64_t mask = 0;
+    uint64_t next = 0; // writer only
+
+    static void copyName(char* to, string_view name) {
+        size_t n = min(name.size(), static_cast<size_t>(TELEMETRY_NAME_BYTES - 1));
+        memcpy(to, name.data(), n);
+        memset(to + n, 0, TELEMETRY_NAME_BYTES - n);
+    }
+
+public:
+    TelemetryRing() = default;
+    TelemetryRing(const TelemetryRing&) = delete;
+    TelemetryRing& operator=(const TelemetryRing&) = delete;
+
+    ~TelemetryRing() {
+#ifndef _WIN32
+        if (!mapping) return;
+        if (writer) header->closed.store(1, memory_order_release);
+        munmap(mapping, mappedBytes);
+#endif
+    }
+
+    bool isOpen() const { return mapping != nullptr; }
+    uint32_t capacity() const { return header->capacity; }
+
+    // Creates (or truncates) path as a ring of capacity records (rounded up
+    // to a power of two) and becomes its writer
+    bool create(const string& path, uint32_t capacity = TELEMETRY_DEFAULT_CAPACITY) {
+#ifdef _WIN32
+        (void)path;
+        (void)capacity;
+        return false;
+#else
+        uint32_t size = 1;
+        while (size < capacity) size <<= 1;
+        size_t bytes = sizeof(TelemetryHeader) + static_cast<size_t>(size) * sizeof(TelemetryRecord);
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        bool sized = ftruncate(fd, bytes) == 0;
+        void* map = sized ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (map == MAP_FAILED) return false;
+        mapping = map;
+        mappedBytes = bytes;
+        writer = true;
+        header = static_cast<TelemetryHeader*>(map);
+        records = reinterpret_cast<TelemetryRecord*>(static_cast<char*>(map) + sizeof(TelemetryHeader));
+        mask = size - 1;
+        header->recordSize = sizeof(TelemetryRecord);
+        header->capacity = size;
+        header->closed.store(0, memory_order_relaxed);
+        header->published.store(0, memory_order_relaxed);
+        // The magic goes last: readers ignore the file until it is complete
+        atomic_thread_fence(memory_order_release);
+        memcpy(header->magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC));
+        return true;
+#endif
+    }
+
+    // Maps an existing ring read-only
+    bool attach(const string& path) {
+#ifdef _WIN32
+        (void)path;
+        return false;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        off_t bytes = lseek(fd, 0, SEEK_END);
+        void* map = (bytes >= static_cast<off_t>(sizeof(TelemetryHeader)))
+            ? mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (map == MAP_FAILED) return false;
+        const TelemetryHeader* h = static_cast<const TelemetryHeader*>(map);
+        bool valid = memcmp(h->magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC)) == 0
+            && h->recordSize == sizeof(TelemetryRecord) && h->capacity && (h->capacity & (h->capacity - 1)) == 0
+            && sizeof(TelemetryHeader) + static_cast<size_t>(h->capacity) * sizeof(TelemetryRecord) <= static_cast<size_t>(bytes);
+        if (!valid) {
+            munmap(map, bytes);
+            return false;
+        }
+        mapping = map;
+        mappedBytes = bytes;
+        header = static_cast<TelemetryHeader*>(map);
+        records = reinterpret_cast<TelemetryRecord*>(static_cast<char*>(map) + sizeof(TelemetryHeader));
+        mask = header->capacity - 1;
+        return true;
+#endif
+    }
+
+    // Writer side, one thread only
+    void publish(const GameEvent& e) {
+        TelemetryPayload payload = TelemetryPayload();
+        payload.type = e.type;
+        payload.value = e.value;
+        copyName(payload.actor, e.actor);
+        copyName(payload.target, e.target);
+        uint64_t words[TELEMETRY_PAYLOAD_WORDS];
+        memcpy(words, &payload, sizeof(words));
+
+        TelemetryRecord& r = records[next & mask];
+        r.sequence.store(0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release); // readers see the 0 before the new payload
+        for (int w = 0; w < TELEMETRY_PAYLOAD_WORDS; ++w) r.payload[w].store(words[w], memory_order_relaxed);
+        r.sequence.store(next + 1, memory_order_release);
+        header->published.store(++next, memory_order_release);
+    }
+
+    // Reader side
+    uint64_t published() const { return header->published.load(memory_order_acquire); }
+    bool writerClosed() const { return header->closed.load(memory_order_acquire) != 0; }
+
+    // Copies record index; false if it was overwritten (or is being written)
+    bool read(uint64_t index, TelemetryEvent& out) const {
+        const TelemetryRecord& r = records[index & mask];
+        if (r.sequence.load(memory_order_acquire) != index + 1) return false;
+        uint64_t words[TELEMETRY_PAYLOAD_WORDS];
+        for (int w = 0; w < TELEMETRY_PAYLOAD_WORDS; ++w) words[w] = r.payload[w].load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire); // the payload loads happen before the re-check
+        if (r.sequence.load(memory_order_relaxed) != index + 1) return false;
+        TelemetryPayload copy;
+        memcpy(&copy, words, sizeof(copy));
+        if (copy.type >= EVENT_COUNT) return false;
+        out.index = index;
+        out.type = static_cast<EventType>(copy.type);
+        out.value = copy.value;
+        out.actor.assign(copy.actor, strnlen(copy.actor, TELEMETRY_NAME_BYTES));
+        out.target.assign(copy.target, strnlen(copy.target, TELEMETRY_NAME_BYTES));
+        return true;
+    }
+};
+
+// Publishes every event to the ring and passes everything on to the sink
+// that was active before, so text and --events keep working alongside
+class TelemetrySink : public MessageSink {
+private:
+    MessageSink& inner;
+    TelemetryRing& ring;
+
+public:
+    TelemetrySink(MessageSink& inner, TelemetryRing& ring) : inner(inner), ring(ring) {}
+
+    ostream* text() override { return inner.text(); }
+
+    void event(const GameEvent& e) override {
+        ring.publish(e);
+        inner.event(e);
+    }
+
+    void flush() override { inner.flush(); }
+    void awaitInput() override { inner.awaitInput(); }
+};
+
+// ===== TRACING =====
+// Scoped spans for finding which phase a stall belongs to. Build with
+// -DSISAS_TRACE and every TRACE_SPAN("name") records its start and duration
+// into its thread's own buffer (no lock, no syscall besides the clock); at
+// the end of main the buffers go to a Chrome trace-event JSON file
+// (--trace FILE, default sisas_trace.json) that chrome://tracing and
+// Perfetto open. Without SISAS_TRACE, TRACE_SPAN expands to nothing.
+#if defined(SISAS_TRACE)
+const size_t TRACE_MAX_EVENTS_PER_THREAD = 1 << 20; // later spans are counted as dropped
+
+struct TraceEvent {
+    const char* name; // string literal
+    int64_t startNanos;
+    int64_t durationNanos;
+};
+
+struct TraceBuffer {
+    int thread;
+    vector<TraceEvent> events;
+    uint64_t dropped = 0;
+};
+
+class TraceRegistry {
+private:
+    mutex buffersMutex; // taken once per thread and when writing the file
+    vector<unique_ptr<TraceBuffer>> buffers;
+    chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+
+public:
+    int64_t now() const { return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count(); }
+
+    TraceBuffer& threadBuffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        if (!buffer) {
+            lock_guard<mutex> lock(buffersMutex);
+            buffers.push_back(unique_ptr<TraceBuffer>(new TraceBuffer{static_cast<int>(buffers.size()) + 1, {}}));
+            buffer = buffers.back().get();
+            buffer->events.reserve(4096);
+        }
+        return *buffer;
+    }
+
+    // Call once the threads that record have stopped
+    bool write(const string& path) {
+        ofstream out(path);
+        lock_guard<mutex> lock(buffersMutex);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        uint64_t dropped = 0;
+        for (const unique_ptr<TraceBuffer>& buffer : buffers) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread
+                << ",\"args\":{\"name\":\"hilo " << buffer->thread << "\"}}";
+            first = false;
+            for (const TraceEvent& e : buffer->events) {
+                out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread
+                    << ",\"ts\":" << e.startNanos / 1000 << '.' << setw(3) << setfill('0') << e.startNanos % 1000
+                    << ",\"dur\":" << e.durationNanos / 1000 << '.' << setw(3) << e.durationNanos % 1000 << setfill(' ') << '}';
+            }
+            dropped += buffer->dropped;
+        }
+        out << "\n],\"otherData\":{\"dropped_spans\":" << dropped << "}}\n";
+        return static_cast<bool>(out);
+    }
+};
+
+TraceRegistry traceRegistry;
+
+class TraceSpan {
+private:
+    const char* name;
+    int64_t start;
+
+public:
+    explicit TraceSpan(const char* name) : name(name), start(traceRegistry.now()) {}
+
+    ~TraceSpan() {
+        int64_t end = traceRegistry.now();
+        TraceBuffer& buffer = traceRegistry.threadBuffer();
+        if (buffer.events.size() < TRACE_MAX_EVENTS_PER_THREAD) {
+            buffer.events.push_back({name, start, end - start});
+        } else {
+            ++buffer.dropped;
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#else
+#define TRACE_SPAN(name) ((void)0)
+#endif
+
+// ===== RANDOM NUMBER GENERATION =====
+// xoshiro256** (Blackman & Vigna): 32 bytes of state, a few cycles per draw and
+// trivially cheap to seed. All game randomness goes through Rng objects handed
+// out by an RngService, so a whole run is reproducible from one master seed.
+// Bounded draws use our own multiply-shift instead of uniform_int_distribution,
+// whose output differs between standard libraries.
+uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+class Rng {
+private:
+    uint64_t s[4];
+
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+public:
+    // Satisfies UniformRandomBitGenerator, so std::shuffle and friends accept it
+    using result_type = uint64_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    explicit Rng(uint64_t seedValue = 0) { seed(seedValue); }
+
+    void seed(uint64_t seedValue) {
+        for (uint64_t& word : s) {
+            word = splitmix64(seedValue);
+        }
+    }
+
+    uint64_t operator()() {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform integer in [0, n), n > 0. Bias is below n / 2^32, which is
+    // invisible for the small ranges the game uses.
+    int below(int n) {
+        return static_cast<int>(((operator()() >> 32) * static_cast<uint64_t>(n)) >> 32);
+    }
+
+    // Uniform integer in [lo, hi], same contract as uniform_int_distribution<>(lo, hi)
+    int between(int lo, int hi) {
+        return lo + below(hi - lo + 1);
+    }
+
+    // Percentile roll in [1, 100]
+    int roll100() {
+        return below(100) + 1;
+    }
+
+    // Raw state, for replays that need to resume a stream exactly
+    void getState(uint64_t out[4]) const { memcpy(out, s, sizeof(s)); }
+    void setState(const uint64_t in[4]) { memcpy(s, in, sizeof(s)); }
+};
+
+// Identifies each independent random stream of a run
+enum RngStreamId : uint64_t {
+    STREAM_INVENTORY = 1,
+    STREAM_DUNGEON = 2,
+    STREAM_BATTLE = 3,
+    STREAM_REWARDS = 4,
+    STREAM_SIMULATION = 5,
+    STREAM_ENDLESS = 6,   // index: room depth
+    STREAM_SESSIONS = 7,  // index: server session, the master seed of its run
+};
+
+class RngService {
+private:
+    uint64_t masterSeed;
+
+public:
+    explicit RngService(uint64_t masterSeed) : masterSeed(masterSeed) {}
+
+    uint64_t getMasterSeed() const { return masterSeed; }
+
+    // Seed of the given stream; distinct ids give unrelated sequences
+    uint64_t streamSeed(uint64_t streamId, uint64_t index = 0) const {
+        uint64_t mix = masterSeed ^ (streamId * 0xD1B54A32D192ED03ULL);
+        splitmix64(mix);
+        mix ^= index * 0x9E3779B97F4A7C15ULL;
+        return splitmix64(mix);
+    }
+
+    Rng stream(uint64_t streamId, uint64_t index = 0) const {
+        return Rng(streamSeed(streamId, index));
+    }
+
+    // Fresh master seed for runs started without --seed
+    static uint64_t randomSeed() {
+        random_device rd;
+        return (static_cast<uint64_t>(rd()) << 32) ^ rd();
+    }
+};
+
+// ===== STAT MODIFIERS =====
+// Stats are a compact enum so items can describe their effect as fixed
+// (stat, delta) pairs resolved once at construction; equipping applies them
+// with plain indexed adds instead of comparing stat names.
+enum Stat : uint8_t {
+    STAT_HP,
+    STAT_ATK,
+    STAT_DEF,
+    STAT_SPD,
+    STAT_LCK,
+    STAT_COUNT
+};
+
+constexpr const char* STAT_NAMES[STAT_COUNT] = {"HP", "ATK", "DEF", "SPD", "LCK"};
+
+constexpr const char* statName(Stat stat) {
+    return STAT_NAMES[stat];
+}
+
+// Returns false if text is not one of STAT_NAMES
+bool parseStat(const string& text, Stat& stat) {
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        if (text == STAT_NAMES[i]) {
+            stat = static_cast<Stat>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct StatModifier {
+    Stat stat;
+    int delta;
+};
+
+// Item rarity tiers, indexed the same way as RARITY_NAMES
+enum Rarity : uint8_t {
+    RARITY_COMMON,
+    RARITY_RARE,
+    RARITY_CONSUMABLE,
+    RARITY_COUNT
+};
+
+constexpr const char* RARITY_NAMES[RARITY_COUNT] = {"Common", "Rare", "Consumible"};
+
+Rarity parseRarity(const string& text) {
+    for (int i = 0; i < RARITY_COUNT; ++i) {
+        if (text == RARITY_NAMES[i]) return static_cast<Rarity>(i);
+    }
+    return RARITY_COMMON;
+}
+
+// Items affect at most two stats; unused entries carry a zero delta
+const int MAX_ITEM_MODIFIERS = 2;
+typedef array<StatModifier, MAX_ITEM_MODIFIERS> ItemModifiers;
+
+// ===== RUN ARENA =====
+// Process-wide count of global operator new calls, so benchmarks can show
+// which code paths still reach malloc. Only the benchmarks turn it on; games
+// pay a relaxed load per allocation, not a shared read-modify-write.
+atomic<uint64_t> heapAllocations(0);
+atomic<bool> countHeapAllocations(false);
+
+// Kept out of line: once inlined, GCC sees malloc()/free() meet operator
+// new/delete at each call site and warns about a mismatch that is not there
+#ifdef __GNUC__
+#define SISAS_NOINLINE __attribute__((noinline))
+#else
+#define SISAS_NOINLINE
+#endif
+
+SISAS_NOINLINE void* operator new(size_t size) {
+    if (countHeapAllocations.load(memory_order_relaxed)) heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+SISAS_NOINLINE void operator delete(void* p) noexcept { free(p); }
+SISAS_NOINLINE void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Monotonic arena for everything that lives exactly one run: the team, the
+// rooms and their enemies, and the battle bookkeeping. Allocation is a pointer
+// bump; reset() runs the destructors of the objects made with create() and
+// rewinds to the first chunk, keeping every chunk for the next run, so after
+// the first run a new one never touches the heap. It doubles as a
+// pmr::memory_resource so run-scoped containers can draw from it too.
+class RunArena : public pmr::memory_resource {
+private:
+    struct Chunk {
+        char* data;
+        size_t size;
+    };
+    struct Cleanup {
+        void (*destroy)(void*);
+        void* object;
+        Cleanup* next;
+    };
+
+    vector<Chunk> chunks;
+    size_t current = 0;     // chunk being filled
+    size_t offset = 0;      // first free byte in it
+    size_t chunkSize;
+    Cleanup* cleanups = nullptr;
+
+    // Offset of the first address at or after `from` in chunk that is
+    // aligned; chunks themselves are only aligned for max_align_t
+    size_t alignedOffset(const Chunk& chunk, size_t from, size_t alignment) const {
+        uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data);
+        return ((base + from + alignment - 1) & ~(alignment - 1)) - base;
+    }
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        while (current < chunks.size()) {
+            size_t start = alignedOffset(chunks[current], offset, alignment);
+            if (start + bytes <= chunks[current].size) {
+                offset = start + bytes;
+                return chunks[current].data + start;
+            }
+            ++current;
+            offset = 0;
+        }
+        size_t size = max(chunkSize, bytes + alignment);
+        chunks.push_back({static_cast<char*>(::operator new(size)), size});
+        current = chunks.size() - 1;
+        size_t start = alignedOffset(chunks[current], 0, alignment);
+        offset = start + bytes;
+        return chunks[current].data + start;
+    }
+
+    // Memory comes back all at once in reset()
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+    explicit RunArena(size_t chunkSize = 16 * 1024) : chunkSize(chunkSize) {}
+
+    RunArena(const RunArena&) = delete;
+    RunArena& operator=(const RunArena&) = delete;
+
+    ~RunArena() {
+        reset();
+        for (const Chunk& chunk : chunks) ::operator delete(chunk.data);
+    }
+
+    // Constructs a T owned by the arena; it is destroyed by reset()
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+        if (!is_trivially_destructible<T>::value) {
+            Cleanup* cleanup = static_cast<Cleanup*>(allocate(sizeof(Cleanup), alignof(Cleanup)));
+            *cleanup = {[](void* p) { static_cast<T*>(p)->~T(); }, object, cleanups};
+            cleanups = cleanup;
+        }
+        return object;
+    }
+
+    // Destroys every created object (newest first) and rewinds; chunks are kept
+    void reset() {
+        for (Cleanup* c = cleanups; c; c = c->next) c->destroy(c->object);
+        cleanups = nullptr;
+        current = 0;
+        offset = 0;
+    }
+
+    size_t chunkCount() const { return chunks.size(); }
+
+    size_t bytesReserved() const {
+        size_t total = 0;
+        for (const Chunk& chunk : chunks) total += chunk.size;
+        return total;
+    }
+};
+
+// ===== CHARACTER CLASS (BASE ABSTRACT CLASS) =====
+class Character {
+protected:
+    pmr::string name;
+    int hp;
+    int maxHp;
+    int atk;
+    int def;
+    int spd;
+    int lck;
+
+    // Field each Stat modifies; HP modifiers raise the cap (maxHp)
+    static constexpr int Character::* STAT_FIELDS[STAT_COUNT] = {
+        &Character::maxHp, &Character::atk, &Character::def, &Character::spd, &Character::lck
+    };
+
+public:
+    Character(string_view name, int hp, int atk, int def, int spd, int lck,
+              pmr::memory_resource* resource = pmr::get_default_resource())
+        : name(name, resource), hp(hp), maxHp(hp), atk(atk), def(def), spd(spd), lck(lck) {}
+    
+    virtual ~Character() = default;
+    
+    // Getters
+    string_view getName() const { return name; }
+    int getHp() const { return hp; }
+    int getMaxHp() const { return maxHp; }
+    int getAtk() const { return atk; }
+    int getDef() const { return def; }
+    int getSpd() const { return spd; }
+    int getLck() const { return lck; }
+    
+    // Setters (for stat boosts)
+    void setAtk(int val) { atk = val; }
+    void setDef(int val) { def = val; }
+    void setSpd(int val) { spd = val; }
+    void setLck(int val) { lck = val; }
+    void setHp(int val) { hp = val; }
+    void setMaxHp(int val) { maxHp = val; }
+
+
+    // Health management
+    virtual void takeDamage(int damage) {
+        hp = max(0, hp - damage);
+    }
+    
+    void heal(int amount) {
+        hp = min(maxHp, hp + amount);
+    }
+    
+    bool isAlive() const {
+        return hp > 0;
+    }
+    
+    // Combat rules, shared with replay playback
+    static int hitChance(int attackerLck, int defenderLck) {
+        int chance = 85 + (attackerLck - defenderLck) * 2;
+        return max(10, min(95, chance)); // Clamp between 10-95%
+    }
+
+    static int damage(int attackerAtk, int defenderDef, bool critical) {
+        int baseDamage = max(1, attackerAtk - defenderDef);
+        return critical ? static_cast<int>(baseDamage * 1.5) : baseDamage;
+    }
+
+    // Combat methods; roll, if given, receives the percentile drawn
+    bool calculateHitChance(const Character* defender, Rng& rng, int* roll = nullptr) const {
+        int hitRoll = rng.roll100();
+        if (roll) *roll = hitRoll;
+        return hitRoll <= hitChance(lck, defender->lck);
+    }
+    
+    int calculateDamage(const Character* defender, Rng& rng, int* critRoll = nullptr) const {
+        // Critical hit chance based on luck
+        int roll = rng.roll100();
+        if (critRoll) *critRoll = roll;
+        int baseDamage = damage(atk, defender->def, roll <= lck);
+        if (roll <= lck) {
+            gameText() << "¡Golpe crítico!" << '\n';
+            emitEvent(EVENT_CRITICAL_HIT, name, defender->name, baseDamage);
+        }
         
-        // Potion names
-        vector<string> potionNames = {
-            "Aguapanela Hirviente", "Vive100", "Lechona Mágica", "Juan Váldez Carga Triple",
-            "Jugo de tomate de arbol", "Changua Bendita", "Aguardiente del Valle",
-            "Aguardiente Antioqueño", "Cholado Energético", "Lulada Espiritual"
-        };
+        return baseDamage;
+    }
+    
+    void displayStats() const {
+        gameText() << name << " - HP: " << hp << "/" << maxHp 
+             << " ATK: " << atk << " DEF: " << def 
+             << " SPD: " << spd << " LCK: " << lck << '\n';
+    }
+};
+
+// ===== ITEM CLASS (BASE ABSTRACT CLASS) =====
+class Item {
+protected:
+    string name;
+    string rarity;
+    int statBoost1;
+    int statBoost2;
+    string affectedStat1;
+    string affectedStat2;
+    ItemModifiers modifiers;
+    Rarity rarityTier;
+
+    static StatModifier makeModifier(const string& stat, int boost) {
+        StatModifier mod = {STAT_ATK, 0};
+        if (boost > 0 && parseStat(stat, mod.stat)) {
+            mod.delta = boost;
+        }
+        return mod;
+    }
+
+public:
+    Item(const string& name, const string& rarity, int boost1, int boost2, 
+         const string& stat1, const string& stat2)
+        : name(name), rarity(rarity), statBoost1(boost1), statBoost2(boost2),
+          affectedStat1(stat1), affectedStat2(stat2),
+          modifiers{{makeModifier(stat1, boost1), makeModifier(stat2, boost2)}},
+          rarityTier(parseRarity(rarity)) {}
+    
+    virtual ~Item() = default;
+    
+    // Getters
+    const string& getName() const { return name; }
+    const string& getRarity() const { return rarity; }
+    Rarity getRarityTier() const { return rarityTier; }
+    int getStatBoost1() const { return statBoost1; }
+    int getStatBoost2() const { return statBoost2; }
+    const string& getAffectedStat1() const { return affectedStat1; }
+    const string& getAffectedStat2() const { return affectedStat2; }
+    const ItemModifiers& getModifiers() const { return modifiers; }
+    
+    virtual void displayInfo() const {
+        gameText() << name << " (" << rarity << ") - " 
+             << affectedStat1 << " +" << statBoost1;
+        if (statBoost2 > 0 && !affectedStat2.empty()) { // Ensure second stat is meaningful
+            gameText() << ", " << affectedStat2 << " +" << statBoost2;
+        }
+        gameText() << '\n';
+    }
+};
+
+// ===== WEAPON CLASS =====
+class Weapon : public Item {
+public:
+    Weapon(const string& name, const string& rarity, int atkBoost, int secondaryBoost, const string& secondaryStat)
+        : Item(name, rarity, atkBoost, secondaryBoost, "ATK", secondaryStat) {}
+    
+    string getWeaponType() const { return "Weapon"; }
+};
+
+// ===== ARMOR CLASS =====
+class Armor : public Item {
+public:
+    Armor(const string& name, const string& rarity, int defBoost, int secondaryBoost, const string& secondaryStat)
+        : Item(name, rarity, defBoost, secondaryBoost, "DEF", secondaryStat) {}
+    
+    string getArmorType() const { return "Armor"; }
+};
+
+// ===== POTION CLASS =====
+// Only the definition; whether a hero already drank it is per-run state
+// kept in a PotionInstance.
+class Potion : public Item {
+public:
+    Potion(const string& name, int boost1, int boost2, const string& stat1, const string& stat2)
+        : Item(name, "Consumible", boost1, boost2, stat1, stat2) {}
+};
+
+// One potion handed out during a run: the shared definition plus its owner
+// and usage, so two heroes (or two runs) holding the same Potion never see
+// each other's state.
+struct PotionInstance {
+    const Potion* potion;
+    const Hero* owner;
+    bool used;
+};
+
+// ===== HERO CLASS =====
+// A hero's stats come in layers: base (roster) stats, equipment modifiers,
+// timed buffs (potions in effect) and permanent growth (the post-battle
+// boosts, compounded):
+//
+//     effective = (base + equipment) * growth + buffs
+//
+// The Character fields cache the effective stats, so combat reads them as
+// plain loads. Changing a layer marks only the stats it touches as dirty and
+// recomputes those, each from the layers rather than from the previous
+// value, so no sequence of equips, potions and boosts can make them drift.
+class Hero : public Character {
+private:
+    const Weapon* weapon;
+    const Armor* armor;
+    vector<PotionInstance*> potions;
+    int totalHealthLost;
+    int baseStats[STAT_COUNT];
+    int equipmentMods[STAT_COUNT] = {}; // weapon + armor
+    int buffMods[STAT_COUNT] = {};      // potions in effect
+    double growth[STAT_COUNT];          // permanent multiplier, 1 = no growth
+    uint32_t dirtyStats = 0;            // bit per Stat awaiting refreshStats()
+
+public:
+    Hero(string_view name, int hp, int atk, int def, int spd, int lck,
+         pmr::memory_resource* resource = pmr::get_default_resource())
+        : Character(name, hp, atk, def, spd, lck, resource), weapon(nullptr), armor(nullptr), totalHealthLost(0),
+          baseStats{hp, atk, def, spd, lck} {
+        fill(begin(growth), end(growth), 1.0);
+    }
+    
+    // Equipment management
+    void equipWeapon(const Weapon* newWeapon) {
+        if (weapon) addModifiers(equipmentMods, weapon, -1); // Remove old weapon bonuses if exists
+        weapon = newWeapon;
+        if (weapon) addModifiers(equipmentMods, weapon, 1);
+        refreshStats();
+    }
+    
+    void equipArmor(const Armor* newArmor) {
+        if (armor) addModifiers(equipmentMods, armor, -1); // Remove old armor bonuses if exists
+        armor = newArmor;
+        if (armor) addModifiers(equipmentMods, armor, 1);
+        refreshStats();
+    }
+    
+    void addPotion(PotionInstance* potion) {
+        potions.push_back(potion);
+    }
+    
+    void usePotion(int index) {
+        if (index >= 0 && index < potions.size() && !potions[index]->used) {
+            const Potion* potion = potions[index]->potion;
+            addModifiers(buffMods, potion, 1);
+            refreshStats();
+            potions[index]->used = true;
+            gameText() << name << " usa " << potion->getName() << "!" << '\n';
+            emitEvent(EVENT_POTION_USED, name, potion->getName());
+        } else {
+             gameText() << "No puedes usar esa poción." << '\n';
+        }
+    }
+
+    // Ends a drunk potion's effect early (timed effects); the potion stays used
+    void expirePotion(int index) {
+        const Potion* potion = potions[index]->potion;
+        addModifiers(buffMods, potion, -1);
+        refreshStats();
+        gameText() << "El efecto de " << potion->getName() << " se acaba para " << name << "." << '\n';
+        emitEvent(EVENT_EFFECT_EXPIRED, name, potion->getName());
+    }
+
+    // Ends every potion effect and makes the potions drinkable again, with
+    // HP back to full; equipment and growth stay
+    void resetPotionEffects() {
+        for (PotionInstance* p : potions) {
+            p->used = false;
+        }
+        for (int stat = 0; stat < STAT_COUNT; ++stat) {
+            if (buffMods[stat] != 0) dirtyStats |= 1u << stat;
+            buffMods[stat] = 0;
+        }
+        refreshStats();
+        hp = maxHp;
+    }
+    
+    // Getters
+    const Weapon* getEquippedWeapon() const { return weapon; }
+    const Armor* getEquippedArmor() const { return armor; }
+    const vector<PotionInstance*>& getPotions() const { return potions; }
+    int getTotalHealthLost() const { return totalHealthLost; }
+    
+    // Stat management
+    void takeDamage(int damage) override {
+        int healthBefore = hp;
+        Character::takeDamage(damage);
+        totalHealthLost += (healthBefore - hp);
+    }
+    
+    void boostStats(float percentage) {
+        for (Stat stat : {STAT_ATK, STAT_DEF}) {
+            growth[stat] *= 1.0 + percentage / 100.0;
+            dirtyStats |= 1u << stat;
+        }
+        refreshStats();
+        gameText() << name << " ha mejorado sus estadísticas (ATK y DEF +" << percentage << "%)." << '\n';
+    }
+    
+    void displayEquipment() const {
+        gameText() << "\n=== Equipamiento de " << name << " ===" << '\n';
+        if (weapon) {
+            gameText() << "Arma: ";
+            weapon->displayInfo();
+        } else {
+            gameText() << "Arma: Ninguna" << '\n';
+        }
+        
+        if (armor) {
+            gameText() << "Armadura: ";
+            armor->displayInfo();
+        } else {
+            gameText() << "Armadura: Ninguna" << '\n';
+        }
+        
+        gameText() << "Pociones: " << potions.size() << '\n';
+        bool hasPotions = false;
+        for (size_t i = 0; i < potions.size(); ++i) {
+            if (!potions[i]->used) {
+                gameText() << "  " << (i + 1) << ". ";
+                potions[i]->potion->displayInfo();
+                hasPotions = true;
+            }
+        }
+        if (!hasPotions) {
+            gameText() << "  Ninguna poción disponible." << '\n';
+        }
+        gameText() << "--------------------------------" << '\n';
+    }
+
+private:
+    // Constant time and allocation-free: one indexed add per modifier
+    void addModifiers(int* layer, const Item* item, int sign) {
+        for (const StatModifier& mod : item->getModifiers()) {
+            if (mod.delta == 0) continue;
+            layer[mod.stat] += sign * mod.delta;
+            dirtyStats |= 1u << mod.stat;
+        }
+    }
+
+    // Recomputes the dirty stats from their layers. A higher max HP also
+    // heals by the difference; a lower one caps current HP.
+    void refreshStats() {
+        for (int stat = 0; stat < STAT_COUNT; ++stat) {
+            if (!(dirtyStats & (1u << stat))) continue;
+            int value = static_cast<int>((baseStats[stat] + equipmentMods[stat]) * growth[stat]) + buffMods[stat];
+            if (stat == STAT_HP) {
+                int gained = value - maxHp;
+                maxHp = value;
+                hp = gained > 0 ? hp + gained : min(hp, maxHp);
+            } else {
+                this->*STAT_FIELDS[stat] = value;
+            }
+        }
+        dirtyStats = 0;
+    }
+};
+
+// ===== ENEMY CLASS =====
+class Enemy : public Character {
+private:
+    string type;
+
+public:
+    Enemy(string_view name, int hp, int atk, int def, int spd, int lck, string_view type,
+          pmr::memory_resource* resource = pmr::get_default_resource())
+        : Character(name, hp, atk, def, spd, lck, resource), type(type) {}
+    
+    string getType() const { return type; }
+};
+
+// ===== ROSTER TABLES =====
+// Base stats for every playable hero and every enemy. Game builds its characters
+// from these tables and the headless simulator reads them directly.
+struct CharacterTemplate {
+    const char* name;
+    int hp;
+    int atk;
+    int def;
+    int spd;
+    int lck;
+    const char* type;
+};
+
+// Hero base stats (HP, ATK, DEF, SPD, LCK)
+const CharacterTemplate HERO_ROSTER[] = {
+    {"Caleño",   100, 15, 10, 8, 7, "Héroe"},
+    {"Costeño",  110, 12, 12, 6, 9, "Héroe"},
+    {"Paisa",     90, 18,  8, 10, 5, "Héroe"},
+    {"Amazonas",  95, 14, 11, 7, 8, "Héroe"},
+    {"Llanero",  120, 13, 13, 5, 6, "Héroe"},
+    {"Chocoano",  85, 17,  9, 9, 7, "Héroe"},
+};
+const int HERO_ROSTER_SIZE = sizeof(HERO_ROSTER) / sizeof(HERO_ROSTER[0]);
+
+const CharacterTemplate ENEMY_ROSTER[] = {
+    // Soldier (HP, ATK, DEF, SPD, LCK)
+    {"El Mindo",           40,  8,  5,  7,  6, "Soldado"},
+    {"Betty la Fea",       45,  7,  6,  8,  7, "Soldado"},
+    {"Carlos Vives",       50,  9,  6,  6,  5, "Soldado"},
+    {"Diva Jessurum",      42,  9,  4,  9,  8, "Soldado"},
+    {"Falcao García",      55, 11,  7,  7,  6, "Soldado"},
+    {"Shakira",            48, 10,  5,  8,  7, "Soldado"},
+    {"Juanes",             52, 10,  6,  7,  6, "Soldado"},
+    {"Maluma",             47,  8,  7,  9,  5, "Soldado"},
+    {"J Balvin",           49,  9,  6,  8,  6, "Soldado"},
+    {"Karol G",            46, 10,  5,  7,  8, "Soldado"},
+    {"Gabo",               44,  8,  6,  9,  7, "Soldado"},
+    {"El Pibe Valderrama", 51, 10,  7,  6,  5, "Soldado"},
+
+    // Mini-Boss (HP, ATK, DEF, SPD, LCK)
+    {"Pablo Escobar",      80, 25, 10, 18, 25, "Mini-Jefe"},
+    {"Alias Tiro Fijo",    75, 24, 11,  7, 16, "Mini-Jefe"},
+    {"La Liendra",         90, 23,  9,  9, 17, "Mini-Jefe"},
+
+    // Final Boss (HP, ATK, DEF, SPD, LCK)
+    {"PETRO",             150, 35, 15, 10, 20, "Jefe Final"},
+    {"Gozo con Gonzo",     90, 45, 25, 18, 16, "Jefe Final"},
+};
+const int ENEMY_ROSTER_SIZE = sizeof(ENEMY_ROSTER) / sizeof(ENEMY_ROSTER[0]);
+
+// Horde rooms fill up with this one; weak alone, dangerous by the dozen
+const CharacterTemplate HORDE_MINION = {"Barrista", 10, 9, 2, 6, 4, "Horda"};
+const int HORDE_ROOM = 5;          // the horde takes this room's place
+const int HORDE_DEFAULT_SIZE = 24;
+
+const CharacterTemplate* findEnemyTemplate(string_view name) {
+    for (const CharacterTemplate& t : ENEMY_ROSTER) {
+        if (name == t.name) return &t;
+    }
+    return nullptr;
+}
+
+// Enemy line-up of one room, fixed capacity so building it never allocates
+const int MAX_ROOM_ENEMIES = 3;
+
+struct RoomLayout {
+    const CharacterTemplate* enemies[MAX_ROOM_ENEMIES];
+    int count = 0;
+
+    void push_back(const CharacterTemplate* t) { enemies[count++] = t; }
+    const CharacterTemplate* const* begin() const { return enemies; }
+    const CharacterTemplate* const* end() const { return enemies + count; }
+};
+
+// Enemy line-up for a dungeon room (1-10). Fixed rooms always get the same
+// enemies; regular rooms draw 2-3 soldiers from gen.
+RoomLayout buildRoomLayout(int roomNumber, Rng& gen) {
+    RoomLayout layout;
+    if (roomNumber == 3) { // Special event room: Mini-boss
+        layout.push_back(findEnemyTemplate("Pablo Escobar"));
+        layout.push_back(findEnemyTemplate("La Liendra"));
+    } else if (roomNumber == 6) { // Special event room: Mini-boss
+        layout.push_back(findEnemyTemplate("Alias Tiro Fijo"));
+        layout.push_back(findEnemyTemplate("El Mindo"));
+        layout.push_back(findEnemyTemplate("Betty la Fea"));
+    } else if (roomNumber == 8) { // Special event room: Reward room
+        layout.push_back(findEnemyTemplate("Carlos Vives"));
+        layout.push_back(findEnemyTemplate("Diva Jessurum"));
+    } else if (roomNumber == 10) { // Final boss room
+        layout.push_back(findEnemyTemplate("Gozo con Gonzo"));
+        layout.push_back(findEnemyTemplate("PETRO"));
+    } else { // Regular rooms
+        int numEnemies = gen.between(2, 3);
+        for (int e = 0; e < numEnemies; ++e) {
+            int enemyType = gen.between(0, ENEMY_ROSTER_SIZE - 4); // Exclude mini-bosses and final boss for regular rooms
+            layout.push_back(&ENEMY_ROSTER[enemyType]);
+        }
+    }
+    return layout;
+}
+
+// ===== ALIAS TABLE =====
+// Walker/Vose alias method: O(n) build, O(1) weighted draw with one random
+// index and one threshold compare.
+class AliasTable {
+private:
+    vector<uint32_t> threshold; // P(keep column i) scaled to 2^32
+    vector<uint32_t> alias;
+
+public:
+    AliasTable() = default;
+
+    explicit AliasTable(const vector<double>& weights) { build(weights); }
+
+    void build(const vector<double>& weights) {
+        size_t n = weights.size();
+        threshold.assign(n, 0);
+        alias.assign(n, 0);
+        double total = 0;
+        for (double w : weights) total += max(0.0, w);
+        if (n == 0 || total <= 0) {
+            threshold.clear();
+            alias.clear();
+            return;
+        }
+
+        vector<double> scaled(n);
+        vector<uint32_t> small, large;
+        for (size_t i = 0; i < n; ++i) {
+            scaled[i] = max(0.0, weights[i]) * n / total;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back();
+            small.pop_back();
+            uint32_t l = large.back();
+            threshold[s] = static_cast<uint32_t>(min(scaled[s] * 4294967296.0, 4294967295.0));
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // Leftovers are 1.0 up to rounding
+        for (uint32_t i : large) { threshold[i] = UINT32_MAX; alias[i] = i; }
+        for (uint32_t i : small) { threshold[i] = UINT32_MAX; alias[i] = i; }
+    }
+
+    bool empty() const { return threshold.empty(); }
+    size_t size() const { return threshold.size(); }
+
+    // Index drawn with probability weight[i] / sum(weights)
+    int sample(Rng& rng) const {
+        uint64_t bits = rng();
+        uint32_t column = static_cast<uint32_t>(((bits >> 32) * threshold.size()) >> 32);
+        return static_cast<uint32_t>(bits) < threshold[column] ? column : alias[column];
+    }
+};
+
+// Item families a loot table can hand out
+enum ItemCategory : uint8_t {
+    CATEGORY_WEAPON,
+    CATEGORY_ARMOR,
+    CATEGORY_POTION,
+    CATEGORY_COUNT
+};
+
+struct LootEntry {
+    ItemCategory category;
+    Rarity rarity;
+    double weight;
+};
+
+// Weighted (category, rarity) odds for one source of loot, e.g. a room
+class LootTable {
+private:
+    vector<LootEntry> entries;
+    AliasTable table;
+
+public:
+    LootTable() = default;
+
+    explicit LootTable(const vector<LootEntry>& lootEntries) : entries(lootEntries) {
+        vector<double> weights;
+        for (const LootEntry& e : entries) weights.push_back(e.weight);
+        table.build(weights);
+    }
+
+    bool empty() const { return table.empty(); }
+    const vector<LootEntry>& getEntries() const { return entries; }
+
+    const LootEntry& sample(Rng& rng) const { return entries[table.sample(rng)]; }
+
+    // Weapon, armor or potion with equal odds, the classic room reward
+    static LootTable uniform(Rarity rarity) {
+        return LootTable({{CATEGORY_WEAPON, rarity, 1}, {CATEGORY_ARMOR, rarity, 1}, {CATEGORY_POTION, RARITY_CONSUMABLE, 1}});
+    }
+};
+
+// ===== ITEM CATALOG =====
+// Every weapon, armor and potion definition of a game, rolled once from an
+// inventory stream and read-only afterwards. Nothing in it changes after the
+// constructor, so any number of runs and threads can share one catalog
+// (through a shared_ptr<const ItemCatalog>) without copies or locks.
+class ItemCatalog {
+private:
+    vector<Weapon> weapons;
+    vector<Armor> armors;
+    vector<Potion> potions;
+    // Catalog indexed by rarity at build time, so draws never filter
+    vector<const Weapon*> weaponsByRarity[RARITY_COUNT];
+    vector<const Armor*> armorsByRarity[RARITY_COUNT];
+    vector<const Potion*> potionList;
+
+    void indexItems() {
+        for (const Weapon& weapon : weapons) weaponsByRarity[weapon.getRarityTier()].push_back(&weapon);
+        for (const Armor& armor : armors) armorsByRarity[armor.getRarityTier()].push_back(&armor);
+        for (const Potion& potion : potions) potionList.push_back(&potion);
+    }
+
+public:
+    // Rolls the item stats from gen, leaving it advanced past them
+    explicit ItemCatalog(Rng& gen) {
+        initializeItems(gen);
+    }
+
+    ItemCatalog(const ItemCatalog&) = delete; // the index points into the item vectors
+    ItemCatalog& operator=(const ItemCatalog&) = delete;
+
+    const vector<const Weapon*>& weaponsOf(Rarity rarity) const { return weaponsByRarity[rarity]; }
+    const vector<const Armor*>& armorsOf(Rarity rarity) const { return armorsByRarity[rarity]; }
+    const vector<const Potion*>& getPotions() const { return potionList; }
+
+    vector<const Weapon*> getAllWeapons() const {
+        vector<const Weapon*> all;
+        for (const Weapon& weapon : weapons) all.push_back(&weapon);
+        return all;
+    }
+
+    vector<const Armor*> getAllArmors() const {
+        vector<const Armor*> all;
+        for (const Armor& armor : armors) all.push_back(&armor);
+        return all;
+    }
+
+private:
+    void initializeItems(Rng& gen) {
+        TRACE_SPAN("ItemCatalog::initializeItems");
+        // Weapon names
+        vector<string> weaponNames = {
+            "Machete del Llanero", "Lanza de Totumo", "Botella vacía", "Caña de Pescar Oxidada",
+            "Argolla de sapo", "Chancla Voladora", "Cruceta del carro", "Cuchillo de carnicero",
+            "Pesa de gimnasio", "Sombrero Vueltiao Cortante", "Paraguas de TransMilenio", 
+            "Látigo del Amazonas", "Lapicero PaperMate", "Balón de Microfútbol Golty",
+            "Arepa Caliente", "Alcancía", "Destapador Inmortal", "Bandera de la Selección",
+            "Acordeón Bendecido", "El florero de Llorente"
+        };
+        
+        // Armor names
+        vector<string> armorNames = {
+            "Chaleco de Moto Ratera", "Ruana de la Abuela", "Capa de Lluvia Bogotana",
+            "Camisa de Lino Carretero", "Protección de Baloto", "Armadura de Buseta",
+            "Gabán Antiviral", "Camiseta de Fútbol Sudada", "Chubasquero del Amazonas",
+            "Coraza de Tusa", "Poncho Cafetero", "Protección de Tambores", "Overol de Obrero",
+            "Chaleco de Pesca Urbana", "Cáscara de Bananazo", "Traje de Baile del Carnaval",
+            "Placa de TransMi", "Camiseta del Once Caldas", "Uniforme Escolar Inmortal",
+            "Protector de Cerveza Artesanal"
+        };
+        
+        // Potion names
+        vector<string> potionNames = {
+            "Aguapanela Hirviente", "Vive100", "Lechona Mágica", "Juan Váldez Carga Triple",
+            "Jugo de tomate de arbol", "Changua Bendita", "Aguardiente del Valle",
+            "Aguardiente Antioqueño", "Cholado Energético", "Lulada Espiritual"
+        };
+        
+        vector<string> secondaryStats = {"HP", "DEF", "SPD", "LCK"};
+        
+        // Create weapons (10 common, 10 rare)
+        weapons.reserve(20);
+        for (int i = 0; i < 20; ++i) {
+            string rarity = (i < 10) ? "Common" : "Rare";
+            // Common: +4-5 ATK + boost menor = 6-7 points total
+            // Rare: +5-7 ATK + boost fuerte = 8-10 points total
+            int atkBoost = (rarity == "Common") ? gen.between(4, 5) : gen.between(5, 7);
+            int secondaryBoost = (rarity == "Common") ? gen.between(2, 3) : gen.between(3, 5);
+            
+            string secondaryStat = secondaryStats[gen.below(secondaryStats.size())];
+            
+            weapons.emplace_back(weaponNames[i], rarity, atkBoost, secondaryBoost, secondaryStat);
+        }
+        
+        // Create armors (10 common, 10 rare)
+        armors.reserve(20);
+        for (int i = 0; i < 20; ++i) {
+            string rarity = (i < 10) ? "Common" : "Rare";
+            // Common: +4-5 DEF + boost menor = 6-7 points total
+            // Rare: +5-7 DEF + boost fuerte = 8-10 points total
+            int defBoost = (rarity == "Common") ? gen.between(4, 5) : gen.between(5, 7);
+            int secondaryBoost = (rarity == "Common") ? gen.between(2, 3) : gen.between(3, 5);
+            
+            string secondaryStat = secondaryStats[gen.below(secondaryStats.size())];
+            
+            armors.emplace_back(armorNames[i], rarity, defBoost, secondaryBoost, secondaryStat);
+        }
+        
+        // Create potions
+        vector<string> potionStats = {"HP", "ATK", "DEF", "SPD", "LCK"};
+        potions.reserve(10);
+        for (int i = 0; i < 10; ++i) {
+            string stat1 = potionStats[gen.below(potionStats.size())];
+            string stat2;
+            do {
+                stat2 = potionStats[gen.below(potionStats.size())];
+            } while (stat2 == stat1); // Ensure two different stats
+            
+            int boost1 = gen.between(3, 5); // 6-9 points total
+            int boost2 = gen.between(3, 5);
+            
+            potions.emplace_back(potionNames[i], boost1, boost2, stat1, stat2);
+        }
+        indexItems();
+    }
+};
+
+// ===== INVENTORY CLASS =====
+// One game's view of a shared ItemCatalog: its own draw stream and the
+// per-run instance table of the potions handed to heroes. Weapons and
+// armors carry no state of their own, so heroes point straight at the
+// catalog's definitions.
+class Inventory {
+private:
+    shared_ptr<const ItemCatalog> catalog;
+    deque<PotionInstance> potionInstances; // deque: heroes keep pointers into it
+    Rng gen;
+
+public:
+    Inventory(shared_ptr<const ItemCatalog> catalog, const Rng& rng) : catalog(move(catalog)), gen(rng) {}
+
+    const ItemCatalog& getCatalog() const { return *catalog; }
+
+    // Forgets the previous run's potions; call once the heroes holding them are gone
+    void startRun() { potionInstances.clear(); }
+
+    // Same, for a new game reusing this inventory: draws continue from rng
+    void startRun(const Rng& rng) {
+        gen = rng;
+        startRun();
+    }
+
+    // Hands a fresh, unused copy of potion to owner's run
+    PotionInstance* grantPotion(const Potion* potion, const Hero* owner) {
+        potionInstances.push_back({potion, owner, false});
+        return &potionInstances.back();
+    }
+
+    size_t grantedPotions() const { return potionInstances.size(); }
+    
+    // O(1), allocation-free draws from the rarity buckets
+    const Weapon* getRandomWeapon(Rarity rarity) {
+        const vector<const Weapon*>& bucket = catalog->weaponsOf(rarity);
+        if (bucket.empty()) return nullptr;
+        return bucket[gen.below(bucket.size())];
+    }
+    
+    const Armor* getRandomArmor(Rarity rarity) {
+        const vector<const Armor*>& bucket = catalog->armorsOf(rarity);
+        if (bucket.empty()) return nullptr;
+        return bucket[gen.below(bucket.size())];
+    }
+    
+    // Every draw is a new potion for the run, so any definition can come up
+    const Potion* getRandomPotion() {
+        const vector<const Potion*>& potions = catalog->getPotions();
+        if (potions.empty()) return nullptr;
+        return potions[gen.below(potions.size())];
+    }
+
+    // Draws an item following a weighted loot table
+    const Item* getRandomItem(const LootTable& loot, Rng& rng) {
+        if (loot.empty()) return nullptr;
+        const LootEntry& entry = loot.sample(rng);
+        switch (entry.category) {
+            case CATEGORY_WEAPON: {
+                const vector<const Weapon*>& bucket = catalog->weaponsOf(entry.rarity);
+                return bucket.empty() ? nullptr : bucket[rng.below(bucket.size())];
+            }
+            case CATEGORY_ARMOR: {
+                const vector<const Armor*>& bucket = catalog->armorsOf(entry.rarity);
+                return bucket.empty() ? nullptr : bucket[rng.below(bucket.size())];
+            }
+            default: {
+                const vector<const Potion*>& potions = catalog->getPotions();
+                return potions.empty() ? nullptr : potions[rng.below(potions.size())];
+            }
+        }
+    }
+};
+
+// ===== INITIATIVE TIMELINE =====
+// ATB-style turn order: a combatant that acts is put back on the timeline
+// INITIATIVE_SCALE / SPD time units later, so twice the SPD means twice the
+// turns. Entries live in a binary min-heap ordered by (time, sequence); the
+// sequence keeps ties in scheduling order, so the order is deterministic.
+// Scheduling and taking the next entry are O(log n) for any number of
+// combatants. Entries of units that died are dropped when they come up
+// rather than searched for.
+enum TurnOrder : uint8_t {
+    TURN_ORDER_INITIATIVE, // SPD-driven timeline
+    TURN_ORDER_ALTERNATE   // classic: teams alternate, SPD only picks who opens
+};
+
+enum TimelineKind : uint8_t {
+    TIMELINE_HERO,
+    TIMELINE_ENEMY
+};
+
+const uint64_t INITIATIVE_SCALE = 100000;
+const int POTION_EFFECT_ACTIONS = 3; // --potion-turns default: the drinker's turns a timed potion lasts
+
+struct TimelineEntry {
+    uint64_t time;
+    uint64_t sequence;
+    TimelineKind kind;
+    int unit;
+
+    bool operator>(const TimelineEntry& other) const {
+        return time != other.time ? time > other.time : sequence > other.sequence;
+    }
+};
+
+class InitiativeTimeline {
+private:
+    pmr::vector<TimelineEntry> heap;
+    uint64_t now = 0;
+    uint64_t sequence = 0;
+
+public:
+    explicit InitiativeTimeline(pmr::memory_resource* resource = pmr::get_default_resource()) : heap(resource) {}
+
+    // Time until a unit with this SPD acts again
+    static uint64_t actionDelay(int spd) { return INITIATIVE_SCALE / static_cast<uint64_t>(max(1, spd)); }
+
+    void clear() {
+        heap.clear();
+        now = 0;
+        sequence = 0;
+    }
+
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
+    uint64_t time() const { return now; }
+
+    void schedule(uint64_t delay, TimelineKind kind, int unit) {
+        heap.push_back({now + delay, sequence++, kind, unit});
+        push_heap(heap.begin(), heap.end(), greater<TimelineEntry>());
+    }
+
+    // Earliest entry; the timeline's clock moves to its time
+    TimelineEntry pop() {
+        pop_heap(heap.begin(), heap.end(), greater<TimelineEntry>());
+        TimelineEntry next = heap.back();
+        heap.pop_back();
+        now = next.time;
+        return next;
+    }
+};
+
+// ===== ALIVE SETS =====
+// Living members of one side of a battle, so rooms with thousands of
+// combatants cost the same per turn as rooms with three. A dense array with
+// swap-remove answers "how many are left" and "pick the k-th" in O(1); a
+// circular list through the survivors in roster order keeps the classic
+// round robin (each side cycles through its living members) O(1) as well.
+// A fallen member is unlinked once, when it dies.
+class AliveSet {
+private:
+    pmr::vector<int> members;  // living roster indices, any order
+    pmr::vector<int> slot;     // roster index -> position in members, -1 once fallen
+    pmr::vector<int> nextLink; // next living member in roster order (circular)
+    pmr::vector<int> prevLink;
+    int cursor = -1;           // member whose round-robin turn comes next
+
+public:
+    explicit AliveSet(pmr::memory_resource* resource = pmr::get_default_resource())
+        : members(resource), slot(resource), nextLink(resource), prevLink(resource) {}
+
+    template <typename T>
+    void reset(const pmr::vector<T*>& side) {
+        members.clear();
+        slot.assign(side.size(), -1);
+        nextLink.assign(side.size(), -1);
+        prevLink.assign(side.size(), -1);
+        for (size_t i = 0; i < side.size(); ++i) {
+            if (!side[i]->isAlive()) continue;
+            slot[i] = static_cast<int>(members.size());
+            members.push_back(static_cast<int>(i));
+        }
+        for (size_t k = 0; k < members.size(); ++k) { // members is in roster order here
+            nextLink[members[k]] = members[(k + 1) % members.size()];
+            prevLink[members[k]] = members[(k + members.size() - 1) % members.size()];
+        }
+        cursor = members.empty() ? -1 : members[0];
+    }
+
+    size_t count() const { return members.size(); }
+    bool empty() const { return members.empty(); }
+    bool contains(int index) const { return slot[index] >= 0; }
+    int pick(size_t k) const { return members[k]; }
+
+    // Round robin: the member that acts now; -1 if nobody is left
+    int takeTurn() {
+        int unit = cursor;
+        if (unit >= 0) cursor = nextLink[unit];
+        return unit;
+    }
+
+    // unit acted out of round-robin order (initiative timeline)
+    void passTurn(int unit) { cursor = nextLink[unit]; }
+    int upcoming() const { return cursor; }
+
+    void remove(int index) {
+        int position = slot[index];
+        if (position < 0) return;
+        int last = members.back();
+        members[position] = last;
+        slot[last] = position;
+        members.pop_back();
+        slot[index] = -1;
+        if (members.empty()) {
+            cursor = -1;
+            return;
+        }
+        nextLink[prevLink[index]] = nextLink[index];
+        prevLink[nextLink[index]] = prevLink[index];
+        if (cursor == index) cursor = nextLink[index];
+    }
+};
+
+// ===== COMBAT METRICS =====
+// Counters from real and simulated battles: attacks by attacker type (hero
+// class or enemy type), damage histograms per room, potions drunk, health
+// lost per hero class and kills per enemy type. Each thread that fights
+// gets its own cache-line-aligned block and is the only one writing it, so
+// a count is a plain load, add and store: no locked instruction, no line
+// bouncing between cores. Exporting sums every block, including those of
+// threads that already finished. Collection is off unless enabled; Battle
+// looks its thread's block up once per battle and skips all counting when
+// there is none.
+const char* const METRIC_ENEMY_TYPES[] = {"Soldado", "Mini-Jefe", "Jefe Final", "Horda"};
+const int METRIC_ENEMY_TYPE_COUNT = sizeof(METRIC_ENEMY_TYPES) / sizeof(METRIC_ENEMY_TYPES[0]) + 1; // last: any other type
+const int METRIC_HERO_CLASS_COUNT = HERO_ROSTER_SIZE + 1; // last: not from the roster
+const int METRIC_ROOM_COUNT = 12;    // 0: unknown, 1-10, 11: deeper endless rooms
+const int METRIC_DAMAGE_BUCKETS = 9; // upper bounds 1, 2, 4, ..., 128 and +Inf
+
+enum MetricOutcome { METRIC_HIT, METRIC_MISS, METRIC_CRIT, METRIC_OUTCOMES }; // a crit is also a hit
+
+int metricHeroClass(string_view name) {
+    for (int i = 0; i < HERO_ROSTER_SIZE; ++i) {
+        if (name == HERO_ROSTER[i].name) return i;
+    }
+    return HERO_ROSTER_SIZE;
+}
+
+int metricEnemyType(string_view type) {
+    for (int i = 0; i + 1 < METRIC_ENEMY_TYPE_COUNT; ++i) {
+        if (type == METRIC_ENEMY_TYPES[i]) return i;
+    }
+    return METRIC_ENEMY_TYPE_COUNT - 1;
+}
+
+int metricRoom(int roomNumber) { return max(0, min(METRIC_ROOM_COUNT - 1, roomNumber)); }
+
+int metricDamageBucket(int damage) {
+    int bucket = 0;
+    while (bucket + 1 < METRIC_DAMAGE_BUCKETS && damage > (1 << bucket)) ++bucket;
+    return bucket;
+}
+
+// Every counter, as live per-thread atomics or as merged plain totals
+template <typename Counter>
+struct CombatCounters {
+    Counter battles;
+    Counter heroWins;
+    Counter heroAttacks[METRIC_HERO_CLASS_COUNT][METRIC_OUTCOMES];
+    Counter enemyAttacks[METRIC_ENEMY_TYPE_COUNT][METRIC_OUTCOMES];
+    Counter damage[METRIC_ROOM_COUNT][2][METRIC_DAMAGE_BUCKETS]; // [room][0 heroes hit, 1 enemies hit][bucket]
+    Counter damageSum[METRIC_ROOM_COUNT][2];
+    Counter potionsUsed[METRIC_HERO_CLASS_COUNT];
+    Counter healthLost[METRIC_HERO_CLASS_COUNT];
+    Counter kills[METRIC_ENEMY_TYPE_COUNT];
+};
+
+using CombatTotals = CombatCounters<uint64_t>;
+
+// One thread's block. Only its owner writes, so += is a relaxed load and store.
+struct alignas(64) CombatMetrics : CombatCounters<atomic<uint64_t>> {
+    static void add(atomic<uint64_t>& counter, uint64_t n = 1) {
+        counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+};
+
+static_assert(sizeof(atomic<uint64_t>) == sizeof(uint64_t), "merge walks the counters as a flat array");
+const size_t METRIC_COUNTERS = sizeof(CombatTotals) / sizeof(uint64_t);
+
+class CombatMetricsRegistry {
+private:
+    mutable mutex blocksMutex; // taken once per thread and on export, never while counting
+    vector<unique_ptr<CombatMetrics>> blocks;
+    atomic<bool> enabled{false};
+
+public:
+    void enable() { enabled.store(true); }
+
+    // The calling thread's block, or nullptr while collection is off
+    CombatMetrics* threadBlock() {
+        if (!enabled.load(memory_order_relaxed)) return nullptr;
+        thread_local CombatMetrics* block = nullptr;
+        if (!block) {
+            lock_guard<mutex> lock(blocksMutex);
+            blocks.push_back(unique_ptr<CombatMetrics>(new CombatMetrics())); // value-initialized: all zero
+            block = blocks.back().get();
+        }
+        return block;
+    }
+
+    CombatTotals merge() const {
+        CombatTotals totals = {};
+        uint64_t* out = reinterpret_cast<uint64_t*>(&totals);
+        lock_guard<mutex> lock(blocksMutex);
+        for (const unique_ptr<CombatMetrics>& block : blocks) {
+            const atomic<uint64_t>* in = reinterpret_cast<const atomic<uint64_t>*>(static_cast<const CombatCounters<atomic<uint64_t>>*>(block.get()));
+            for (size_t i = 0; i < METRIC_COUNTERS; ++i) out[i] += in[i].load(memory_order_relaxed);
+        }
+        return totals;
+    }
+};
+
+CombatMetricsRegistry combatMetrics;
+
+string metricHeroClassName(int heroClass) { return heroClass < HERO_ROSTER_SIZE ? HERO_ROSTER[heroClass].name : "otro"; }
+string metricEnemyTypeName(int type) { return type + 1 < METRIC_ENEMY_TYPE_COUNT ? METRIC_ENEMY_TYPES[type] : "otro"; }
+string metricRoomName(int room) { return room == 0 ? "desconocida" : room + 1 == METRIC_ROOM_COUNT ? to_string(room) + "+" : to_string(room); }
+
+const char* const METRIC_OUTCOME_NAMES[METRIC_OUTCOMES] = {"hit", "miss", "crit"};
+const char* const METRIC_SIDE_NAMES[2] = {"hero", "enemy"}; // who took the damage
+
+// Prometheus text exposition format
+void writeMetricsPrometheus(ostream& out, const CombatTotals& t) {
+    out << "# HELP sisas_battles_total Battles fought.\n# TYPE sisas_battles_total counter\n";
+    out << "sisas_battles_total " << t.battles << '\n';
+    out << "# HELP sisas_hero_wins_total Battles the heroes won.\n# TYPE sisas_hero_wins_total counter\n";
+    out << "sisas_hero_wins_total " << t.heroWins << '\n';
+
+    out << "# HELP sisas_attacks_total Attacks by attacker type and outcome (crits are also hits).\n";
+    out << "# TYPE sisas_attacks_total counter\n";
+    for (int c = 0; c < METRIC_HERO_CLASS_COUNT; ++c) {
+        for (int o = 0; o < METRIC_OUTCOMES; ++o) {
+            out << "sisas_attacks_total{side=\"hero\",attacker=\"" << metricHeroClassName(c) << "\",outcome=\""
+                << METRIC_OUTCOME_NAMES[o] << "\"} " << t.heroAttacks[c][o] << '\n';
+        }
+    }
+    for (int e = 0; e < METRIC_ENEMY_TYPE_COUNT; ++e) {
+        for (int o = 0; o < METRIC_OUTCOMES; ++o) {
+            out << "sisas_attacks_total{side=\"enemy\",attacker=\"" << metricEnemyTypeName(e) << "\",outcome=\""
+                << METRIC_OUTCOME_NAMES[o] << "\"} " << t.enemyAttacks[e][o] << '\n';
+        }
+    }
+
+    out << "# HELP sisas_damage Damage of each hit, by room and by the side that took it.\n";
+    out << "# TYPE sisas_damage histogram\n";
+    for (int r = 0; r < METRIC_ROOM_COUNT; ++r) {
+        for (int s = 0; s < 2; ++s) {
+            uint64_t cumulative = 0;
+            for (int b = 0; b < METRIC_DAMAGE_BUCKETS; ++b) cumulative += t.damage[r][s][b];
+            if (cumulative == 0) continue; // rooms nobody fought in
+            string labels = "room=\"" + metricRoomName(r) + "\",side=\"" + METRIC_SIDE_NAMES[s] + "\"";
+            cumulative = 0;
+            for (int b = 0; b < METRIC_DAMAGE_BUCKETS; ++b) {
+                cumulative += t.damage[r][s][b];
+                out << "sisas_damage_bucket{" << labels << ",le=\""
+                    << (b + 1 < METRIC_DAMAGE_BUCKETS ? to_string(1 << b) : string("+Inf")) << "\"} " << cumulative << '\n';
+            }
+            out << "sisas_damage_sum{" << labels << "} " << t.damageSum[r][s] << '\n';
+            out << "sisas_damage_count{" << labels << "} " << cumulative << '\n';
+        }
+    }
+
+    out << "# HELP sisas_potions_used_total Potions drunk, by hero class.\n# TYPE sisas_potions_used_total counter\n";
+    for (int c = 0; c < METRIC_HERO_CLASS_COUNT; ++c) {
+        out << "sisas_potions_used_total{hero_class=\"" << metricHeroClassName(c) << "\"} " << t.potionsUsed[c] << '\n';
+    }
+    out << "# HELP sisas_health_lost_total Health lost (totalHealthLost), by hero class.\n# TYPE sisas_health_lost_total counter\n";
+    for (int c = 0; c < METRIC_HERO_CLASS_COUNT; ++c) {
+        out << "sisas_health_lost_total{hero_class=\"" << metricHeroClassName(c) << "\"} " << t.healthLost[c] << '\n';
+    }
+    out << "# HELP sisas_kills_total Enemies defeated, by enemy type.\n# TYPE sisas_kills_total counter\n";
+    for (int e = 0; e < METRIC_ENEMY_TYPE_COUNT; ++e) {
+        out << "sisas_kills_total{enemy_type=\"" << metricEnemyTypeName(e) << "\"} " << t.kills[e] << '\n';
+    }
+}
+
+void writeMetricsJson(ostream& out, const CombatTotals& t) {
+    out << "{\n  \"battles\": " << t.battles << ",\n  \"hero_wins\": " << t.heroWins << ",\n  \"attacks\": {\n    \"hero\": {";
+    for (int c = 0; c < METRIC_HERO_CLASS_COUNT; ++c) {
+        out << (c ? ", " : "") << '"' << metricHeroClassName(c) << "\": {";
+        for (int o = 0; o < METRIC_OUTCOMES; ++o) out << (o ? ", " : "") << '"' << METRIC_OUTCOME_NAMES[o] << "\": " << t.heroAttacks[c][o];
+        out << '}';
+    }
+    out << "},\n    \"enemy\": {";
+    for (int e = 0; e < METRIC_ENEMY_TYPE_COUNT; ++e) {
+        out << (e ? ", " : "") << '"' << metricEnemyTypeName(e) << "\": {";
+        for (int o = 0; o < METRIC_OUTCOMES; ++o) out << (o ? ", " : "") << '"' << METRIC_OUTCOME_NAMES[o] << "\": " << t.enemyAttacks[e][o];
+        out << '}';
+    }
+    out << "}\n  },\n  \"damage_bucket_bounds\": [";
+    for (int b = 0; b + 1 < METRIC_DAMAGE_BUCKETS; ++b) out << (b ? ", " : "") << (1 << b);
+    out << "],\n  \"damage\": [";
+    bool first = true;
+    for (int r = 0; r < METRIC_ROOM_COUNT; ++r) {
+        for (int s = 0; s < 2; ++s) {
+            uint64_t count = 0;
+            for (int b = 0; b < METRIC_DAMAGE_BUCKETS; ++b) count += t.damage[r][s][b];
+            if (count == 0) continue;
+            out << (first ? "\n" : ",\n") << "    {\"room\": \"" << metricRoomName(r) << "\", \"side\": \"" << METRIC_SIDE_NAMES[s]
+                << "\", \"count\": " << count << ", \"sum\": " << t.damageSum[r][s] << ", \"buckets\": [";
+            for (int b = 0; b < METRIC_DAMAGE_BUCKETS; ++b) out << (b ? ", " : "") << t.damage[r][s][b];
+            out << "]}";
+            first = false;
+        }
+    }
+    out << "\n  ],\n  \"potions_used\": {";
+    for (int c = 0; c < METRIC_HERO_CLASS_COUNT; ++c) out << (c ? ", " : "") << '"' << metricHeroClassName(c) << "\": " << t.potionsUsed[c];
+    out << "},\n  \"health_lost\": {";
+    for (int c = 0; c < METRIC_HERO_CLASS_COUNT; ++c) out << (c ? ", " : "") << '"' << metricHeroClassName(c) << "\": " << t.healthLost[c];
+    out << "},\n  \"kills\": {";
+    for (int e = 0; e < METRIC_ENEMY_TYPE_COUNT; ++e) out << (e ? ", " : "") << '"' << metricEnemyTypeName(e) << "\": " << t.kills[e];
+    out << "}\n}\n";
+}
+
+// Turns collection on and writes the merged counters to path when it goes
+// out of scope: JSON if path ends in .json, Prometheus text otherwise
+class CombatMetricsFile {
+private:
+    string path;
+
+public:
+    explicit CombatMetricsFile(string path) : path(move(path)) {
+        if (!this->path.empty()) combatMetrics.enable();
+    }
+
+    ~CombatMetricsFile() {
+        if (path.empty()) return;
+        ofstream out(path);
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json) {
+            writeMetricsJson(out, combatMetrics.merge());
+        } else {
+            writeMetricsPrometheus(out, combatMetrics.merge());
+        }
+        if (!out) cout << "Error con el archivo: " << path << endl;
+    }
+};
+
+//Battle class
+
+// Sees every resolved turn of a Battle; the replay recorder hooks in here.
+// Combatants are identified by their index in the battle's hero/enemy list.
+class BattleObserver {
+public:
+    virtual ~BattleObserver() = default;
+    virtual void battleStarted(const pmr::vector<Hero*>& heroes, const pmr::vector<Enemy*>& enemies, const Rng& rng) = 0;
+    // critRoll is 0 when the attack missed
+    virtual void attackResolved(bool enemyAttacks, int actor, int target, int hitRoll, int critRoll, int damage) = 0;
+    virtual void potionUsed(int hero, int slot, const ItemModifiers& effect) = 0;
+    // A potion's effect ran out (initiative turn order only)
+    virtual void potionExpired(int hero, int slot, const ItemModifiers& effect) = 0;
+    virtual void battleEnded(bool heroesWon) = 0;
+};
+
+// What a hero does on its turn: attack an enemy (index in the battle's enemy
+// list, or ANY_ENEMY) or drink a potion (index in the hero's potion list).
+struct HeroDecision {
+    static const int ANY_ENEMY = -1; // whichever living enemy is cheapest to reach, O(1)
+
+    bool usePotion = false;
+    int index = 0;
+};
+
+// Chooses hero actions instead of the console prompt. heroIndex/enemyIndex
+// are the living members whose round-robin turn comes next on each side,
+// after the acting hero was picked.
+class HeroPolicy {
+public:
+    virtual ~HeroPolicy() = default;
+    virtual HeroDecision decide(const pmr::vector<Hero*>& heroes, const pmr::vector<Enemy*>& enemies,
+                                int actingHero, size_t heroIndex, size_t enemyIndex) = 0;
+};
+
+class Battle {
+private:
+    pmr::vector<Hero*> heroes;
+    pmr::vector<Enemy*> enemies;
+    Rng& rng;
+    BattleObserver* observer;
+    HeroPolicy* policy;
+
+    AliveSet livingHeroes;  // who can still act or be targeted, kept as units fall
+    AliveSet livingEnemies;
+    bool heroesTurn = true; // Indica qué equipo ataca ahora
+    TurnOrder turnOrder = TURN_ORDER_INITIATIVE;
+    InitiativeTimeline timeline;
+    // Timed potions (opt-in): 0 keeps the classic rule, a potion's bonus
+    // lasts the whole run. Otherwise it wears off at the start of the
+    // drinker's potionActions-th turn after drinking, under either turn order.
+    struct PotionTimer {
+        int hero;
+        int slot;
+        int turnsLeft;
+    };
+    int potionActions = 0;
+    pmr::vector<PotionTimer> potionTimers;
+    int roomNumber = 0;
+    CombatMetrics* metrics = nullptr; // this thread's counters while collection is on
+    pmr::vector<uint8_t> heroClasses; // metric class/type of each combatant
+    pmr::vector<uint8_t> enemyTypes;
+
+public:
+    // The battle's own lists come from the same memory as the room's enemies
+    Battle(const vector<Hero*>& heroes, const pmr::vector<Enemy*>& enemies, Rng& rng,
+           BattleObserver* observer = nullptr, HeroPolicy* policy = nullptr)
+        : heroes(heroes.begin(), heroes.end(), enemies.get_allocator()),
+          enemies(enemies, enemies.get_allocator()), rng(rng), observer(observer), policy(policy),
+          livingHeroes(enemies.get_allocator().resource()), livingEnemies(enemies.get_allocator().resource()),
+          timeline(enemies.get_allocator().resource()), potionTimers(enemies.get_allocator().resource()),
+          heroClasses(enemies.get_allocator().resource()),
+          enemyTypes(enemies.get_allocator().resource()) {}
+
+    void setTurnOrder(TurnOrder order) { turnOrder = order; }
+
+    // Potions drunk in this battle wear off after actions of the drinker's
+    // turns (0 = they last the whole run)
+    void setPotionDuration(int actions) { potionActions = max(0, actions); }
+
+    // Room the battle is fought in, for the per-room metrics
+    void setRoomNumber(int number) { roomNumber = number; }
+
+    // Plays the whole battle; hero turns go to the policy or the console
+    bool startBattle() {
+        TRACE_SPAN("Battle::startBattle");
+        begin();
+        while (!isOver()) {
+            TRACE_SPAN("Battle::turn");
+            TimelineKind kind;
+            int unit;
+            if (!nextTurn(kind, unit)) continue;
+            if (kind == TIMELINE_HERO) {
+                heroAction(unit);
+            } else {
+                enemyAction(unit);
+            }
+            endTurn(kind, unit);
+        }
+        return finish();
+    }
+
+private:
+    void begin() {
+        gameText() << "\n--- ¡Una batalla ha comenzado! ---" << '\n';
+        emitEvent(EVENT_BATTLE_STARTED, {}, {}, static_cast<int>(enemies.size()));
+        if (observer) observer->battleStarted(heroes, enemies, rng);
+
+        livingHeroes.reset(heroes);
+        livingEnemies.reset(enemies);
+        potionTimers.clear();
+
+        metrics = combatMetrics.threadBlock();
+        if (metrics) {
+            CombatMetrics::add(metrics->battles);
+            heroClasses.clear();
+            for (Hero* hero : heroes) heroClasses.push_back(static_cast<uint8_t>(metricHeroClass(hero->getName())));
+            enemyTypes.clear();
+            for (Enemy* enemy : enemies) enemyTypes.push_back(static_cast<uint8_t>(metricEnemyType(enemy->getType())));
+        }
+
+        if (turnOrder == TURN_ORDER_INITIATIVE) {
+            // Everyone's first turn comes after one action delay, so the fastest
+            // unit opens; on equal SPD heroes go first, as in decideFirstTurn.
+            timeline.clear();
+            for (size_t i = 0; i < heroes.size(); ++i) {
+                if (heroes[i]->isAlive()) timeline.schedule(InitiativeTimeline::actionDelay(heroes[i]->getSpd()), TIMELINE_HERO, static_cast<int>(i));
+            }
+            for (size_t i = 0; i < enemies.size(); ++i) {
+                if (enemies[i]->isAlive()) timeline.schedule(InitiativeTimeline::actionDelay(enemies[i]->getSpd()), TIMELINE_ENEMY, static_cast<int>(i));
+            }
+        } else {
+            // Decide quién inicia (más SPD entre héroes y enemigos vivos)
+            heroesTurn = decideFirstTurn();
+        }
+    }
+
+    // Timed potion effects still running when the battle ends wear off with it.
+    bool finish() {
+        for (const PotionTimer& timer : potionTimers) expirePotion(timer.hero, timer.slot);
+        potionTimers.clear();
+
+        displayBattleStatus();
+
+        bool heroesWon = getWinner() == "Heroes";
+        if (observer) observer->battleEnded(heroesWon);
+        if (metrics && heroesWon) CombatMetrics::add(metrics->heroWins);
+        if (heroesWon) {
+            gameText() << "\n¡Los héroes han ganado la batalla!" << '\n';
+            emitEvent(EVENT_BATTLE_ENDED, "Heroes", {}, 1);
+            return true;
+        } else {
+            gameText() << "\n¡Los enemigos han ganado la batalla! Has perdido la partida." << '\n';
+            emitEvent(EVENT_BATTLE_ENDED, "Enemies", {}, 0);
+            return false;
+        }
+    }
+    
+    // Displays current HP status of all combatants
+public:
+    void displayBattleStatus() const { //Muestra en consola el estado actual de la batalla: Vida y estadísticas de héroes y enemigos.
+        gameText() << "\n--- Estado de la Batalla ---" << '\n';
+        gameText() << "Héroes:" << '\n';
+        for (Hero* hero : heroes) {
+            hero->displayStats();
+        }
+        gameText() << "Enemigos:" << '\n';
+        for (Enemy* enemy : enemies) {
+            enemy->displayStats();
+        }
+        gameText() << "--------------------------" << '\n';
+    }
+
+private:
+    bool isOver() const {
+        return checkBattleEnd() || (turnOrder == TURN_ORDER_INITIATIVE && timeline.empty());
+    }
+
+    // Picks and announces whose turn it is; false when the step was a unit
+    // that fell since it was scheduled
+    bool nextTurn(TimelineKind& kind, int& unit) {
+        if (turnOrder == TURN_ORDER_INITIATIVE) {
+            TimelineEntry next = timeline.pop();
+            kind = next.kind;
+            unit = next.unit;
+            if (!(kind == TIMELINE_HERO ? livingHeroes : livingEnemies).contains(unit)) return false;
+            (kind == TIMELINE_HERO ? livingHeroes : livingEnemies).passTurn(unit);
+        } else {
+            kind = heroesTurn ? TIMELINE_HERO : TIMELINE_ENEMY;
+            unit = (heroesTurn ? livingHeroes : livingEnemies).takeTurn();
+        }
+        if (kind == TIMELINE_HERO && !potionTimers.empty()) tickPotionTimers(unit);
+        gameText() << "\n--- TURNO ---" << '\n';
+        Character* actor = (kind == TIMELINE_HERO) ? static_cast<Character*>(heroes[unit])
+                                                   : static_cast<Character*>(enemies[unit]);
+        gameText() << "\nEs el turno de " << actor->getName() << "." << '\n';
+        emitEvent(EVENT_TURN_STARTED, actor->getName(), {}, kind == TIMELINE_ENEMY);
+        return true;
+    }
+
+    // The unit that acted goes back on the timeline, or the other team plays
+    void endTurn(TimelineKind kind, int unit) {
+        if (turnOrder == TURN_ORDER_INITIATIVE) {
+            Character* actor = (kind == TIMELINE_HERO) ? static_cast<Character*>(heroes[unit])
+                                                       : static_cast<Character*>(enemies[unit]);
+            if (actor->isAlive()) timeline.schedule(InitiativeTimeline::actionDelay(actor->getSpd()), kind, unit);
+        } else {
+            heroesTurn = !heroesTurn;
+        }
+    }
+
+    // A hero's turn comes up: its timed potions that ran out wear off first
+    void tickPotionTimers(int hero) {
+        size_t kept = 0;
+        for (const PotionTimer& timer : potionTimers) {
+            if (timer.hero == hero && timer.turnsLeft == 1) {
+                expirePotion(timer.hero, timer.slot);
+                continue;
+            }
+            potionTimers[kept] = timer;
+            if (timer.hero == hero) --potionTimers[kept].turnsLeft;
+            ++kept;
+        }
+        potionTimers.resize(kept);
+    }
+
+    void expirePotion(int hero, int slot) {
+        heroes[hero]->expirePotion(slot);
+        if (observer) observer->potionExpired(hero, slot, heroes[hero]->getPotions()[slot]->potion->getModifiers());
+    }
+
+    bool decideFirstTurn() {
+        // Encuentra el héroe más rápido vivo
+        int maxHeroSpd = -1;
+        for (auto h : heroes) {
+            if (h->isAlive() && h->getSpd() > maxHeroSpd)
+                maxHeroSpd = h->getSpd();
+        }
+        // Encuentra el enemigo más rápido vivo
+        int maxEnemySpd = -1;
+        for (auto e : enemies) {
+            if (e->isAlive() && e->getSpd() > maxEnemySpd)
+                maxEnemySpd = e->getSpd();
+        }
+        // Empieza el equipo con mayor SPD
+        return maxHeroSpd >= maxEnemySpd;
+    }
+
+    void applyDecision(int heroIdx, const HeroDecision& decision) {
+        if (decision.usePotion) {
+            drinkPotion(heroIdx, decision.index);
+        } else {
+            attackEnemy(heroIdx, decision.index == HeroDecision::ANY_ENEMY ? livingEnemies.pick(0) : decision.index);
+        }
+    }
+
+    void heroAction(int heroIdx) {
+        Hero* hero = heroes[heroIdx];
+        if (policy) {
+            applyDecision(heroIdx, policy->decide(heroes, enemies, heroIdx, livingHeroes.upcoming(), livingEnemies.upcoming()));
+            return;
+        }
+
+        int choice; //Método que maneja la decisión del jugador con su héroe (atacar o usar poción).
+        while (true) {
+            gameText() << hero->getName() << ", ¿qué quieres hacer?" << '\n';
+            gameText() << "1. Atacar" << '\n';
+            gameText() << "2. Usar poción" << '\n';
+            gameText() << "Opción: ";
+            choice = getValidatedInput(1, 2); //Imprime opciones y obtiene la elección del jugador (entrada validada).
+
+            if (choice == 1) {
+                // Si elige atacar, primero busca enemigos vivos (en el orden de la sala).
+                if (livingEnemies.empty()) { //Si no hay enemigos vivos, lo informa y reinicia la elección.
+                    gameText() << "No hay enemigos a quien atacar." << '\n';
+                    continue; // Re-prompt hero action
+                }
+                vector<int> aliveEnemies;
+                aliveEnemies.reserve(livingEnemies.count());
+                for (size_t i = 0; i < enemies.size(); ++i) {
+                    if (livingEnemies.contains(static_cast<int>(i))) {
+                        aliveEnemies.push_back(static_cast<int>(i));
+                    }
+                }
+
+                gameText() << "Selecciona un enemigo para atacar:" << '\n';
+                for (size_t i = 0; i < aliveEnemies.size(); ++i) {
+                    gameText() << (i + 1) << ". " << enemies[aliveEnemies[i]]->getName() << " (HP: " << enemies[aliveEnemies[i]]->getHp() << ")" << '\n';
+                }
+                int targetIndex;
+                gameText() << "Objetivo: ";
+                targetIndex = getValidatedInput(1, aliveEnemies.size()); //Muestra los enemigos disponibles y pide al usuario seleccionar uno.
+
+                attackEnemy(heroIdx, aliveEnemies[targetIndex - 1]);
+                break; // Ejecuta el ataque y finaliza el turno del héroe.
+
+            } else if (choice == 2) { //Revisa qué pociones no han sido usadas por el héroe.
+                // Use potion logic
+                vector<PotionInstance*> availablePotions;
+                for (PotionInstance* p : hero->getPotions()) {
+                    if (!p->used) {
+                        availablePotions.push_back(p);
+                    }
+                }
+
+                if (availablePotions.empty()) { //Si no hay ninguna disponible, vuelve a pedir una acción.
+                    gameText() << "No tienes pociones disponibles para usar." << '\n';
+                    continue; // Re-prompt hero action
+                }
+
+                gameText() << "Selecciona una poción para usar:" << '\n';
+                for (size_t i = 0; i < availablePotions.size(); ++i) {
+                    gameText() << (i + 1) << ". ";
+                    availablePotions[i]->potion->displayInfo();
+                }
+                int potionIndex;
+                gameText() << "Poción: ";
+                potionIndex = getValidatedInput(1, availablePotions.size()); //Muestra la lista de pociones disponibles y deja al jugador elegir una.
+
+                // Find the original index of the potion in the hero's main potions vector
+                // This is necessary because hero->usePotion expects the original index
+                int originalIndex = -1;
+                for (size_t i = 0; i < hero->getPotions().size(); ++i) {
+                    if (hero->getPotions()[i] == availablePotions[potionIndex - 1]) {
+                        originalIndex = i;
+                        break; //Busca el índice original de la poción elegida en el vector del héroe (porque usePotion necesita ese índice).
+                    }
+                }
+                if (originalIndex != -1) {
+                     drinkPotion(heroIdx, originalIndex);
+                     break; // Action completed
+                } else {
+                    gameText() << "Error interno al usar poción." << '\n'; // Should not happen
+                    continue; //Si encuentra el índice, la poción es usada. Si no, se indica error y vuelve a empezar.
+                }
+            }
+        }
+    }
+
+    // Calcula si acierta y el daño; si el enemigo muere, lo informa.
+    // A target that is out of range or already down wastes the turn (policies
+    // and replays can ask for one) and is not reported to observers.
+    void attackEnemy(int heroIdx, int target) {
+        Hero* hero = heroes[heroIdx];
+        if (target < 0 || target >= static_cast<int>(enemies.size()) || !livingEnemies.contains(target)) {
+            gameText() << "No puedes atacar a ese enemigo." << '\n';
+            return;
+        }
+        Enemy* targetEnemy = enemies[target];
+        int hitRoll = 0;
+        int critRoll = 0;
+        int damage = 0;
+        if (hero->calculateHitChance(targetEnemy, rng, &hitRoll)) {
+            damage = hero->calculateDamage(targetEnemy, rng, &critRoll);
+            targetEnemy->takeDamage(damage);
+            gameText() << hero->getName() << " ataca a " << targetEnemy->getName() << " por " << damage << " de daño." << '\n';
+            emitEvent(EVENT_ATTACK, hero->getName(), targetEnemy->getName(), damage);
+            if (metrics) countHit(metrics->heroAttacks[heroClasses[heroIdx]], critRoll <= hero->getLck(), 1, damage);
+            if (!targetEnemy->isAlive()) {
+                livingEnemies.remove(target);
+                gameText() << targetEnemy->getName() << " ha sido derrotado!" << '\n';
+                emitEvent(EVENT_DEFEATED, targetEnemy->getName());
+                if (metrics) CombatMetrics::add(metrics->kills[enemyTypes[target]]);
+            }
+        } else {
+            gameText() << hero->getName() << " falló el ataque a " << targetEnemy->getName() << "." << '\n';
+            emitEvent(EVENT_MISS, hero->getName(), targetEnemy->getName());
+            if (metrics) CombatMetrics::add(metrics->heroAttacks[heroClasses[heroIdx]][METRIC_MISS]);
+        }
+        if (observer) {
+            observer->attackResolved(false, heroIdx, target, hitRoll, critRoll, damage);
+        }
+    }
+
+    // Like attackEnemy, a bad or spent slot only prints Hero::usePotion's
+    // refusal: no observer call, metric or potion timer.
+    void drinkPotion(int heroIdx, int slot) {
+        Hero* hero = heroes[heroIdx];
+        bool usable = slot >= 0 && slot < static_cast<int>(hero->getPotions().size()) && !hero->getPotions()[slot]->used;
+        hero->usePotion(slot);
+        if (!usable) return;
+        if (observer) {
+            observer->potionUsed(heroIdx, slot, hero->getPotions()[slot]->potion->getModifiers());
+        }
+        if (metrics) CombatMetrics::add(metrics->potionsUsed[heroClasses[heroIdx]]);
+        if (potionActions > 0) potionTimers.push_back({heroIdx, slot, potionActions});
+    }
+
+
+    void enemyAction(int enemyIdx) { //Busca héroes vivos para atacar.
+        Enemy* enemy = enemies[enemyIdx];
+        if (livingHeroes.empty()) {
+            // This should ideally not happen if checkBattleEnd works correctly
+            return; //Si no hay héroes vivos, termina sin hacer nada.
+        }
+
+        int target = livingHeroes.pick(rng.below(livingHeroes.count())); //Elige un héroe aleatoriamente como objetivo.
+        Hero* targetHero = heroes[target];
+
+        int hitRoll = 0;
+        int critRoll = 0;
+        int damage = 0;
+        if (enemy->calculateHitChance(targetHero, rng, &hitRoll)) {
+            damage = enemy->calculateDamage(targetHero, rng, &critRoll);
+            int healthBefore = targetHero->getHp();
+            targetHero->takeDamage(damage);
+            gameText() << enemy->getName() << " ataca a " << targetHero->getName() << " por " << damage << " de daño." << '\n';
+            emitEvent(EVENT_ATTACK, enemy->getName(), targetHero->getName(), damage);
+            if (metrics) {
+                countHit(metrics->enemyAttacks[enemyTypes[enemyIdx]], critRoll <= enemy->getLck(), 0, damage);
+                CombatMetrics::add(metrics->healthLost[heroClasses[target]], healthBefore - targetHero->getHp());
+            }
+            if (!targetHero->isAlive()) {
+                livingHeroes.remove(target);
+                gameText() << targetHero->getName() << " ha sido derrotado!" << '\n';
+                emitEvent(EVENT_DEFEATED, targetHero->getName());
+            }
+        } else {
+            gameText() << enemy->getName() << " falló el ataque a " << targetHero->getName() << "." << '\n';
+            emitEvent(EVENT_MISS, enemy->getName(), targetHero->getName());
+            if (metrics) CombatMetrics::add(metrics->enemyAttacks[enemyTypes[enemyIdx]][METRIC_MISS]);
+        } //Ataca con la misma lógica que el héroe: calcula si acierta, daño, aplica daño y muestra resultado.
+        if (observer) {
+            observer->attackResolved(true, enemyIdx, target, hitRoll, critRoll, damage);
+        }
+    }
+    // side: 0 a hero was hit, 1 an enemy
+    void countHit(atomic<uint64_t>* attacks, bool critical, int side, int damage) {
+        CombatMetrics::add(attacks[METRIC_HIT]);
+        if (critical) CombatMetrics::add(attacks[METRIC_CRIT]);
+        int room = metricRoom(roomNumber);
+        CombatMetrics::add(metrics->damage[room][side][metricDamageBucket(damage)]);
+        CombatMetrics::add(metrics->damageSum[room][side], damage);
+    }
+
+    bool checkBattleEnd() const {
+        return livingHeroes.empty() || livingEnemies.empty();
+    }
+
+
+    string getWinner() const {
+        bool heroesAlive = !livingHeroes.empty();
+        bool enemiesAlive = !livingEnemies.empty();
+        if (heroesAlive && !enemiesAlive) return "Heroes";
+        if (!heroesAlive && enemiesAlive) return "Enemies";
+        return "Ongoing";
+    }
+};
+
+// ===== HEADLESS BATTLE SIMULATOR =====
+// Runs the same combat rules as Battle with TURN_ORDER_ALTERNATE (SPD decides
+// the opening team, teams alternate, each side cycles through its living members, 10-95% hit clamp,
+// max(1, ATK - DEF) damage, LCK% chance of a 1.5x crit) without any I/O or
+// heap allocation. Heroes pick a random living enemy, just like enemies do.
+const int SIM_MAX_SIDE = 4;
+
+struct SimCombatant {
+    int hp;
+    int maxHp;
+    int atk;
+    int def;
+    int spd;
+    int lck;
+};
+
+SimCombatant makeSimCombatant(const Character& c) {
+    return {c.getHp(), c.getMaxHp(), c.getAtk(), c.getDef(), c.getSpd(), c.getLck()};
+}
+
+SimCombatant makeSimCombatant(const CharacterTemplate& t) {
+    return {t.hp, t.hp, t.atk, t.def, t.spd, t.lck};
+}
+
+struct BattleSetup {
+    SimCombatant heroes[SIM_MAX_SIDE];
+    SimCombatant enemies[SIM_MAX_SIDE];
+    int heroCount = 0;
+    int enemyCount = 0;
+
+    void addHero(const SimCombatant& c) { if (heroCount < SIM_MAX_SIDE) heroes[heroCount++] = c; }
+    void addEnemy(const SimCombatant& c) { if (enemyCount < SIM_MAX_SIDE) enemies[enemyCount++] = c; }
+};
+
+struct BattleResult {
+    bool heroesWon = false;
+    int turns = 0;
+    int heroHpLeft[SIM_MAX_SIDE] = {};
+    int enemyHpLeft[SIM_MAX_SIDE] = {};
+    int heroHpLost = 0;
+};
+
+class BattleSimulator {
+private:
+    Rng rng;
+
+    // Uniform integer in [0, n) from 32 random bits (multiply-shift, no division)
+    static int scale(uint32_t bits, int n) {
+        return static_cast<int>((static_cast<uint64_t>(bits) * static_cast<uint64_t>(n)) >> 32);
+    }
+
+    static int nextAlive(const SimCombatant* side, int count, int& index) {
+        for (int tries = 0; tries < count; ++tries) {
+            int current = index;
+            index = (index + 1 == count) ? 0 : index + 1;
+            if (side[current].hp > 0) return current;
+        }
+        return -1;
+    }
+
+    // Resolves one attack without branching on the rolls; both 1-100 rolls come
+    // from a single 64-bit draw. Returns the HP actually removed from the defender.
+    int attack(const SimCombatant& attacker, SimCombatant& defender) {
+        uint64_t bits = rng();
+        int hitChance = 85 + (attacker.lck - defender.lck) * 2;
+        hitChance = max(10, min(95, hitChance));
+        int hit = scale(static_cast<uint32_t>(bits), 100) < hitChance;
+        int crit = scale(static_cast<uint32_t>(bits >> 32), 100) < attacker.lck;
+
+        int damage = max(1, attacker.atk - defender.def);
+        damage += crit * (damage / 2); // 1.5x, truncated like static_cast<int>(damage * 1.5)
+        damage *= hit;
+        int removed = min(defender.hp, damage);
+        defender.hp -= removed;
+        return removed;
+    }
+
+public:
+    explicit BattleSimulator(uint64_t seed = 0) : rng(seed) {}
+
+    void reseed(uint64_t seed) { rng.seed(seed); }
+
+    BattleResult run(const BattleSetup& setup) {
+        BattleResult result;
+        SimCombatant heroes[SIM_MAX_SIDE];
+        SimCombatant enemies[SIM_MAX_SIDE];
+        int maxHeroSpd = -1;
+        int maxEnemySpd = -1;
+        for (int i = 0; i < setup.heroCount; ++i) {
+            heroes[i] = setup.heroes[i];
+            if (heroes[i].hp > 0) maxHeroSpd = max(maxHeroSpd, heroes[i].spd);
+        }
+        for (int i = 0; i < setup.enemyCount; ++i) {
+            enemies[i] = setup.enemies[i];
+            if (enemies[i].hp > 0) maxEnemySpd = max(maxEnemySpd, enemies[i].spd);
+        }
+
+        bool heroesTurn = maxHeroSpd >= maxEnemySpd;
+        int heroIndex = 0;
+        int enemyIndex = 0;
+        // Dense lists of living members so a random target is a single index
+        int aliveHeroes[SIM_MAX_SIDE];
+        int aliveEnemies[SIM_MAX_SIDE];
+        int heroesAlive = 0;
+        int enemiesAlive = 0;
+        for (int i = 0; i < setup.heroCount; ++i) {
+            if (heroes[i].hp > 0) aliveHeroes[heroesAlive++] = i;
+        }
+        for (int i = 0; i < setup.enemyCount; ++i) {
+            if (enemies[i].hp > 0) aliveEnemies[enemiesAlive++] = i;
+        }
+
+        while (heroesAlive > 0 && enemiesAlive > 0) {
+            if (heroesTurn) {
+                int actor = nextAlive(heroes, setup.heroCount, heroIndex);
+                int slot = rng.below(enemiesAlive);
+                SimCombatant& target = enemies[aliveEnemies[slot]];
+                attack(heroes[actor], target);
+                if (target.hp == 0) aliveEnemies[slot] = aliveEnemies[--enemiesAlive];
+            } else {
+                int actor = nextAlive(enemies, setup.enemyCount, enemyIndex);
+                int slot = rng.below(heroesAlive);
+                SimCombatant& target = heroes[aliveHeroes[slot]];
+                result.heroHpLost += attack(enemies[actor], target);
+                if (target.hp == 0) aliveHeroes[slot] = aliveHeroes[--heroesAlive];
+            }
+            ++result.turns;
+            heroesTurn = !heroesTurn;
+        }
+
+        result.heroesWon = heroesAlive > 0;
+        for (int i = 0; i < setup.heroCount; ++i) result.heroHpLeft[i] = heroes[i].hp;
+        for (int i = 0; i < setup.enemyCount; ++i) result.enemyHpLeft[i] = enemies[i].hp;
+        return result;
+    }
+
+    BattleResult run(const BattleSetup& setup, uint64_t seed) {
+        reseed(seed);
+        return run(setup);
+    }
+};
+
+
+// ===== BATTLE SOLVER =====
+// Outcome distribution of a BattleSetup under the simulator's policies (SPD
+// picks the opening team, round-robin attackers, uniformly random living
+// target) computed by dynamic programming over the Markov chain of battle
+// states instead of sampling. A state is every combatant's HP plus a
+// configuration: the team about to act and both round-robin pointers,
+// normalized to a living member.
+//
+// A hit always removes at least 1 HP, so probability mass only flows from
+// higher to lower total HP; states are swept in that order, one bucket per
+// total, with a hash table per bucket merging paths that reach the same HP
+// vector. A miss keeps the HP vector and only moves the configuration, so
+// misses form cycles inside one HP vector. The expected number of visits of
+// each configuration, v = m + A v (A holds the miss chances), is solved once
+// per set of living combatants as v = (I - A)^-1 m. Only reachable states are
+// ever created. The result is exact only when prunedMass is 0: states whose
+// mass is below `epsilon` are dropped, and their mass is the error bound.
+//
+// Every reachable HP vector is a state, so the solver is only practical for
+// the boss room, where the heroes fall in a few hits: with epsilon 1e-12 it
+// solves to about 1e-7 in seconds (epsilon 0 takes minutes). In regular rooms
+// most hits remove 1-3 HP and the mass spreads over far more HP vectors than
+// fit; --simulate is the tool for those rooms.
+struct SolverResult {
+    double heroWin = 0;        // P(heroes win)
+    double heroHpLost = 0;     // E[HP removed from heroes]
+    double turns = 0;          // E[attacks until one side falls]
+    double prunedMass = 0;     // probability not expanded (epsilon or state limit)
+    size_t states = 0;         // HP vectors expanded
+    bool stateLimitHit = false;
+    bool keyOverflow = false;  // the HP vectors do not fit the 64-bit state key
+};
+
+class BattleSolver {
+private:
+    static const int MAX_CONFIGS = 2 * SIM_MAX_SIDE * SIM_MAX_SIDE;
+
+    // States of one total HP: HP vectors (stride n), the mass per configuration
+    // and an open-addressing index (key + 1, 0 = empty) kept at most half full
+    struct Bucket {
+        vector<uint64_t> keys;
+        vector<uint32_t> slots;
+        vector<int> hp;
+        vector<double> mass;
+        uint32_t states = 0;
+    };
+
+    SimCombatant units[2][SIM_MAX_SIDE];
+    // P(hit and [no] crit) and damage, by [side][attacker][defender][crit]
+    double hitOdds[2][SIM_MAX_SIDE][SIM_MAX_SIDE][2];
+    int damageOf[2][SIM_MAX_SIDE][SIM_MAX_SIDE][2];
+    int count[2] = {0, 0};
+    int combatants = 0;
+    int configs = 0;
+    uint64_t radix[2 * SIM_MAX_SIDE];
+    vector<Bucket> buckets;
+    // (I - A)^-1 per set of living combatants, built on first use
+    vector<vector<double>> visitMatrix;
+
+    int configOf(int side, int heroPtr, int enemyPtr) const {
+        return (side * count[0] + heroPtr) * count[1] + enemyPtr;
+    }
+
+    void splitConfig(int config, int& side, int ptr[2]) const {
+        ptr[1] = config % count[1];
+        config /= count[1];
+        ptr[0] = config % count[0];
+        side = config / count[0];
+    }
+
+    static bool alive(int mask, int unit) { return (mask >> unit) & 1; }
+
+    // Bit i = combatant i alive; heroes first, then enemies
+    int aliveMask(const int* hp) const {
+        int mask = 0;
+        for (int i = 0; i < combatants; ++i) mask |= (hp[i] > 0) << i;
+        return mask;
+    }
+
+    // First living member of side at or after ptr (wrapping)
+    int normalize(int mask, int side, int ptr) const {
+        int base = side ? count[0] : 0;
+        for (int tries = 0; tries < count[side]; ++tries) {
+            if (alive(mask, base + ptr)) return ptr;
+            ptr = (ptr + 1 == count[side]) ? 0 : ptr + 1;
+        }
+        return 0;
+    }
+
+    bool validConfig(int mask, int config) const {
+        int side;
+        int ptr[2];
+        splitConfig(config, side, ptr);
+        return alive(mask, ptr[0]) && alive(mask, count[0] + ptr[1]);
+    }
+
+    // Configuration after the actor of config has had its turn
+    int nextConfig(int mask, int config) const {
+        int side;
+        int ptr[2];
+        splitConfig(config, side, ptr);
+        int advanced = (ptr[side] + 1 == count[side]) ? 0 : ptr[side] + 1;
+        ptr[side] = normalize(mask, side, advanced);
+        return configOf(1 - side, ptr[0], ptr[1]);
+    }
+
+    int livingCount(int mask, int side) const {
+        int base = side ? count[0] : 0;
+        int living = 0;
+        for (int i = 0; i < count[side]; ++i) living += alive(mask, base + i);
+        return living;
+    }
+
+    double missChance(int mask, int config) const {
+        int side;
+        int ptr[2];
+        splitConfig(config, side, ptr);
+        const SimCombatant& attacker = units[side][ptr[side]];
+        int defenders = 1 - side;
+        int base = defenders ? count[0] : 0;
+        double pick = 1.0 / livingCount(mask, defenders);
+        double miss = 0;
+        for (int t = 0; t < count[defenders]; ++t) {
+            if (!alive(mask, base + t)) continue;
+            miss += pick * (1 - Character::hitChance(attacker.lck, units[defenders][t].lck) / 100.0);
+        }
+        return miss;
+    }
+
+    // Gauss-Jordan inverse of I - A, where A[next(c)][c] = miss chance of c.
+    // Every miss cycle loses at least 5% per step, so I - A is invertible.
+    const vector<double>& visits(int mask) {
+        vector<double>& inverse = visitMatrix[mask];
+        if (!inverse.empty()) return inverse;
+        int n = configs;
+        vector<double> work(n * n, 0.0);
+        inverse.assign(n * n, 0.0);
+        for (int c = 0; c < n; ++c) {
+            work[c * n + c] = 1;
+            inverse[c * n + c] = 1;
+        }
+        for (int c = 0; c < n; ++c) {
+            if (validConfig(mask, c)) work[nextConfig(mask, c) * n + c] -= missChance(mask, c);
+        }
+        for (int col = 0; col < n; ++col) {
+            int pivot = col;
+            for (int r = col + 1; r < n; ++r) {
+                if (fabs(work[r * n + col]) > fabs(work[pivot * n + col])) pivot = r;
+            }
+            for (int k = 0; k < n; ++k) {
+                swap(work[col * n + k], work[pivot * n + k]);
+                swap(inverse[col * n + k], inverse[pivot * n + k]);
+            }
+            double scale = 1 / work[col * n + col];
+            for (int k = 0; k < n; ++k) {
+                work[col * n + k] *= scale;
+                inverse[col * n + k] *= scale;
+            }
+            for (int r = 0; r < n; ++r) {
+                double factor = work[r * n + col];
+                if (r == col || factor == 0) continue;
+                for (int k = 0; k < n; ++k) {
+                    work[r * n + k] -= factor * work[col * n + k];
+                    inverse[r * n + k] -= factor * inverse[col * n + k];
+                }
+            }
+        }
+        return inverse;
+    }
+
+    static size_t hashIndex(uint64_t key) {
+        return static_cast<size_t>(splitmix64(key));
+    }
+
+    static void growIndex(Bucket& bucket) {
+        vector<uint64_t> keys(max<size_t>(64, bucket.keys.size() * 2), 0);
+        vector<uint32_t> slots(keys.size());
+        size_t mask = keys.size() - 1;
+        for (size_t i = 0; i < bucket.keys.size(); ++i) {
+            if (bucket.keys[i] == 0) continue;
+            size_t j = hashIndex(bucket.keys[i]) & mask;
+            while (keys[j] != 0) j = (j + 1) & mask;
+            keys[j] = bucket.keys[i];
+            slots[j] = bucket.slots[i];
+        }
+        bucket.keys.swap(keys);
+        bucket.slots.swap(slots);
+    }
+
+    // Bucket and row of the state with these HP, created empty on first reach
+    pair<Bucket*, uint32_t> stateOf(const int* hp) {
+        uint64_t key = 1;
+        int total = 0;
+        for (int i = 0; i < combatants; ++i) {
+            key += radix[i] * hp[i];
+            total += hp[i];
+        }
+        Bucket& bucket = buckets[total];
+        if ((bucket.states + 1) * 2 > bucket.keys.size()) growIndex(bucket);
+        size_t mask = bucket.keys.size() - 1;
+        size_t i = hashIndex(key) & mask;
+        while (bucket.keys[i] != 0 && bucket.keys[i] != key) i = (i + 1) & mask;
+        if (bucket.keys[i] == 0) {
+            bucket.keys[i] = key;
+            bucket.slots[i] = bucket.states++;
+            bucket.hp.insert(bucket.hp.end(), hp, hp + combatants);
+            bucket.mass.resize(bucket.mass.size() + configs, 0.0);
+        }
+        return {&bucket, bucket.slots[i]};
+    }
+
+    // Spreads the visits of one state over its hit outcomes. The HP after a
+    // hit depends only on (side, actor, target, crit), so every configuration
+    // where the same actor attacks shares one lookup of the state reached.
+    void expand(const int* hp, const double* visited, SolverResult& result) {
+        int mask = aliveMask(hp);
+        int next[2 * SIM_MAX_SIDE];
+        for (int side = 0; side < 2; ++side) {
+            int defenders = 1 - side;
+            int base = defenders ? count[0] : 0;
+            double pick = 1.0 / livingCount(mask, defenders);
+            for (int actor = 0; actor < count[side]; ++actor) {
+                if (!alive(mask, (side ? count[0] : 0) + actor)) continue;
+                // Configurations where this actor attacks, and their visits
+                int configsActing[SIM_MAX_SIDE];
+                int others = 0;
+                double actorVisits = 0;
+                for (int other = 0; other < count[defenders]; ++other) {
+                    int config = side ? configOf(1, other, actor) : configOf(0, actor, other);
+                    if (!alive(mask, base + other) || visited[config] <= 0) continue;
+                    configsActing[others++] = config;
+                    actorVisits += visited[config];
+                }
+                if (others == 0) continue;
+                result.turns += actorVisits;
+                int advanced = normalize(mask, side, actor + 1 == count[side] ? 0 : actor + 1);
+
+                for (int t = 0; t < count[defenders]; ++t) {
+                    if (!alive(mask, base + t)) continue;
+                    for (int crit = 0; crit < 2; ++crit) {
+                        double chance = pick * hitOdds[side][actor][t][crit];
+                        if (chance == 0) continue;
+                        int removed = min(hp[base + t], damageOf[side][actor][t][crit]);
+                        if (defenders == 0) result.heroHpLost += actorVisits * chance * removed;
+                        copy(hp, hp + combatants, next);
+                        next[base + t] -= removed;
+                        int nextMask = aliveMask(next);
+                        if (livingCount(nextMask, defenders) == 0) {
+                            if (defenders == 1) result.heroWin += actorVisits * chance;
+                            continue;
+                        }
+                        // Rows are indices: new states may move a bucket's mass array
+                        pair<Bucket*, uint32_t> reached = stateOf(next);
+                        double* row = &reached.first->mass[size_t(reached.second) * configs];
+                        for (int i = 0; i < others; ++i) {
+                            int config = configsActing[i];
+                            int ptr[2];
+                            int ignored;
+                            splitConfig(config, ignored, ptr);
+                            ptr[side] = advanced;
+                            ptr[defenders] = normalize(nextMask, defenders, ptr[defenders]);
+                            row[configOf(defenders, ptr[0], ptr[1])] += visited[config] * chance;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+public:
+    // Gives up after maxStates HP vectors (stateLimitHit); the mass left
+    // unexpanded counts as pruned. The state key 1 + sum(radix[i] * hp[i])
+    // peaks at the product of (hp + 1), so setups where that exceeds 2^64 - 1
+    // are refused with keyOverflow set.
+    SolverResult solve(const BattleSetup& setup, double epsilon = 0, size_t maxStates = 2000000) {
+        SolverResult result;
+        count[0] = setup.heroCount;
+        count[1] = setup.enemyCount;
+        combatants = count[0] + count[1];
+        int start[2 * SIM_MAX_SIDE];
+        int maxSpd[2] = {-1, -1};
+        int total = 0;
+        uint64_t weight = 1;
+        for (int i = 0; i < combatants; ++i) {
+            int side = i < count[0] ? 0 : 1;
+            units[side][side ? i - count[0] : i] = side ? setup.enemies[i - count[0]] : setup.heroes[i];
+            const SimCombatant& unit = units[side][side ? i - count[0] : i];
+            start[i] = max(0, unit.hp);
+            if (start[i] > 0) maxSpd[side] = max(maxSpd[side], unit.spd);
+            radix[i] = weight;
+            uint64_t levels = static_cast<uint64_t>(start[i]) + 1;
+            if (weight > UINT64_MAX / levels) {
+                result.keyOverflow = true;
+                result.prunedMass = 1;
+                return result;
+            }
+            weight *= levels;
+            total += start[i];
+        }
+        int mask = aliveMask(start);
+        if (count[0] == 0 || livingCount(mask, 0) == 0) return result;
+        if (count[1] == 0 || livingCount(mask, 1) == 0) {
+            result.heroWin = 1;
+            return result;
+        }
+
+        for (int side = 0; side < 2; ++side) {
+            for (int a = 0; a < count[side]; ++a) {
+                const SimCombatant& attacker = units[side][a];
+                double critChance = max(0, min(100, attacker.lck)) / 100.0;
+                for (int d = 0; d < count[1 - side]; ++d) {
+                    const SimCombatant& defender = units[1 - side][d];
+                    double hit = Character::hitChance(attacker.lck, defender.lck) / 100.0;
+                    hitOdds[side][a][d][0] = hit * (1 - critChance);
+                    hitOdds[side][a][d][1] = hit * critChance;
+                    damageOf[side][a][d][0] = Character::damage(attacker.atk, defender.def, false);
+                    damageOf[side][a][d][1] = Character::damage(attacker.atk, defender.def, true);
+                }
+            }
+        }
+        configs = 2 * count[0] * count[1];
+        visitMatrix.assign(size_t(1) << combatants, vector<double>());
+        buckets.assign(total + 1, Bucket());
+        int side = maxSpd[0] >= maxSpd[1] ? 0 : 1;
+        stateOf(start).first->mass[configOf(side, normalize(mask, 0, 0), normalize(mask, 1, 0))] = 1.0;
+
+        vector<double> visited(configs);
+        for (int level = total; level > 0; --level) {
+            Bucket& bucket = buckets[level];
+            for (size_t s = 0; s < bucket.states; ++s) {
+                const int* hp = &bucket.hp[s * combatants];
+                const double* mass = &bucket.mass[s * configs];
+                double stateMass = 0;
+                for (int c = 0; c < configs; ++c) stateMass += mass[c];
+                if (stateMass < epsilon || result.stateLimitHit) {
+                    result.prunedMass += stateMass;
+                    continue;
+                }
+                if (result.states == maxStates) {
+                    result.stateLimitHit = true;
+                    result.prunedMass += stateMass;
+                    continue;
+                }
+                const vector<double>& inverse = visits(aliveMask(hp));
+                for (int r = 0; r < configs; ++r) {
+                    double sum = 0;
+                    for (int c = 0; c < configs; ++c) sum += inverse[r * configs + c] * mass[c];
+                    visited[r] = sum;
+                }
+                expand(hp, visited.data(), result);
+                ++result.states;
+            }
+            bucket = Bucket(); // release the level once swept
+        }
+        return result;
+    }
+};
+
+// ===== MCTS HERO AUTOPLAY =====
+// HeroPolicy that picks attack targets and potions by Monte Carlo Tree Search
+// over a headless copy of the battle. Enemy turns and every hit/crit roll are
+// sampled, so the tree is a transposition table of hero decision states keyed
+// by a hash of the state (HP, stats, turn pointers, potions left), with UCB1
+// per action. Rollouts attack random living enemies, like BattleSimulator.
+// The search models the alternating turn order; under the initiative
+// timeline it is an approximation that still ranks targets and potions well.
+//
+// Root parallelism: each thread of a persistent pool searches its own table
+// from the same root until the per-decision deadline, and the root action
+// visit counts are summed; the most visited action is played.
+const int SEARCH_MAX_POTIONS = 8;
+const int SEARCH_MAX_ACTIONS = SIM_MAX_SIDE + SEARCH_MAX_POTIONS; // attacks, then potion slots
+
+struct SearchState {
+    SimCombatant heroes[SIM_MAX_SIDE];
+    SimCombatant enemies[SIM_MAX_SIDE];
+    int heroCount = 0;
+    int enemyCount = 0;
+    int heroIndex = 0;          // round-robin pointers, as in Battle
+    int enemyIndex = 0;
+    bool heroesTurn = true;
+    uint8_t potionsLeft[SIM_MAX_SIDE] = {}; // bit p set = potion slot p unused
+};
+
+// Field of SimCombatant each Stat modifies, like Character::STAT_FIELDS
+constexpr int SimCombatant::* SIM_STAT_FIELDS[STAT_COUNT] = {
+    &SimCombatant::maxHp, &SimCombatant::atk, &SimCombatant::def, &SimCombatant::spd, &SimCombatant::lck
+};
+
+// Battle rules on a SearchState; potion effects are fixed for a whole search
+class SearchRules {
+private:
+    ItemModifiers potionEffects[SIM_MAX_SIDE][SEARCH_MAX_POTIONS];
+
+    static int peekAlive(const SimCombatant* side, int count, int index) {
+        for (int tries = 0; tries < count; ++tries) {
+            if (side[index].hp > 0) return index;
+            index = (index + 1 == count) ? 0 : index + 1;
+        }
+        return -1;
+    }
+
+    static int nextAlive(const SimCombatant* side, int count, int& index) {
+        int actor = peekAlive(side, count, index);
+        if (actor >= 0) index = (actor + 1 == count) ? 0 : actor + 1;
+        return actor;
+    }
+
+    static void attack(const SimCombatant& attacker, SimCombatant& defender, Rng& rng) {
+        if (rng.roll100() > Character::hitChance(attacker.lck, defender.lck)) return;
+        bool critical = rng.roll100() <= attacker.lck;
+        defender.hp = max(0, defender.hp - Character::damage(attacker.atk, defender.def, critical));
+    }
+
+    static int pickAlive(const SimCombatant* side, int count, Rng& rng) {
+        int alive[SIM_MAX_SIDE];
+        int living = 0;
+        for (int i = 0; i < count; ++i) {
+            if (side[i].hp > 0) alive[living++] = i;
+        }
+        return alive[rng.below(living)];
+    }
+
+public:
+    void setPotion(int hero, int slot, const ItemModifiers& effect) { potionEffects[hero][slot] = effect; }
+
+    static bool anyAlive(const SimCombatant* side, int count) {
+        for (int i = 0; i < count; ++i) {
+            if (side[i].hp > 0) return true;
+        }
+        return false;
+    }
+
+    static bool over(const SearchState& s) {
+        return !anyAlive(s.heroes, s.heroCount) || !anyAlive(s.enemies, s.enemyCount);
+    }
+
+    // Hero about to act in a state where it is the heroes' turn
+    static int actingHero(const SearchState& s) { return peekAlive(s.heroes, s.heroCount, s.heroIndex); }
+
+    // Hash of everything that decides the rest of the battle
+    static uint64_t hash(const SearchState& s) {
+        uint64_t h = 0x51A5u;
+        auto mix = [&h](uint64_t value) {
+            uint64_t state = h ^ value;
+            h = splitmix64(state);
+        };
+        for (int side = 0; side < 2; ++side) {
+            const SimCombatant* units = side ? s.enemies : s.heroes;
+            int count = side ? s.enemyCount : s.heroCount;
+            for (int i = 0; i < count; ++i) {
+                const SimCombatant& u = units[i];
+                mix((uint64_t(uint16_t(u.hp)) << 48) | (uint64_t(uint16_t(u.maxHp)) << 32) |
+                    (uint64_t(uint16_t(u.atk)) << 16) | uint16_t(u.def));
+                mix((uint64_t(uint16_t(u.lck)) << 16) | (side ? 0 : s.potionsLeft[i]));
+            }
+        }
+        mix((uint64_t(peekAlive(s.heroes, s.heroCount, s.heroIndex) & 0xFF) << 16) |
+            (uint64_t(peekAlive(s.enemies, s.enemyCount, s.enemyIndex) & 0xFF) << 8) | s.heroesTurn);
+        return h;
+    }
+
+    // Legal actions of the acting hero; returns how many were written
+    static int legalActions(const SearchState& s, int hero, int* actions) {
+        int n = 0;
+        for (int e = 0; e < s.enemyCount; ++e) {
+            if (s.enemies[e].hp > 0) actions[n++] = e;
+        }
+        for (int p = 0; p < SEARCH_MAX_POTIONS; ++p) {
+            if (s.potionsLeft[hero] & (1u << p)) actions[n++] = SIM_MAX_SIDE + p;
+        }
+        return n;
+    }
+
+    // The acting hero carries out action, then the enemies get the turn
+    void heroTurn(SearchState& s, int action, Rng& rng) const {
+        int hero = nextAlive(s.heroes, s.heroCount, s.heroIndex);
+        SimCombatant& h = s.heroes[hero];
+        if (action < SIM_MAX_SIDE) {
+            attack(h, s.enemies[action], rng);
+        } else {
+            int slot = action - SIM_MAX_SIDE;
+            s.potionsLeft[hero] &= ~(1u << slot);
+            for (const StatModifier& mod : potionEffects[hero][slot]) {
+                h.*SIM_STAT_FIELDS[mod.stat] += mod.delta;
+                if (mod.stat == STAT_HP) h.hp += mod.delta; // HP boosts also heal
+            }
+        }
+        s.heroesTurn = false;
+    }
+
+    static void enemyTurn(SearchState& s, Rng& rng) {
+        int enemy = nextAlive(s.enemies, s.enemyCount, s.enemyIndex);
+        attack(s.enemies[enemy], s.heroes[pickAlive(s.heroes, s.heroCount, rng)], rng);
+        s.heroesTurn = true;
+    }
+
+    // Default policy: heroes attack a random living enemy
+    static void rollout(SearchState& s, Rng& rng) {
+        while (!over(s)) {
+            if (s.heroesTurn) {
+                int hero = nextAlive(s.heroes, s.heroCount, s.heroIndex);
+                attack(s.heroes[hero], s.enemies[pickAlive(s.enemies, s.enemyCount, rng)], rng);
+                s.heroesTurn = false;
+            } else {
+                enemyTurn(s, rng);
+            }
+        }
+    }
+
+    // Outcome for the heroes in [0, 1]: a win is worth at least 0.5 plus the
+    // share of HP kept; a loss at most 0.5 times the share of enemy HP removed
+    static double reward(const SearchState& end, const SearchState& root) {
+        int heroHp = 0;
+        int heroMax = 0;
+        int enemyHp = 0;
+        int enemyStart = 0;
+        for (int i = 0; i < end.heroCount; ++i) {
+            heroHp += end.heroes[i].hp;
+            heroMax += max(end.heroes[i].maxHp, 1);
+        }
+        for (int i = 0; i < end.enemyCount; ++i) {
+            enemyHp += end.enemies[i].hp;
+            enemyStart += root.enemies[i].hp;
+        }
+        if (enemyHp == 0) return 0.5 + 0.5 * heroHp / heroMax;
+        return enemyStart ? 0.5 * (enemyStart - enemyHp) / enemyStart : 0;
+    }
+};
+
+// One thread's search tree: an open-addressing transposition table of hero
+// decision states, cleared in O(1) between decisions by a generation stamp
+class SearchTable {
+public:
+    struct Node {
+        uint64_t key = 0;
+        uint32_t generation = 0;
+        uint32_t visits = 0;
+        int actionCount = 0;
+        int actions[SEARCH_MAX_ACTIONS];
+        uint32_t actionVisits[SEARCH_MAX_ACTIONS];
+        double actionValue[SEARCH_MAX_ACTIONS];
+    };
+
+private:
+    vector<Node> nodes;
+    uint32_t generation = 0;
+    size_t used = 0;
+
+public:
+    explicit SearchTable(size_t capacity = size_t(1) << 15) : nodes(capacity) {}
+
+    void clear() {
+        ++generation;
+        used = 0;
+    }
+
+    // Node of key; created is set for a new node. nullptr once 3/4 full.
+    Node* findOrCreate(uint64_t key, bool& created) {
+        size_t mask = nodes.size() - 1;
+        for (size_t i = static_cast<size_t>(key) & mask;; i = (i + 1) & mask) {
+            Node& node = nodes[i];
+            if (node.generation != generation) {
+                if (used * 4 >= nodes.size() * 3) return nullptr;
+                ++used;
+                node.key = key;
+                node.generation = generation;
+                node.visits = 0;
+                node.actionCount = 0;
+                created = true;
+                return &node;
+            }
+            if (node.key == key) {
+                created = false;
+                return &node;
+            }
+        }
+    }
+
+    size_t size() const { return used; }
+};
+
+// Persistent worker threads, so a 10 ms decision does not pay for spawning
+// them. run() hands the same job to every worker (the caller is worker 0).
+class SearchPool {
+private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    condition_variable finished;
+    function<void(int)> job;
+    uint64_t round = 0;
+    int pending = 0;
+    bool stopping = false;
+
+    void work(int worker) {
+        uint64_t seen = 0;
+        while (true) {
+            function<void(int)> current;
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || round != seen; });
+                if (stopping) return;
+                seen = round;
+                current = job;
+            }
+            current(worker);
+            lock_guard<mutex> guard(lock);
+            if (--pending == 0) finished.notify_one();
+        }
+    }
+
+public:
+    explicit SearchPool(int threads) {
+        for (int i = 1; i < threads; ++i) workers.emplace_back(&SearchPool::work, this, i);
+    }
+
+    ~SearchPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers) worker.join();
+    }
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    void run(const function<void(int)>& task) {
+        {
+            lock_guard<mutex> guard(lock);
+            job = task;
+            pending = static_cast<int>(workers.size());
+            ++round;
+        }
+        wake.notify_all();
+        task(0);
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return pending == 0; });
+    }
+};
+
+class MctsHeroPolicy : public HeroPolicy {
+private:
+    SearchPool pool;
+    vector<SearchTable> tables;
+    vector<Rng> rngs;
+    chrono::microseconds budget;
+    double exploration = 0.7;
+    uint64_t iterations = 0; // over the last decision, all threads
+
+    static const int MAX_PATH = 512;
+
+    // One playout from root: select by UCB1 through known decision states,
+    // add the first new one, roll out from it and back the reward up
+    void iterate(const SearchState& root, const SearchRules& rules, SearchTable& table, Rng& rng) {
+        SearchTable::Node* pathNodes[MAX_PATH];
+        int pathActions[MAX_PATH];
+        int depth = 0;
+        SearchState s = root;
+        while (!SearchRules::over(s)) {
+            if (!s.heroesTurn) {
+                SearchRules::enemyTurn(s, rng);
+                continue;
+            }
+            bool created = false;
+            SearchTable::Node* node = depth < MAX_PATH ? table.findOrCreate(SearchRules::hash(s), created) : nullptr;
+            if (!node) break;
+            if (created) {
+                node->actionCount = SearchRules::legalActions(s, SearchRules::actingHero(s), node->actions);
+                for (int a = 0; a < node->actionCount; ++a) {
+                    node->actionVisits[a] = 0;
+                    node->actionValue[a] = 0;
+                }
+                if (depth > 0) break; // expansion: roll out from the new state
+            }
+
+            // UCB1; untried actions first
+            int pick = 0;
+            double best = -1;
+            double logVisits = log(static_cast<double>(node->visits) + 1);
+            for (int a = 0; a < node->actionCount; ++a) {
+                double n = node->actionVisits[a];
+                if (n == 0) {
+                    pick = a;
+                    break;
+                }
+                double score = node->actionValue[a] / n + exploration * sqrt(logVisits / n);
+                if (score > best) {
+                    best = score;
+                    pick = a;
+                }
+            }
+            pathNodes[depth] = node;
+            pathActions[depth] = pick;
+            ++depth;
+            rules.heroTurn(s, node->actions[pick], rng);
+        }
+        SearchRules::rollout(s, rng);
+        double value = SearchRules::reward(s, root);
+        for (int i = 0; i < depth; ++i) {
+            SearchTable::Node* node = pathNodes[i];
+            ++node->visits;
+            ++node->actionVisits[pathActions[i]];
+            node->actionValue[pathActions[i]] += value;
+        }
+    }
+
+public:
+    MctsHeroPolicy(int threads, chrono::microseconds budget, uint64_t seed)
+        : pool(max(1, threads)), tables(max(1, threads)), budget(budget) {
+        for (int i = 0; i < pool.size(); ++i) rngs.emplace_back(seed + 0x9E3779B97F4A7C15ULL * (i + 1));
+    }
+
+    uint64_t lastIterations() const { return iterations; }
+
+    // Best action of the hero about to act in root (heroes' turn)
+    int search(const SearchState& root, const SearchRules& rules) {
+        // The clock starts before any work; a fifth of the budget (at least
+        // 1 ms) is left for waking the pool, threads the OS runs late and the
+        // merge, and every worker checks it before each playout
+        auto deadline = chrono::steady_clock::now() + budget - max<chrono::microseconds>(budget / 5, chrono::milliseconds(1));
+        int actions[SEARCH_MAX_ACTIONS];
+        int actionCount = SearchRules::legalActions(root, SearchRules::actingHero(root), actions);
+        if (actionCount == 1) {
+            iterations = 0;
+            return actions[0];
+        }
+
+        uint64_t rootKey = SearchRules::hash(root);
+        atomic<uint64_t> total(0);
+        pool.run([&](int worker) {
+            SearchTable& table = tables[worker];
+            table.clear();
+            uint64_t done = 0;
+            while (chrono::steady_clock::now() < deadline) {
+                iterate(root, rules, table, rngs[worker]);
+                ++done;
+            }
+            total += done;
+        });
+        iterations = total;
+
+        // Sum the root statistics of every thread's tree
+        uint64_t visits[SEARCH_MAX_ACTIONS] = {};
+        double value[SEARCH_MAX_ACTIONS] = {};
+        for (SearchTable& table : tables) {
+            bool created = false;
+            SearchTable::Node* node = table.findOrCreate(rootKey, created);
+            if (!node || created) continue;
+            for (int a = 0; a < node->actionCount; ++a) {
+                visits[a] += node->actionVisits[a];
+                value[a] += node->actionValue[a];
+            }
+        }
+        int best = 0;
+        for (int a = 1; a < actionCount; ++a) {
+            if (visits[a] > visits[best] || (visits[a] == visits[best] && value[a] > value[best])) best = a;
+        }
+        return actions[best];
+    }
+
+    HeroDecision decide(const pmr::vector<Hero*>& heroes, const pmr::vector<Enemy*>& enemies,
+                        int actingHero, size_t /*heroIndex*/, size_t enemyIndex) override {
+        // Hordes are beyond the search model; just keep cutting them down
+        if (enemies.size() > static_cast<size_t>(SIM_MAX_SIDE)) return {false, HeroDecision::ANY_ENEMY};
+
+        SearchState root;
+        SearchRules rules;
+        for (Hero* hero : heroes) {
+            if (root.heroCount == SIM_MAX_SIDE) break;
+            int slot = 0;
+            for (const PotionInstance* potion : hero->getPotions()) {
+                if (slot == SEARCH_MAX_POTIONS) break;
+                if (!potion->used) root.potionsLeft[root.heroCount] |= 1u << slot;
+                rules.setPotion(root.heroCount, slot++, potion->potion->getModifiers());
+            }
+            root.heroes[root.heroCount++] = makeSimCombatant(*hero);
+        }
+        for (Enemy* enemy : enemies) {
+            if (root.enemyCount == SIM_MAX_SIDE) break;
+            root.enemies[root.enemyCount++] = makeSimCombatant(*enemy);
+        }
+        root.heroIndex = actingHero; // the acting hero has not moved yet
+        root.enemyIndex = static_cast<int>(enemyIndex) % max(1, root.enemyCount);
+        root.heroesTurn = true;
+
+        int action = search(root, rules);
+        HeroDecision decision;
+        decision.usePotion = action >= SIM_MAX_SIDE;
+        decision.index = decision.usePotion ? action - SIM_MAX_SIDE : action;
+        return decision;
+    }
+};
+
+// ===== STAT BALANCER =====
+// Genetic search over the hero roster's stat lines, plus one HP/ATK/DEF scale
+// per enemy tier, aiming at a target win rate for every room. Each hero keeps a
+// fixed stat budget (HP + ATK + DEF + SPD + LCK within [minTotal, maxTotal],
+// as in descripcion.txt) and per-stat bounds. Fitness is the mean squared gap
+// between simulated and target win rates over a few fixed teams and all ten
+// rooms. Every candidate is simulated with the same battle seeds, so
+// candidates are compared on equal luck, and a generation's evaluations are
+// spread over the MCTS worker pool.
+const int BALANCE_TIERS = 3;
+constexpr const char* BALANCE_TIER_NAMES[BALANCE_TIERS] = {"Soldado", "Mini-Jefe", "Jefe Final"};
+
+// Win rate the designers want for each room with a fresh team
+const double BALANCE_TARGETS[10] = {0.95, 0.92, 0.75, 0.88, 0.85, 0.70, 0.82, 0.78, 0.75, 0.50};
+
+// Teams every candidate is tried with (indices into the hero roster)
+const int BALANCE_TEAMS[][3] = {{0, 1, 2}, {3, 4, 5}, {0, 2, 4}, {1, 3, 5}};
+const int BALANCE_TEAM_COUNT = sizeof(BALANCE_TEAMS) / sizeof(BALANCE_TEAMS[0]);
+
+const int BALANCE_MIN_TOTAL = 100;
+const int BALANCE_MAX_TOTAL = 115;
+const int BALANCE_STAT_MIN[STAT_COUNT] = {30, 4, 3, 3, 3};
+const int BALANCE_STAT_MAX[STAT_COUNT] = {90, 25, 20, 15, 20};
+
+struct BalanceCandidate {
+    int stats[HERO_ROSTER_SIZE][STAT_COUNT];
+    double tierScale[BALANCE_TIERS];
+    double fitness = 0;
+    double winRate[10] = {};
+};
+
+class StatBalancer {
+private:
+    int minTotal;
+    int maxTotal;
+    int battlesPerRoom;
+    RngService seeds;
+    Rng rng;
+    SearchPool& pool;
+
+    static int tierOf(const CharacterTemplate& t) {
+        for (int tier = 0; tier < BALANCE_TIERS; ++tier) {
+            if (string_view(t.type) == BALANCE_TIER_NAMES[tier]) return tier;
+        }
+        return 0;
+    }
+
+    int total(const int* stats) const {
+        int sum = 0;
+        for (int s = 0; s < STAT_COUNT; ++s) sum += stats[s];
+        return sum;
+    }
+
+    // Clamps each stat, then moves single points until the total fits the budget
+    void repair(int* stats) {
+        for (int s = 0; s < STAT_COUNT; ++s) {
+            stats[s] = max(BALANCE_STAT_MIN[s], min(BALANCE_STAT_MAX[s], stats[s]));
+        }
+        int sum = total(stats);
+        while (sum > maxTotal || sum < minTotal) {
+            int s = rng.below(STAT_COUNT);
+            if (sum > maxTotal && stats[s] > BALANCE_STAT_MIN[s]) {
+                --stats[s];
+                --sum;
+            } else if (sum < minTotal && stats[s] < BALANCE_STAT_MAX[s]) {
+                ++stats[s];
+                ++sum;
+            }
+        }
+    }
+
+    void mutate(BalanceCandidate& c) {
+        for (int h = 0; h < HERO_ROSTER_SIZE; ++h) {
+            if (rng.below(3) != 0) continue;
+            // Move points between two stats (budget-neutral), sometimes grow or shrink
+            int from = rng.below(STAT_COUNT);
+            int to = rng.below(STAT_COUNT);
+            int amount = 1 + rng.below(from == STAT_HP || to == STAT_HP ? 6 : 3);
+            c.stats[h][from] -= amount;
+            c.stats[h][to] += amount;
+            if (rng.below(4) == 0) c.stats[h][rng.below(STAT_COUNT)] += rng.between(-3, 3);
+            repair(c.stats[h]);
+        }
+        for (int tier = 0; tier < BALANCE_TIERS; ++tier) {
+            if (rng.below(4) == 0) {
+                c.tierScale[tier] = max(0.3, min(1.5, c.tierScale[tier] + rng.between(-10, 10) / 100.0));
+            }
+        }
+    }
+
+    BalanceCandidate crossover(const BalanceCandidate& a, const BalanceCandidate& b) {
+        BalanceCandidate child = a;
+        for (int h = 0; h < HERO_ROSTER_SIZE; ++h) {
+            if (rng.below(2)) copy(b.stats[h], b.stats[h] + STAT_COUNT, child.stats[h]);
+        }
+        for (int tier = 0; tier < BALANCE_TIERS; ++tier) {
+            if (rng.below(2)) child.tierScale[tier] = b.tierScale[tier];
+        }
+        return child;
+    }
+
+    const BalanceCandidate& tournament(const vector<BalanceCandidate>& population) {
+        const BalanceCandidate* best = &population[rng.below(population.size())];
+        for (int i = 0; i < 2; ++i) {
+            const BalanceCandidate& other = population[rng.below(population.size())];
+            if (other.fitness < best->fitness) best = &other;
+        }
+        return *best;
+    }
+
+public:
+    StatBalancer(int minTotal, int maxTotal, int battlesPerRoom, uint64_t seed, SearchPool& pool)
+        : minTotal(minTotal), maxTotal(maxTotal), battlesPerRoom(battlesPerRoom), seeds(seed),
+          rng(seeds.stream(STREAM_SIMULATION, 1)), pool(pool) {}
+
+    // The shipped roster squeezed into the budget, with unscaled enemies
+    BalanceCandidate current() {
+        BalanceCandidate c;
+        for (int h = 0; h < HERO_ROSTER_SIZE; ++h) {
+            const CharacterTemplate& t = HERO_ROSTER[h];
+            int stats[STAT_COUNT] = {t.hp, t.atk, t.def, t.spd, t.lck};
+            copy(stats, stats + STAT_COUNT, c.stats[h]);
+            repair(c.stats[h]);
+        }
+        fill(c.tierScale, c.tierScale + BALANCE_TIERS, 1.0);
+        return c;
+    }
+
+    // Simulates every team in every room; fills winRate and fitness
+    void evaluate(BalanceCandidate& c) const {
+        BattleSimulator simulator;
+        double error = 0;
+        Rng layoutGen = seeds.stream(STREAM_DUNGEON); // rooms drawn in order, like a run
+        for (int room = 1; room <= 10; ++room) {
+            RoomLayout layout = buildRoomLayout(room, layoutGen);
+            int wins = 0;
+            for (int team = 0; team < BALANCE_TEAM_COUNT; ++team) {
+                BattleSetup setup;
+                for (int member : BALANCE_TEAMS[team]) {
+                    const int* s = c.stats[member];
+                    setup.addHero({s[STAT_HP], s[STAT_HP], s[STAT_ATK], s[STAT_DEF], s[STAT_SPD], s[STAT_LCK]});
+                }
+                for (const CharacterTemplate* t : layout) {
+                    SimCombatant enemy = makeSimCombatant(*t);
+                    double scale = c.tierScale[tierOf(*t)];
+                    enemy.hp = enemy.maxHp = max(1, static_cast<int>(enemy.hp * scale + 0.5));
+                    enemy.atk = max(1, static_cast<int>(enemy.atk * scale + 0.5));
+                    enemy.def = max(0, static_cast<int>(enemy.def * scale + 0.5));
+                    setup.addEnemy(enemy);
+                }
+                for (int b = 0; b < battlesPerRoom; ++b) {
+                    uint64_t battle = (uint64_t(room) * BALANCE_TEAM_COUNT + team) * battlesPerRoom + b;
+                    wins += simulator.run(setup, seeds.streamSeed(STREAM_SIMULATION, battle)).heroesWon;
+                }
+            }
+            c.winRate[room - 1] = static_cast<double>(wins) / (BALANCE_TEAM_COUNT * battlesPerRoom);
+            double gap = c.winRate[room - 1] - BALANCE_TARGETS[room - 1];
+            error += gap * gap;
+        }
+        c.fitness = error / 10;
+    }
+
+    // Evaluates the whole population on the pool's threads
+    void evaluateAll(vector<BalanceCandidate>& population) {
+        atomic<size_t> next(0);
+        pool.run([&](int) {
+            for (size_t i = next++; i < population.size(); i = next++) evaluate(population[i]);
+        });
+    }
+
+    // Runs the search; returns the final population, best first
+    vector<BalanceCandidate> run(int generations, int populationSize, const function<void(int, const BalanceCandidate&)>& progress) {
+        vector<BalanceCandidate> population;
+        population.push_back(current());
+        while (static_cast<int>(population.size()) < populationSize) {
+            BalanceCandidate c = population[0];
+            for (int i = 0; i < 4; ++i) mutate(c);
+            population.push_back(c);
+        }
+        evaluateAll(population);
+        auto byFitness = [](const BalanceCandidate& a, const BalanceCandidate& b) { return a.fitness < b.fitness; };
+        sort(population.begin(), population.end(), byFitness);
+
+        const int elite = 2;
+        for (int generation = 1; generation <= generations; ++generation) {
+            vector<BalanceCandidate> next(population.begin(), population.begin() + elite);
+            while (static_cast<int>(next.size()) < populationSize) {
+                BalanceCandidate child = crossover(tournament(population), tournament(population));
+                mutate(child);
+                next.push_back(child);
+            }
+            // Elites keep their scores; only children need simulating
+            vector<BalanceCandidate> children(next.begin() + elite, next.end());
+            evaluateAll(children);
+            copy(children.begin(), children.end(), next.begin() + elite);
+            sort(next.begin(), next.end(), byFitness);
+            population.swap(next);
+            progress(generation, population[0]);
+        }
+        return population;
+    }
+};
+
+// ===== BATCH BATTLE ENGINE (STRUCTURE OF ARRAYS) =====
+// Steps many independent battles in lockstep, 8 battles per SIMD block. Each
+// block stores every stat as one 8-lane vector per roster slot (slots 0-3 are
+// heroes, 4-7 enemies), so a whole turn of 8 battles - actor and target
+// selection, the 85 + (lckA - lckD) * 2 hit clamp, max(1, atkA - defD) damage,
+// the 1.5x crit and the HP update - runs as straight-line vector code with no
+// per-battle branches. Vectors use the GCC/Clang vector extension with 8
+// lanes, and the kernel leans on AVX2's per-lane variable shifts and 32-bit
+// multiplies (emulated on plain SSE it ran at about half the scalar
+// simulator's speed). Its functions are therefore compiled for AVX2 whatever
+// the build flags, and run() picks the kernel from the CPU: without AVX2, or
+// on compilers/targets without the extension, the battles go through
+// BattleSimulator.
+//
+// Rules and target choice are the same as BattleSimulator. Each lane has its
+// own xoshiro128** stream seeded from the battle's RngService stream, and the
+// rolls use 16-bit precision, so individual battles differ from the scalar
+// simulator but the result distribution is the same. When a battle ends, its
+// lane is reloaded with the next battle of the batch.
+struct BatchTotals {
+    long long battles = 0;
+    long long heroWins = 0;
+    long long turns = 0;
+    long long heroHpLost = 0;
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SISAS_BATCH_SIMD
+#define SISAS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+class BatchBattleEngine {
+private:
+    BattleSimulator simulator; // CPUs without AVX2
+
+    BatchTotals runScalar(const BattleSetup& setup, long long battles, const RngService& rngService) {
+        BatchTotals totals;
+        for (long long i = 0; i < battles; ++i) {
+            BattleResult result = simulator.run(setup, rngService.streamSeed(STREAM_SIMULATION, i));
+            ++totals.battles;
+            totals.heroWins += result.heroesWon;
+            totals.turns += result.turns;
+            totals.heroHpLost += result.heroHpLost;
+        }
+        return totals;
+    }
+
+#ifdef SISAS_BATCH_SIMD
+    static const int WIDTH = 8;
+    static const int SLOTS = SIM_MAX_SIDE * 2;
+    // Without -mavx2 GCC only gives 32-byte vectors 16-byte alignment, while
+    // the AVX2 functions load them with aligned moves
+    typedef int32_t Lanes __attribute__((vector_size(WIDTH * sizeof(int32_t)), aligned(WIDTH * sizeof(int32_t))));
+    typedef uint32_t ULanes __attribute__((vector_size(WIDTH * sizeof(uint32_t)), aligned(WIDTH * sizeof(uint32_t))));
+
+    struct Block {
+        Lanes hp[SLOTS];
+        Lanes atk[SLOTS];
+        Lanes def[SLOTS];
+        Lanes lck[SLOTS];
+        Lanes aliveBits;      // bit j set while slot j is alive
+        Lanes nextIndex[2];   // round-robin pointer per side
+        Lanes side;           // 0 heroes act, 1 enemies act
+        Lanes turns;
+        Lanes hpLost;
+        Lanes active;         // -1 while the lane holds a running battle
+        ULanes rng[4];        // xoshiro128** state
+    };
+
+    vector<Block> blocks;
+    bool slotUsed[SLOTS] = {};
+    const BattleSetup* setup = nullptr;
+    const RngService* seeds = nullptr;
+    long long nextBattle = 0;
+    long long totalBattles = 0;
+
+    SISAS_TARGET_AVX2 static void rotl(ULanes& x, int k) {
+        x = (x << k) | (x >> (32 - k));
+    }
+
+    // One xoshiro128** draw per lane; *5 and *9 are shift-adds
+    SISAS_TARGET_AVX2 static void draw(ULanes* st, ULanes& result) {
+        ULanes x = st[1] + (st[1] << 2);
+        rotl(x, 7);
+        result = x + (x << 3);
+        ULanes t = st[1] << 9;
+        st[2] ^= st[0];
+        st[3] ^= st[1];
+        st[1] ^= st[2];
+        st[0] ^= st[3];
+        st[2] ^= t;
+        rotl(st[3], 11);
+    }
+
+    void loadLane(Block& block, int lane, long long battle) {
+        int maxHeroSpd = -1;
+        int maxEnemySpd = -1;
+        int aliveBits = 0;
+        for (int i = 0; i < SIM_MAX_SIDE; ++i) {
+            const SimCombatant* h = (i < setup->heroCount) ? &setup->heroes[i] : nullptr;
+            const SimCombatant* e = (i < setup->enemyCount) ? &setup->enemies[i] : nullptr;
+            int es = SIM_MAX_SIDE + i;
+            block.hp[i][lane] = h ? h->hp : 0;
+            block.atk[i][lane] = h ? h->atk : 0;
+            block.def[i][lane] = h ? h->def : 0;
+            block.lck[i][lane] = h ? h->lck : 0;
+            block.hp[es][lane] = e ? e->hp : 0;
+            block.atk[es][lane] = e ? e->atk : 0;
+            block.def[es][lane] = e ? e->def : 0;
+            block.lck[es][lane] = e ? e->lck : 0;
+            if (h && h->hp > 0) {
+                aliveBits |= 1 << i;
+                maxHeroSpd = max(maxHeroSpd, h->spd);
+            }
+            if (e && e->hp > 0) {
+                aliveBits |= 1 << es;
+                maxEnemySpd = max(maxEnemySpd, e->spd);
+            }
+        }
+        block.aliveBits[lane] = aliveBits;
+        block.nextIndex[0][lane] = 0;
+        block.nextIndex[1][lane] = 0;
+        block.side[lane] = (maxHeroSpd >= maxEnemySpd) ? 0 : 1;
+        block.turns[lane] = 0;
+        block.hpLost[lane] = 0;
+        block.active[lane] = -1;
+        uint64_t seed = seeds->streamSeed(STREAM_SIMULATION, battle);
+        for (int w = 0; w < 4; w += 2) {
+            uint64_t bits = splitmix64(seed);
+            block.rng[w][lane] = static_cast<uint32_t>(bits);
+            block.rng[w + 1][lane] = static_cast<uint32_t>(bits >> 32);
+        }
+    }
+
+    // Advances every running battle of the block by one turn
+    SISAS_TARGET_AVX2 void step(Block& b) {
+        const Lanes zero = {};
+        const Lanes one = zero + 1;
+        const Lanes active = b.active;
+        const Lanes side = b.side;
+        const Lanes enemySide = one - side;
+        const Lanes sideMask = -side; // -1 where enemies act
+
+        // Actor: first living member at or after the side's round-robin pointer
+        Lanes count = sideMask ? zero + setup->enemyCount : zero + setup->heroCount;
+        Lanes ownAlive = (b.aliveBits >> (side * SIM_MAX_SIDE)) & 0xF;
+        Lanes pointer = sideMask ? b.nextIndex[1] : b.nextIndex[0];
+        Lanes actor = zero;
+        Lanes found = zero;
+        for (int t = 0; t < SIM_MAX_SIDE; ++t) {
+            Lanes candidate = pointer + t;
+            candidate = (candidate >= count) ? candidate - count : candidate;
+            Lanes take = (t < count) & (((ownAlive >> candidate) & 1) != 0) & ~found;
+            actor = take ? candidate : actor;
+            found |= take;
+        }
+        Lanes advanced = actor + 1;
+        advanced = (advanced >= count) ? zero : advanced;
+        b.nextIndex[0] = (active & ~sideMask) ? advanced : b.nextIndex[0];
+        b.nextIndex[1] = (active & sideMask) ? advanced : b.nextIndex[1];
+        Lanes actorSlot = actor + side * SIM_MAX_SIDE;
+
+        // Target: uniformly random living member of the other side
+        Lanes otherAlive = (b.aliveBits >> (enemySide * SIM_MAX_SIDE)) & 0xF;
+        Lanes livingTargets = (otherAlive & 1) + ((otherAlive >> 1) & 1) + ((otherAlive >> 2) & 1) + ((otherAlive >> 3) & 1);
+        ULanes pickBits;
+        draw(b.rng, pickBits);
+        Lanes pick = reinterpret_cast<Lanes>(((pickBits >> 16) * reinterpret_cast<ULanes>(livingTargets)) >> 16);
+        Lanes target = zero;
+        Lanes seen = zero;
+        for (int j = 0; j < SIM_MAX_SIDE; ++j) {
+            Lanes bit = (otherAlive >> j) & 1;
+            target = ((bit != 0) & (seen == pick)) ? zero + j : target;
+            seen += bit;
+        }
+        Lanes targetSlot = target + enemySide * SIM_MAX_SIDE;
+
+        // Gather attacker and defender stats with slot masks (only slots in use)
+        Lanes atkA = zero, lckA = zero, defD = zero, lckD = zero, hpD = zero;
+        for (int j = 0; j < SLOTS; ++j) {
+            if (!slotUsed[j]) continue;
+            Lanes isActor = actorSlot == j;
+            Lanes isTarget = targetSlot == j;
+            atkA |= isActor & b.atk[j];
+            lckA |= isActor & b.lck[j];
+            defD |= isTarget & b.def[j];
+            lckD |= isTarget & b.lck[j];
+            hpD |= isTarget & b.hp[j];
+        }
+
+        // Hit and crit rolls in [0, 100) from the two halves of one draw
+        ULanes rollBits;
+        draw(b.rng, rollBits);
+        Lanes hitRoll = reinterpret_cast<Lanes>(((rollBits >> 16) * 100u) >> 16);
+        Lanes critRoll = reinterpret_cast<Lanes>(((rollBits & 0xFFFFu) * 100u) >> 16);
+
+        Lanes chance = 85 + ((lckA - lckD) << 1);
+        chance = (chance > 95) ? zero + 95 : chance;
+        chance = (chance < 10) ? zero + 10 : chance;
+        Lanes damage = atkA - defD;
+        damage = (damage < 1) ? one : damage;
+        damage += (critRoll < lckA) & (damage >> 1);
+        damage &= (hitRoll < chance) & active;
+        Lanes removed = (hpD < damage) ? hpD : damage;
+
+        // Scatter the new HP and retire whoever dropped to 0
+        for (int j = 0; j < SLOTS; ++j) {
+            if (!slotUsed[j]) continue;
+            b.hp[j] -= (targetSlot == j) & removed;
+        }
+        Lanes killed = (hpD - removed == 0) & active;
+        b.aliveBits &= ~(killed & (one << targetSlot));
+        b.hpLost += sideMask & removed;
+        b.turns -= active;
+        b.side = active ? enemySide : side;
+    }
+
+    SISAS_TARGET_AVX2 void collectFinished(Block& b, BatchTotals& totals) {
+        Lanes heroesAlive = b.aliveBits & 0xF;
+        Lanes enemiesAlive = (b.aliveBits >> SIM_MAX_SIDE) & 0xF;
+        Lanes finished = ((heroesAlive == 0) | (enemiesAlive == 0)) & b.active;
+        uint64_t words[WIDTH / 2];
+        memcpy(words, &finished, sizeof(words));
+        uint64_t any = 0;
+        for (uint64_t w : words) any |= w;
+        if (!any) return; // the common case: every battle is still running
+        for (int lane = 0; lane < WIDTH; ++lane) {
+            if (!finished[lane]) continue;
+            ++totals.battles;
+            totals.heroWins += heroesAlive[lane] != 0;
+            totals.turns += b.turns[lane];
+            totals.heroHpLost += b.hpLost[lane];
+            if (nextBattle < totalBattles) {
+                loadLane(b, lane, nextBattle++);
+            } else {
+                b.active[lane] = 0;
+            }
+        }
+    }
+
+    SISAS_TARGET_AVX2 void stepUntilDone(BatchTotals& totals) {
+        while (totals.battles < totalBattles) {
+            for (Block& block : blocks) {
+                step(block);
+                collectFinished(block, totals);
+            }
+        }
+    }
+
+    BatchTotals runVector(const BattleSetup& battleSetup, long long battles, const RngService& rngService) {
+        BatchTotals totals;
+        setup = &battleSetup;
+        seeds = &rngService;
+        totalBattles = battles;
+        nextBattle = 0;
+        for (int i = 0; i < SIM_MAX_SIDE; ++i) {
+            slotUsed[i] = i < setup->heroCount;
+            slotUsed[SIM_MAX_SIDE + i] = i < setup->enemyCount;
+        }
+
+        for (Block& block : blocks) {
+            block = Block();
+            for (int lane = 0; lane < WIDTH; ++lane) {
+                if (nextBattle < totalBattles) {
+                    loadLane(block, lane, nextBattle++);
+                }
+            }
+        }
+
+        stepUntilDone(totals);
+        return totals;
+    }
+#endif
+
+public:
+    // lanes is rounded up to a multiple of the vector width
+    explicit BatchBattleEngine(int lanes = 64) {
+#ifdef SISAS_BATCH_SIMD
+        blocks.resize((max(lanes, 1) + WIDTH - 1) / WIDTH);
+#else
+        (void)lanes;
+#endif
+    }
+
+    static bool vectorized() {
+#ifdef SISAS_BATCH_SIMD
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    static const char* kernelName() { return vectorized() ? "AVX2" : "escalar"; }
+
+    // Runs `battles` battles of the same setup, battle i seeded from stream i
+    BatchTotals run(const BattleSetup& setup, long long battles, const RngService& rngService) {
+#ifdef SISAS_BATCH_SIMD
+        if (vectorized()) return runVector(setup, battles, rngService);
+#endif
+        return runScalar(setup, battles, rngService);
+    }
+};
+
+// ===== ROOM CLASS =====
+class Room {
+private:
+    int roomNumber;
+    pmr::vector<Enemy*> enemies; // owned by whoever made the room (the run arena)
+    string roomType;
+    bool isCleared;
+    const LootTable* loot;       // shared, never owned
+
+public:
+    Room(int number, const string& type, pmr::memory_resource* resource = pmr::get_default_resource(),
+         size_t capacity = MAX_ROOM_ENEMIES)
+        : roomNumber(number), enemies(resource), roomType(type), isCleared(false), loot(&lootTableForRoom(0)) {
+        enemies.reserve(capacity);
+    }
+
+    void addEnemy(Enemy* enemy) {
+        enemies.push_back(enemy);
+    }
+
+    const pmr::vector<Enemy*>& getEnemies() const { return enemies; }
+    int getRoomNumber() const { return roomNumber; }
+    string getRoomType() const { return roomType; }
+    bool isRoomCleared() const { return isCleared; }
+    void clearRoom() { isCleared = true; }
+    void setLootTable(const LootTable& table) { loot = &table; } // must outlive the room
+    const LootTable& getLootTable() const { return *loot; }
+
+    void displayRoomInfo() const {
+        gameText() << "\n--- Estás en la Sala " << roomNumber << " ---" << '\n';
+        gameText() << "Tipo de sala: " << roomType << '\n';
+        if (!enemies.empty()) {
+            gameText() << "¡Enemigos a la vista!" << '\n';
+            for (const auto& enemy : enemies) {
+                if (enemy->isAlive()) {
+                    enemy->displayStats();
+                }
+            }
+        } else {
+            gameText() << "La sala parece tranquila por ahora..." << '\n';
+        }
+    }
+
+    // Random item reward drawn with this room's loot odds (needs an Inventory instance)
+    // This method would typically be called by the Game class
+    const Item* getItemReward(Inventory* inventory, Rng& rng) const {
+        return inventory->getRandomItem(*loot, rng);
+    }
+
+    // Loot odds per room, built once and shared: the chest (room 3) and the
+    // treasure (room 6) hold a guaranteed rare weapon, every other room the
+    // classic uniform common draw
+    static const LootTable& lootTableForRoom(int roomNumber) {
+        static const LootTable rareWeapon({{CATEGORY_WEAPON, RARITY_RARE, 1}});
+        static const LootTable common = LootTable::uniform(RARITY_COMMON);
+        return (roomNumber == 3 || roomNumber == 6) ? rareWeapon : common;
+    }
+};
+
+// Builds dungeon room roomNumber (1-10) with its enemies and loot, all
+// allocated from arena
+Room* buildDungeonRoom(int roomNumber, Rng& gen, RunArena& arena) {
+    Room* room = arena.create<Room>(roomNumber, "Normal", &arena); // Default room type
+    for (const CharacterTemplate* t : buildRoomLayout(roomNumber, gen)) {
+        room->addEnemy(arena.create<Enemy>(t->name, t->hp, t->atk, t->def, t->spd, t->lck, t->type, &arena));
+    }
+    room->setLootTable(Room::lootTableForRoom(roomNumber));
+    return room;
+}
+
+// A "Horda" room: size copies of HORDE_MINION, all allocated from arena
+Room* buildHordeRoom(int roomNumber, int size, RunArena& arena) {
+    const CharacterTemplate& t = HORDE_MINION;
+    Room* room = arena.create<Room>(roomNumber, "Horda", &arena, static_cast<size_t>(size));
+    for (int i = 0; i < size; ++i) {
+        room->addEnemy(arena.create<Enemy>(t.name, t.hp, t.atk, t.def, t.spd, t.lck, t.type, &arena));
+    }
+    room->setLootTable(Room::lootTableForRoom(roomNumber));
+    return room;
+}
+
+// ===== ENDLESS DUNGEON =====
+// Endless mode repeats the classic ten-room cycle (chest at 3, treasure at 6,
+// healer at 8, bosses at 10, then again from 11) with enemy HP/ATK/DEF
+// growing ENDLESS_GROWTH_PERCENT of their base per room. Room d of run r is
+// built on demand from a seed derived from (master seed, r, d) alone, so any
+// room can be rebuilt without the ones before it, and each game of a process
+// gets its own rooms. Only the current room and the prefetched next
+// one exist, each in its own arena; entering a room recycles the arena of
+// the one left behind, so memory stays flat however deep a run goes.
+const int ENDLESS_CYCLE = 10;
+const int ENDLESS_GROWTH_PERCENT = 2;
+const int ENDLESS_STAT_CAP = 1000000000; // keeps damage math in int range at absurd depths
+
+// Classic room (1-10) whose layout and event room depth repeats
+int endlessCyclePosition(int depth) {
+    return (depth - 1) % ENDLESS_CYCLE + 1;
+}
+
+int scaleForDepth(int stat, int depth) {
+    int64_t percent = 100 + static_cast<int64_t>(ENDLESS_GROWTH_PERCENT) * (depth - 1);
+    return static_cast<int>(min<int64_t>(stat * percent / 100, ENDLESS_STAT_CAP));
+}
+
+Room* buildEndlessRoom(int depth, uint64_t roomSeed, RunArena& arena) {
+    int position = endlessCyclePosition(depth);
+    Rng gen(roomSeed);
+    Room* room = arena.create<Room>(depth, "Normal", &arena);
+    for (const CharacterTemplate* t : buildRoomLayout(position, gen)) {
+        room->addEnemy(arena.create<Enemy>(t->name, scaleForDepth(t->hp, depth), scaleForDepth(t->atk, depth),
+                                           scaleForDepth(t->def, depth), t->spd, t->lck, t->type, &arena));
+    }
+    room->setLootTable(Room::lootTableForRoom(position));
+    return room;
+}
+
+class EndlessDungeon {
+private:
+    RngService seeds;
+    RngService runSeeds; // this run's rooms
+    RunArena arenas[2];
+    Room* rooms[2] = {nullptr, nullptr};
+    int depths[2] = {0, 0};
+    int current = 0;
+
+    void build(int slot, int depth) {
+        arenas[slot].reset();
+        rooms[slot] = buildEndlessRoom(depth, runSeeds.streamSeed(STREAM_ENDLESS, depth), arenas[slot]);
+        depths[slot] = depth;
+    }
+
+public:
+    explicit EndlessDungeon(uint64_t masterSeed) : seeds(masterSeed), runSeeds(seeds.streamSeed(STREAM_ENDLESS)) {}
+
+    // Room at depth (1-based) and the prefetch of depth + 1. The room
+    // entered before this one is gone afterwards.
+    Room* enter(int depth) {
+        int next = 1 - current;
+        if (depths[next] != depth) build(next, depth); // first room, or a jump
+        current = next;
+        build(1 - current, depth + 1);
+        return rooms[current];
+    }
+
+    // Drops the rooms of the last run; the next run (0-based) gets its own
+    void startRun(uint64_t run) {
+        for (int slot = 0; slot < 2; ++slot) {
+            arenas[slot].reset();
+            rooms[slot] = nullptr;
+            depths[slot] = 0;
+        }
+        runSeeds = RngService(seeds.streamSeed(STREAM_ENDLESS, run));
+    }
+
+    size_t bytesReserved() const { return arenas[0].bytesReserved() + arenas[1].bytesReserved(); }
+};
+
+// ===== SCORE CLASS =====
+const char* const TIMESTAMP_FORMAT = "%Y-%m-%d %H:%M:%S";
+
+// Called from the leaderboard compactor too, so it avoids localtime()'s
+// shared buffer
+string formatTimestamp(long long epochSeconds) {
+    time_t t = static_cast<time_t>(epochSeconds);
+    tm local = {};
+#ifdef _WIN32
+    localtime_s(&local, &t);
+#else
+    localtime_r(&t, &local);
+#endif
+    char buffer[80];
+    strftime(buffer, sizeof(buffer), TIMESTAMP_FORMAT, &local);
+    return string(buffer);
+}
+
+long long parseTimestamp(const string& text) {
+    tm parsed = {};
+    istringstream ss(text);
+    ss >> get_time(&parsed, TIMESTAMP_FORMAT);
+    if (ss.fail()) return 0;
+    parsed.tm_isdst = -1;
+    return static_cast<long long>(mktime(&parsed));
+}
+
+struct Score {
+    string playerName;
+    int roomReached;
+    int totalHealthLost;
+    string timestamp;
+    long long epochSeconds; // Same instant as timestamp; what the binary log stores
+
+    Score(string name = "", int room = 0, int health = 0, string ts = "", long long epoch = 0) 
+        : playerName(name), roomReached(room), totalHealthLost(health), timestamp(ts), epochSeconds(epoch) {}
+
+    // Operator for sorting: higher roomReached is better. If same room, lower healthLost is better.
+    bool operator<(const Score& other) const {
+        if (roomReached != other.roomReached) {
+            return roomReached > other.roomReached; // Descending order for roomReached
+        }
+        return totalHealthLost < other.totalHealthLost; // Ascending order for totalHealthLost
+    }
+};
+
+// ===== SCORE RANKING =====
+// Order-statistics treap over (roomReached, totalHealthLost) with the same
+// ordering as Score::operator<. Every node stores how many scores its subtree
+// holds, so insert, "how many runs beat this one" and the top K are all
+// O(log D + K) with no re-sorting, where D is the number of distinct results.
+// Runs collapse onto few distinct results (ten rooms, small health losses),
+// so equal keys share one node and keep their ids in a per-node list in
+// insertion order; the tree stays small enough to live in cache even with
+// millions of scores. Ids point back into the caller's own score storage.
+class ScoreRanking {
+private:
+    struct Node {
+        int32_t room;
+        int32_t health;
+        uint32_t priority;
+        uint32_t count;      // scores with exactly this key
+        uint32_t size;       // scores in this subtree
+        int32_t left;
+        int32_t right;
+        int32_t firstEntry;  // ids with this key, linked through entryNext
+        int32_t lastEntry;
+    };
+
+    vector<Node> nodes;
+    vector<uint32_t> entryIds;
+    vector<int32_t> entryNext;
+    int32_t root = -1;
+    uint64_t priorityState = 0x5EED5C0BE5ULL;
+
+    // True if (roomA, healthA) ranks strictly before (roomB, healthB)
+    static bool better(int roomA, int healthA, int roomB, int healthB) {
+        if (roomA != roomB) return roomA > roomB;
+        return healthA < healthB;
+    }
+
+    uint32_t sizeOf(int32_t n) const { return n < 0 ? 0 : nodes[n].size; }
+
+    void update(int32_t n) {
+        nodes[n].size = nodes[n].count + sizeOf(nodes[n].left) + sizeOf(nodes[n].right);
+    }
+
+    // Splits t into keys ranking before (room, health) (l) and the rest (r)
+    void split(int32_t t, int room, int health, int32_t& l, int32_t& r) {
+        if (t < 0) {
+            l = r = -1;
+            return;
+        }
+        if (better(nodes[t].room, nodes[t].health, room, health)) {
+            split(nodes[t].right, room, health, nodes[t].right, r);
+            l = t;
+        } else {
+            split(nodes[t].left, room, health, l, nodes[t].left);
+            r = t;
+        }
+        update(t);
+    }
+
+    int32_t merge(int32_t l, int32_t r) {
+        if (l < 0) return r;
+        if (r < 0) return l;
+        if (nodes[l].priority > nodes[r].priority) {
+            nodes[l].right = merge(nodes[l].right, r);
+            update(l);
+            return l;
+        }
+        nodes[r].left = merge(l, nodes[r].left);
+        update(r);
+        return r;
+    }
+
+    int32_t find(int room, int health) const {
+        int32_t t = root;
+        while (t >= 0) {
+            const Node& node = nodes[t];
+            if (better(room, health, node.room, node.health)) t = node.left;
+            else if (better(node.room, node.health, room, health)) t = node.right;
+            else return t;
+        }
+        return -1;
+    }
+
+    int32_t newEntry(uint32_t id) {
+        entryIds.push_back(id);
+        entryNext.push_back(-1);
+        return static_cast<int32_t>(entryIds.size() - 1);
+    }
+
+public:
+    void clear() {
+        nodes.clear();
+        entryIds.clear();
+        entryNext.clear();
+        root = -1;
+    }
+
+    void reserve(size_t n) {
+        entryIds.reserve(n);
+        entryNext.reserve(n);
+    }
+
+    size_t size() const { return sizeOf(root); }
+
+    size_t distinctResults() const { return nodes.size(); }
+
+    // 1 + number of entries that rank strictly better (ties share a rank)
+    size_t rankOf(int room, int health) const {
+        size_t betterCount = 0;
+        int32_t t = root;
+        while (t >= 0) {
+            const Node& node = nodes[t];
+            if (better(node.room, node.health, room, health)) {
+                betterCount += node.count + sizeOf(node.left);
+                t = node.right;
+            } else {
+                t = node.left;
+            }
+        }
+        return betterCount + 1;
+    }
+
+    // Adds an entry after any existing equal keys; returns its rank
+    size_t insert(int room, int health, uint32_t id) {
+        int32_t entry = newEntry(id);
+        int32_t existing = find(room, health);
+        if (existing >= 0) {
+            // Known result: bump the counts along the search path
+            size_t betterCount = 0;
+            int32_t t = root;
+            while (true) {
+                Node& node = nodes[t];
+                node.size += 1;
+                if (t == existing) break;
+                if (better(node.room, node.health, room, health)) {
+                    betterCount += node.count + sizeOf(node.left);
+                    t = node.right;
+                } else {
+                    t = node.left;
+                }
+            }
+            Node& node = nodes[existing];
+            betterCount += sizeOf(node.left);
+            node.count += 1;
+            entryNext[node.lastEntry] = entry;
+            node.lastEntry = entry;
+            return betterCount + 1;
+        }
+
+        size_t rank = rankOf(room, health);
+        int32_t n = static_cast<int32_t>(nodes.size());
+        nodes.push_back({room, health, static_cast<uint32_t>(splitmix64(priorityState)), 1, 1, -1, -1, entry, entry});
+        int32_t l, r;
+        split(root, room, health, l, r);
+        root = merge(merge(l, n), r);
+        return rank;
+    }
+
+    // Ids of the best k entries, best first
+    void topK(size_t k, vector<uint32_t>& out) const {
+        out.clear();
+        vector<int32_t> stack;
+        int32_t t = root;
+        while ((t >= 0 || !stack.empty()) && out.size() < k) {
+            while (t >= 0) {
+                stack.push_back(t);
+                t = nodes[t].left;
+            }
+            t = stack.back();
+            stack.pop_back();
+            for (int32_t e = nodes[t].firstEntry; e >= 0 && out.size() < k; e = entryNext[e]) {
+                out.push_back(entryIds[e]);
+            }
+            t = nodes[t].right;
+        }
+    }
+
+    void inOrder(vector<uint32_t>& out) const { topK(size(), out); }
+};
+
+// ===== LEADERBOARD STORAGE =====
+// Scores live in two binary files next to the CSV leaderboard:
+//   <name>.log   append-only: header, then one record per finished game
+//   <name>.snap  sorted snapshot written by compaction
+// A record is varint(name length), name bytes, varint(room), varint(health
+// lost) and a zigzag varint of the timestamp minus the previous record's
+// (the first record of a file is relative to 0). A typical record is ~15 bytes.
+//
+// Compaction folds the log into a new snapshot in the background and starts a
+// new log generation. The snapshot remembers which log generation and how
+// many of its records it absorbed, so a crash between writing the snapshot and
+// resetting the log never counts a score twice.
+const char LEADERBOARD_LOG_MAGIC[8] = {'S', 'I', 'S', 'A', 'S', 'L', 'G', '1'};
+const char LEADERBOARD_SNAPSHOT_MAGIC[8] = {'S', 'I', 'S', 'A', 'S', 'S', 'N', '1'};
+
+void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool getVarint(const char*& p, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false; // truncated or malformed
+}
+
+uint64_t zigzagEncode(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+int64_t zigzagDecode(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+void encodeScore(string& out, const Score& score, long long& previousTime) {
+    putVarint(out, score.playerName.size());
+    out.append(score.playerName);
+    putVarint(out, static_cast<uint64_t>(max(0, score.roomReached)));
+    putVarint(out, static_cast<uint64_t>(max(0, score.totalHealthLost)));
+    putVarint(out, zigzagEncode(score.epochSeconds - previousTime));
+    previousTime = score.epochSeconds;
+}
+
+bool decodeScore(const char*& p, const char* end, long long& previousTime, Score& score) {
+    uint64_t nameLength, room, health, delta;
+    if (!getVarint(p, end, nameLength) || static_cast<uint64_t>(end - p) < nameLength) return false;
+    string name(p, nameLength);
+    p += nameLength;
+    if (!getVarint(p, end, room) || !getVarint(p, end, health) || !getVarint(p, end, delta)) return false;
+    long long epoch = previousTime + zigzagDecode(delta);
+    previousTime = epoch;
+    score = Score(name, static_cast<int>(room), static_cast<int>(health), formatTimestamp(epoch), epoch);
+    return true;
+}
+
+bool readWholeFile(const string& path, string& data) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) return false;
+    ostringstream contents;
+    contents << file.rdbuf();
+    data = contents.str();
+    return true;
+}
+
+// Writes data to path, or appends it, and waits until it reaches the disk
+bool writeDurably(const string& path, const string& data, bool append) {
+#ifdef _WIN32
+    int flags = _O_WRONLY | _O_CREAT | _O_BINARY | (append ? _O_APPEND : _O_TRUNC);
+    int fd = _open(path.c_str(), flags, 0644);
+#else
+    int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+    int fd = open(path.c_str(), flags, 0644);
+#endif
+    if (fd < 0) return false;
+    size_t written = 0;
+    bool ok = true;
+    while (written < data.size()) {
+#ifdef _WIN32
+        int n = _write(fd, data.data() + written, static_cast<unsigned>(data.size() - written));
+#else
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+#endif
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+#ifdef _WIN32
+    ok = ok && _commit(fd) == 0;
+    _close(fd);
+#else
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+#endif
+    return ok;
+}
+
+// Moves an already synced file over path
+bool renameOver(const string& from, const string& path) {
+#ifdef _WIN32
+    remove(path.c_str()); // rename() does not overwrite on Windows
+#endif
+    return rename(from.c_str(), path.c_str()) == 0;
+}
+
+// Replaces path atomically: write a temporary file, sync it, rename over
+bool replaceDurably(const string& path, const string& data) {
+    string temporary = path + ".tmp";
+    return writeDurably(temporary, data, false) && renameOver(temporary, path);
+}
+
+// ===== SCOREMANAGER CLASS =====
+class ScoreManager {
+private:
+    vector<Score> scores;   // in load/save order; ranking holds the order
+    ScoreRanking ranking;
+    string filename;     // CSV leaderboard, kept for import/export
+    string logPath;
+    string snapshotPath;
+
+    static const size_t COMPACTION_THRESHOLD = 1024; // log records before compacting
+
+    // Guards scores and ranking (server sessions share one board across
+    // threads), the files and the log bookkeeping below
+    mutable mutex storageMutex;
+    uint64_t logGeneration = 0;
+    size_t logRecords = 0;
+    long long lastLogTime = 0;
+    bool logStarted = false; // the log file holds a valid header
+    bool compacting = false;
+    vector<Score> appendedDuringCompaction;
+    thread compactor;
+
+    static string binaryBasePath(const string& csvPath) {
+        size_t dot = csvPath.find_last_of('.');
+        size_t slash = csvPath.find_last_of("/\\");
+        if (dot == string::npos || (slash != string::npos && dot < slash)) return csvPath;
+        return csvPath.substr(0, dot);
+    }
+
+    static string logHeader(uint64_t generation) {
+        string header(LEADERBOARD_LOG_MAGIC, sizeof(LEADERBOARD_LOG_MAGIC));
+        putVarint(header, generation);
+        return header;
+    }
+
+    // Parses a snapshot file's contents into out; false if they are not a snapshot
+    static bool parseSnapshot(const string& data, uint64_t& absorbedGeneration, uint64_t& absorbedRecords, vector<Score>& out) {
+        if (data.size() < sizeof(LEADERBOARD_SNAPSHOT_MAGIC)
+            || data.compare(0, sizeof(LEADERBOARD_SNAPSHOT_MAGIC), LEADERBOARD_SNAPSHOT_MAGIC, sizeof(LEADERBOARD_SNAPSHOT_MAGIC)) != 0) {
+            return false;
+        }
+        const char* p = data.data() + sizeof(LEADERBOARD_SNAPSHOT_MAGIC);
+        const char* end = data.data() + data.size();
+        uint64_t count;
+        if (!getVarint(p, end, absorbedGeneration) || !getVarint(p, end, absorbedRecords) || !getVarint(p, end, count)) {
+            return false;
+        }
+        long long previousTime = 0;
+        Score score;
+        for (uint64_t i = 0; i < count && decodeScore(p, end, previousTime, score); ++i) {
+            out.push_back(score);
+        }
+        return true;
+    }
+
+    // Parses a log file's contents: every whole record goes to out (up to
+    // maxRecords), goodBytes is where the last whole record ends
+    static bool parseLog(const string& data, uint64_t& generation, vector<Score>& out, size_t& goodBytes,
+                         long long& lastTime, size_t maxRecords = SIZE_MAX) {
+        if (data.size() < sizeof(LEADERBOARD_LOG_MAGIC)
+            || data.compare(0, sizeof(LEADERBOARD_LOG_MAGIC), LEADERBOARD_LOG_MAGIC, sizeof(LEADERBOARD_LOG_MAGIC)) != 0) {
+            return false;
+        }
+        const char* p = data.data() + sizeof(LEADERBOARD_LOG_MAGIC);
+        const char* end = data.data() + data.size();
+        if (!getVarint(p, end, generation)) return false;
+        const char* lastGood = p;
+        lastTime = 0;
+        Score score;
+        while (out.size() < maxRecords && p < end && decodeScore(p, end, lastTime, score)) {
+            lastGood = p;
+            out.push_back(score);
+        }
+        goodBytes = lastGood - data.data();
+        return true;
+    }
+
+    // Parses the snapshot; returns false if it is missing or unreadable
+    bool loadSnapshot(uint64_t& absorbedGeneration, uint64_t& absorbedRecords) {
+        string data;
+        return readWholeFile(snapshotPath, data) && parseSnapshot(data, absorbedGeneration, absorbedRecords, scores);
+    }
+
+    // Parses the log, skipping records a snapshot already absorbed. A torn
+    // record at the end (crash mid-append) is cut off so appends stay aligned.
+    bool loadLog(uint64_t absorbedGeneration, uint64_t absorbedRecords) {
+        string data;
+        vector<Score> records;
+        size_t goodBytes;
+        uint64_t generation;
+        if (!readWholeFile(logPath, data) || !parseLog(data, generation, records, goodBytes, lastLogTime)) return false;
+
+        logGeneration = generation;
+        logRecords = records.size();
+        uint64_t skip = (logGeneration == absorbedGeneration) ? absorbedRecords : 0;
+        if (skip < records.size()) scores.insert(scores.end(), records.begin() + skip, records.end());
+        if (goodBytes != data.size()) {
+            replaceDurably(logPath, data.substr(0, goodBytes));
+        }
+        return true;
+    }
+
+    void startCompactionIfNeeded() {
+        // Called with storageMutex held. The compactor reads what it absorbs
+        // back from the files, so nothing is copied here on the game thread.
+        if (compacting || logRecords < COMPACTION_THRESHOLD) return;
+        if (compactor.joinable()) compactor.join();
+        compacting = true;
+        appendedDuringCompaction.clear();
+        compactor = thread(&ScoreManager::compact, this, logGeneration, logRecords);
+    }
+
+    vector<Score> sortedScores() const {
+        vector<uint32_t> order;
+        ranking.inOrder(order);
+        vector<Score> sorted;
+        sorted.reserve(order.size());
+        for (uint32_t id : order) sorted.push_back(scores[id]);
+        return sorted;
+    }
+
+    void rebuildRanking() {
+        ranking.clear();
+        ranking.reserve(scores.size());
+        for (size_t i = 0; i < scores.size(); ++i) {
+            ranking.insert(scores[i].roomReached, scores[i].totalHealthLost, static_cast<uint32_t>(i));
+        }
+    }
+
+    // Background: merge the current snapshot with the first absorbedRecords
+    // records of the log (all of them fsynced before the count was taken)
+    // into a new snapshot, then start a new log generation holding only what
+    // was appended meanwhile. Appends only ever touch the log's tail, so
+    // reading both files needs no lock. The new log is written and synced
+    // outside the lock too; the lock is only taken to rename it into place,
+    // and if a save slipped in while it was being written it is rebuilt.
+    void compact(uint64_t generation, size_t absorbedRecords) {
+        vector<Score> captured;
+        string data;
+        uint64_t snapshotGeneration = 0;
+        uint64_t snapshotAbsorbed = 0;
+        if (!readWholeFile(snapshotPath, data) || !parseSnapshot(data, snapshotGeneration, snapshotAbsorbed, captured)) {
+            captured.clear();
+            snapshotGeneration = UINT64_MAX;
+        }
+        vector<Score> records;
+        uint64_t logFileGeneration;
+        size_t goodBytes;
+        long long lastTime;
+        bool ok = readWholeFile(logPath, data)
+                  && parseLog(data, logFileGeneration, records, goodBytes, lastTime, absorbedRecords)
+                  && logFileGeneration == generation && records.size() == absorbedRecords;
+        if (!ok) { // the files changed under us; try again at the next save
+            lock_guard<mutex> lock(storageMutex);
+            appendedDuringCompaction.clear();
+            compacting = false;
+            return;
+        }
+        size_t skip = (generation == snapshotGeneration) ? snapshotAbsorbed : 0;
+        if (skip < records.size()) captured.insert(captured.end(), records.begin() + skip, records.end());
+        stable_sort(captured.begin(), captured.end()); // same order as sortedScores()
+
+        string snapshot(LEADERBOARD_SNAPSHOT_MAGIC, sizeof(LEADERBOARD_SNAPSHOT_MAGIC));
+        putVarint(snapshot, generation);
+        putVarint(snapshot, absorbedRecords);
+        putVarint(snapshot, captured.size());
+        long long previousTime = 0;
+        for (const Score& score : captured) {
+            encodeScore(snapshot, score, previousTime);
+        }
+        ok = replaceDurably(snapshotPath, snapshot);
+
+        string temporary = logPath + ".tmp";
+        while (ok) {
+            vector<Score> appended;
+            {
+                lock_guard<mutex> lock(storageMutex);
+                appended = appendedDuringCompaction;
+            }
+            string log = logHeader(generation + 1);
+            long long previous = 0;
+            for (const Score& score : appended) {
+                encodeScore(log, score, previous);
+            }
+            ok = writeDurably(temporary, log, false);
+
+            lock_guard<mutex> lock(storageMutex);
+            if (!ok || appendedDuringCompaction.size() != appended.size()) continue;
+            if (renameOver(temporary, logPath)) {
+                logGeneration = generation + 1;
+                logRecords = appended.size();
+                lastLogTime = previous;
+                logStarted = true;
+            }
+            break;
+        }
+
+        lock_guard<mutex> lock(storageMutex);
+        appendedDuringCompaction.clear();
+        compacting = false;
+    }
+
+public:
+    // An empty file name keeps the board in memory only (scripted replays)
+    ScoreManager(const string& fn = "leaderboard.txt") : filename(fn) {
+        if (fn.empty()) return;
+        string base = binaryBasePath(fn);
+        logPath = base + ".log";
+        snapshotPath = base + ".snap";
+        loadScores();
+    }
+
+    ~ScoreManager() {
+        if (compactor.joinable()) compactor.join();
+    }
+
+    void loadScores() {
+        TRACE_SPAN("ScoreManager::loadScores");
+        if (compactor.joinable()) compactor.join();
+        lock_guard<mutex> lock(storageMutex);
+        scores.clear();
+        ranking.clear();
+        logGeneration = 0;
+        logRecords = 0;
+        lastLogTime = 0;
+        logStarted = false;
+
+        uint64_t absorbedGeneration = 0;
+        uint64_t absorbedRecords = 0;
+        bool haveSnapshot = loadSnapshot(absorbedGeneration, absorbedRecords);
+        if (!haveSnapshot) {
+            absorbedGeneration = UINT64_MAX;
+        }
+        bool haveLog = loadLog(absorbedGeneration, absorbedRecords);
+        logStarted = haveLog;
+        if (!haveLog) {
+            // The next save starts a fresh log. Its generation must follow
+            // the snapshot's, or the records the snapshot says it absorbed
+            // would hide the new ones on the next load.
+            logGeneration = haveSnapshot ? absorbedGeneration + 1 : 0;
+            logRecords = 0;
+            lastLogTime = 0;
+        }
+
+        if (!haveSnapshot && !haveLog) {
+            // First run with the binary format: bring in the CSV leaderboard
+            if (!importCsvLocked(filename)) {
+                gameText() << "Advertencia: No se pudo abrir el archivo de leaderboard. Se creará uno nuevo si se guarda una puntuación." << '\n';
+            }
+            return;
+        }
+        rebuildRanking();
+    }
+
+    // Returns the rank of the new score (ties share a rank)
+    size_t saveScore(const string& playerName, int roomReached, int healthLost) {
+        TRACE_SPAN("ScoreManager::saveScore");
+        long long now = static_cast<long long>(time(0));
+        Score score(playerName, roomReached, healthLost, formatTimestamp(now), now);
+
+        lock_guard<mutex> lock(storageMutex);
+        // O(log N) insert into the ranking instead of re-sorting the board
+        size_t rank = ranking.insert(roomReached, healthLost, static_cast<uint32_t>(scores.size()));
+        scores.push_back(score);
+        if (filename.empty()) return rank;
+
+        // One append + fsync per game; the log header is written on first use
+        // (replacing whatever unreadable file was there)
+        string record;
+        bool newLog = !logStarted;
+        if (newLog) {
+            record = logHeader(logGeneration);
+            lastLogTime = 0;
+        }
+        long long previousTime = lastLogTime;
+        encodeScore(record, score, previousTime);
+
+        if (writeDurably(logPath, record, !newLog)) {
+            logStarted = true;
+            lastLogTime = previousTime;
+            ++logRecords;
+            if (compacting) appendedDuringCompaction.push_back(score);
+            gameText() << "Puntuación guardada exitosamente." << '\n';
+            startCompactionIfNeeded();
+        } else {
+            gameText() << "Error: No se pudo guardar la puntuación en el archivo." << '\n';
+        }
+        return rank;
+    }
+
+    // CSV import/export (name,room,healthLost,timestamp per line). Import adds
+    // the rows to the current leaderboard.
+    bool importCsv(const string& path) {
+        if (compactor.joinable()) compactor.join();
+        lock_guard<mutex> lock(storageMutex);
+        return importCsvLocked(path);
+    }
+
+    bool exportCsv(const string& path) const {
+        ofstream file(path);
+        if (!file.is_open()) return false;
+        for (const auto& score : sortedScores()) {
+            file << score.playerName << "," 
+                 << score.roomReached << "," 
+                 << score.totalHealthLost << "," 
+                 << score.timestamp << '\n';
+        }
+        return static_cast<bool>(file);
+    }
+
+    size_t getScoreCount() const {
+        lock_guard<mutex> lock(storageMutex);
+        return scores.size();
+    }
+
+    // Rank a run with these results would get right now
+    size_t getRank(int roomReached, int healthLost) const {
+        lock_guard<mutex> lock(storageMutex);
+        return ranking.rankOf(roomReached, healthLost);
+    }
+
+    void displayLeaderboard(int limit = 10) const {
+        lock_guard<mutex> lock(storageMutex);
+        gameText() << "\n--- TABLA DE CLASIFICACIÓN ---" << '\n';
+        if (scores.empty()) {
+            gameText() << "No hay puntuaciones registradas aún." << '\n';
+            return;
+        }
         
-        vector<string> secondaryStats = {"HP", "DEF", "SPD", "LCK"};
+        gameText() << left << setw(3) << "#"
+             << setw(20) << "Jugador"
+             << setw(10) << "Salas"
+             << setw(15) << "Vida Perdida"
+             << setw(20) << "Fecha" << '\n';
+        gameText() << string(68, '-') << '\n';
+
+        vector<uint32_t> top;
+        ranking.topK(limit, top);
+        for (size_t i = 0; i < top.size(); ++i) {
+            const Score& score = scores[top[i]];
+            gameText() << left << setw(3) << (i + 1)
+                 << setw(20) << score.playerName
+                 << setw(10) << score.roomReached
+                 << setw(15) << score.totalHealthLost
+                 << setw(20) << score.timestamp << '\n';
+        }
+        gameText() << "------------------------------" << '\n';
+    }
+
+private:
+    // Reads a CSV leaderboard into memory and persists everything as a fresh
+    // snapshot + empty log. Called with storageMutex held.
+    bool importCsvLocked(const string& path) {
+        ifstream file(path);
+        if (!file.is_open()) return false;
+        string line;
+        while (getline(file, line)) {
+            stringstream ss(line);
+            string name, roomStr, healthStr, ts;
+            getline(ss, name, ',');
+            getline(ss, roomStr, ',');
+            getline(ss, healthStr, ',');
+            getline(ss, ts);
+            if (roomStr.empty() || healthStr.empty()) continue;
+
+            scores.emplace_back(name, stoi(roomStr), stoi(healthStr), ts, parseTimestamp(ts));
+        }
+        file.close();
+        rebuildRanking();
+
+        string snapshot(LEADERBOARD_SNAPSHOT_MAGIC, sizeof(LEADERBOARD_SNAPSHOT_MAGIC));
+        putVarint(snapshot, logGeneration);
+        putVarint(snapshot, logRecords); // the log's records are in scores too
+        putVarint(snapshot, scores.size());
+        long long previousTime = 0;
+        for (const Score& score : sortedScores()) {
+            encodeScore(snapshot, score, previousTime);
+        }
+        logGeneration += 1;
+        logRecords = 0;
+        lastLogTime = 0;
+        logStarted = replaceDurably(snapshotPath, snapshot) && replaceDurably(logPath, logHeader(logGeneration));
+        return logStarted;
+    }
+};
+
+// ===== BATTLE REPLAYS =====
+// A replay keeps the starting roster and the battle RNG state of one Battle,
+// then one compact record per turn. Playback re-simulates the turns from that
+// RNG state with the same combat rules (only the player's choices come from
+// the records), so any turn can be rebuilt and checked against what was
+// recorded. Every REPLAY_KEYFRAME_INTERVAL turns a full state keyframe lets
+// playback jump close to any turn instead of starting from the first one.
+//
+// Turn encoding: a flags byte (bits 0-1 actor index, bit 2 enemy side, bit 3
+// potion, bits 4-5 target, bit 6 hit, bit 7 potion expiry) and the hit roll;
+// hits add the crit roll and a varint damage. Potions and expiries store the
+// potion slot and its two modifiers instead. Most turns take 2 to 4 bytes.
+//
+// Enemies aim at a random slot of the battle's set of living heroes, whose
+// order changes as heroes fall, so states carry that order along with the
+// hit points and stats.
+//
+// File: REPLAY_MAGIC, then per battle a varint length and the battle record
+// (room, roster and RNG, turns, keyframes, result).
+const char REPLAY_MAGIC[8] = {'S', 'I', 'S', 'A', 'S', 'R', 'P', '2'};
+const int REPLAY_MAX_SIDE = 4;
+const uint32_t REPLAY_KEYFRAME_INTERVAL = 32;
+
+enum ReplayAction : uint8_t {
+    REPLAY_ATTACK,
+    REPLAY_POTION,
+    REPLAY_EXPIRY // a potion's effect wore off (initiative turn order)
+};
+
+struct ReplayTurn {
+    bool enemyActs;
+    uint8_t actor;       // index on the acting side
+    ReplayAction action;
+    uint8_t target;      // index on the other side (attacks)
+    uint8_t hitRoll;     // 1-100
+    uint8_t critRoll;    // 1-100, 0 when the attack missed
+    int damage;
+    int potionSlot;      // potions and expiries only
+    ItemModifiers effect;
+};
+
+struct ReplayCombatant {
+    int rosterIndex;           // into HERO_ROSTER or ENEMY_ROSTER, -1 if unknown
+    int hp;
+    int stats[STAT_COUNT];     // STAT_HP holds maxHp
+};
+
+// Everything needed to continue a battle from a turn boundary
+struct ReplayState {
+    ReplayCombatant heroes[REPLAY_MAX_SIDE];
+    ReplayCombatant enemies[REPLAY_MAX_SIDE];
+    int heroCount = 0;
+    int enemyCount = 0;
+    uint8_t livingHeroes[REPLAY_MAX_SIDE]; // Battle's living-hero set, same order
+    int livingCount = 0;
+    uint64_t rngState[4];
+
+    // Living heroes in roster order, as a battle starts
+    void resetLivingHeroes() {
+        livingCount = 0;
+        for (int i = 0; i < heroCount; ++i) {
+            if (heroes[i].hp > 0) livingHeroes[livingCount++] = static_cast<uint8_t>(i);
+        }
+    }
+
+    // Same swap-remove as AliveSet::remove
+    void heroFell(int hero) {
+        for (int k = 0; k < livingCount; ++k) {
+            if (livingHeroes[k] == hero) {
+                livingHeroes[k] = livingHeroes[--livingCount];
+                return;
+            }
+        }
+    }
+};
+
+void encodeReplayState(string& out, const ReplayState& state, bool withRoster) {
+    for (int side = 0; side < 2; ++side) {
+        const ReplayCombatant* units = side ? state.enemies : state.heroes;
+        int count = side ? state.enemyCount : state.heroCount;
+        for (int i = 0; i < count; ++i) {
+            if (withRoster) out.push_back(static_cast<char>(units[i].rosterIndex));
+            putVarint(out, zigzagEncode(units[i].hp));
+            for (int stat : units[i].stats) putVarint(out, zigzagEncode(stat));
+        }
+    }
+    if (!withRoster) { // a starting state derives it from the hit points
+        out.push_back(static_cast<char>(state.livingCount));
+        out.append(reinterpret_cast<const char*>(state.livingHeroes), state.livingCount);
+    }
+    out.append(reinterpret_cast<const char*>(state.rngState), sizeof(state.rngState));
+}
+
+// heroCount/enemyCount must already be set
+bool decodeReplayState(const char*& p, const char* end, ReplayState& state, bool withRoster) {
+    uint64_t value;
+    for (int side = 0; side < 2; ++side) {
+        ReplayCombatant* units = side ? state.enemies : state.heroes;
+        int count = side ? state.enemyCount : state.heroCount;
+        for (int i = 0; i < count; ++i) {
+            if (withRoster) {
+                if (p >= end) return false;
+                units[i].rosterIndex = static_cast<signed char>(*p++);
+            }
+            if (!getVarint(p, end, value)) return false;
+            units[i].hp = static_cast<int>(zigzagDecode(value));
+            for (int& stat : units[i].stats) {
+                if (!getVarint(p, end, value)) return false;
+                stat = static_cast<int>(zigzagDecode(value));
+            }
+        }
+    }
+    if (withRoster) {
+        state.resetLivingHeroes();
+    } else {
+        if (p >= end || *p < 0 || *p > state.heroCount || end - p <= *p) return false;
+        state.livingCount = *p++;
+        for (int k = 0; k < state.livingCount; ++k) {
+            state.livingHeroes[k] = static_cast<uint8_t>(*p++);
+            if (state.livingHeroes[k] >= state.heroCount) return false;
+        }
+    }
+    if (end - p < static_cast<ptrdiff_t>(sizeof(state.rngState))) return false;
+    memcpy(state.rngState, p, sizeof(state.rngState));
+    p += sizeof(state.rngState);
+    return true;
+}
+
+void encodeReplayTurn(string& out, const ReplayTurn& turn) {
+    uint8_t flags = (turn.actor & 3) | (turn.enemyActs ? 0x04 : 0);
+    if (turn.action != REPLAY_ATTACK) {
+        out.push_back(static_cast<char>(flags | (turn.action == REPLAY_POTION ? 0x08 : 0x80)));
+        putVarint(out, turn.potionSlot);
+        for (const StatModifier& mod : turn.effect) {
+            out.push_back(static_cast<char>(mod.stat));
+            putVarint(out, zigzagEncode(mod.delta));
+        }
+        return;
+    }
+    bool hit = turn.critRoll != 0;
+    flags |= ((turn.target & 3) << 4) | (hit ? 0x40 : 0);
+    out.push_back(static_cast<char>(flags));
+    out.push_back(static_cast<char>(turn.hitRoll));
+    if (hit) {
+        out.push_back(static_cast<char>(turn.critRoll));
+        putVarint(out, turn.damage);
+    }
+}
+
+bool decodeReplayTurn(const char*& p, const char* end, ReplayTurn& turn) {
+    if (p >= end) return false;
+    uint8_t flags = static_cast<uint8_t>(*p++);
+    turn = ReplayTurn();
+    turn.actor = flags & 3;
+    turn.enemyActs = (flags & 0x04) != 0;
+    uint64_t value;
+    if (flags & 0x88) {
+        turn.action = (flags & 0x08) ? REPLAY_POTION : REPLAY_EXPIRY;
+        if (!getVarint(p, end, value)) return false;
+        turn.potionSlot = static_cast<int>(value);
+        for (StatModifier& mod : turn.effect) {
+            if (p >= end || static_cast<uint8_t>(*p) >= STAT_COUNT) return false;
+            mod.stat = static_cast<Stat>(*p++);
+            if (!getVarint(p, end, value)) return false;
+            mod.delta = static_cast<int>(zigzagDecode(value));
+        }
+        return true;
+    }
+    turn.action = REPLAY_ATTACK;
+    turn.target = (flags >> 4) & 3;
+    if (p >= end) return false;
+    turn.hitRoll = static_cast<uint8_t>(*p++);
+    if (flags & 0x40) {
+        if (p >= end) return false;
+        turn.critRoll = static_cast<uint8_t>(*p++);
+        if (!getVarint(p, end, value)) return false;
+        turn.damage = static_cast<int>(value);
+    }
+    return true;
+}
+
+// Plays turn on state with the game's combat rules and returns it as it
+// actually happens from the state's RNG. Only the player's choices (hero
+// targets and potions) are taken from turn; enemy targets, rolls and damage
+// are re-derived.
+ReplayTurn resimulateTurn(ReplayState& state, const ReplayTurn& turn) {
+    ReplayTurn played = turn;
+    if (turn.action == REPLAY_POTION) {
+        ReplayCombatant& hero = state.heroes[turn.actor];
+        for (const StatModifier& mod : turn.effect) {
+            hero.stats[mod.stat] += mod.delta;
+            if (mod.stat == STAT_HP) hero.hp += mod.delta; // HP boosts also heal
+        }
+        return played;
+    }
+    if (turn.action == REPLAY_EXPIRY) {
+        ReplayCombatant& hero = state.heroes[turn.actor];
+        for (const StatModifier& mod : turn.effect) hero.stats[mod.stat] -= mod.delta;
+        hero.hp = min(hero.hp, hero.stats[STAT_HP]);
+        return played;
+    }
+
+    Rng rng;
+    rng.setState(state.rngState);
+    if (turn.enemyActs && state.livingCount > 0) {
+        played.target = state.livingHeroes[rng.below(state.livingCount)];
+    }
+    ReplayCombatant& attacker = turn.enemyActs ? state.enemies[turn.actor] : state.heroes[turn.actor];
+    ReplayCombatant& defender = turn.enemyActs ? state.heroes[played.target] : state.enemies[played.target];
+
+    played.hitRoll = static_cast<uint8_t>(rng.roll100());
+    played.critRoll = 0;
+    played.damage = 0;
+    if (played.hitRoll <= Character::hitChance(attacker.stats[STAT_LCK], defender.stats[STAT_LCK])) {
+        played.critRoll = static_cast<uint8_t>(rng.roll100());
+        played.damage = Character::damage(attacker.stats[STAT_ATK], defender.stats[STAT_DEF],
+                                          played.critRoll <= attacker.stats[STAT_LCK]);
+        defender.hp = max(0, defender.hp - played.damage);
+        if (turn.enemyActs && defender.hp == 0) state.heroFell(played.target);
+    }
+    rng.getState(state.rngState);
+    return played;
+}
+
+bool sameTurn(const ReplayTurn& a, const ReplayTurn& b) {
+    return a.enemyActs == b.enemyActs && a.actor == b.actor && a.action == b.action &&
+           (a.action != REPLAY_ATTACK ||
+            (a.target == b.target && a.hitRoll == b.hitRoll && a.critRoll == b.critRoll && a.damage == b.damage));
+}
+
+bool sameState(const ReplayState& a, const ReplayState& b) {
+    auto sameUnits = [](const ReplayCombatant* x, const ReplayCombatant* y, int count) {
+        for (int i = 0; i < count; ++i) {
+            if (x[i].hp != y[i].hp || memcmp(x[i].stats, y[i].stats, sizeof(x[i].stats)) != 0) return false;
+        }
+        return true;
+    };
+    return a.heroCount == b.heroCount && a.enemyCount == b.enemyCount &&
+           sameUnits(a.heroes, b.heroes, a.heroCount) && sameUnits(a.enemies, b.enemies, a.enemyCount) &&
+           a.livingCount == b.livingCount && memcmp(a.livingHeroes, b.livingHeroes, a.livingCount) == 0 &&
+           memcmp(a.rngState, b.rngState, sizeof(a.rngState)) == 0;
+}
+
+// One recorded battle, as loaded from a replay file
+struct BattleReplay {
+    int room = 0;
+    bool heroesWon = false;
+    ReplayState start;
+    uint32_t turnCount = 0;
+    string turns;
+    // keyframes[k] is the state right before turn (k + 1) * REPLAY_KEYFRAME_INTERVAL
+    vector<pair<size_t, ReplayState>> keyframes;
+    size_t recordBytes = 0;
+
+    bool parse(const char* p, const char* end) {
+        recordBytes = end - p;
+        uint64_t value;
+        if (!getVarint(p, end, value)) return false;
+        room = static_cast<int>(value);
+        if (end - p < 2) return false;
+        start.heroCount = *p++;
+        start.enemyCount = *p++;
+        if (start.heroCount > REPLAY_MAX_SIDE || start.enemyCount > REPLAY_MAX_SIDE) return false;
+        if (!decodeReplayState(p, end, start, true)) return false;
+        if (!getVarint(p, end, value)) return false;
+        turnCount = static_cast<uint32_t>(value);
+        if (!getVarint(p, end, value) || value > static_cast<uint64_t>(end - p)) return false;
+        turns.assign(p, value);
+        p += value;
+        uint64_t keyframeCount;
+        if (!getVarint(p, end, keyframeCount)) return false;
+        keyframes.clear();
+        for (uint64_t k = 0; k < keyframeCount; ++k) {
+            ReplayState state = start;
+            if (!getVarint(p, end, value) || value > turns.size()) return false;
+            if (!decodeReplayState(p, end, state, false)) return false;
+            keyframes.emplace_back(value, state);
+        }
+        if (p >= end) return false;
+        heroesWon = *p++ != 0;
+        return true;
+    }
+
+    // State right before turn (0 <= turn <= turnCount): nearest keyframe, then
+    // re-simulation of the few turns in between. next points at that turn.
+    bool stateBefore(uint32_t turn, ReplayState& state, const char*& next) const {
+        size_t k = min<size_t>(turn / REPLAY_KEYFRAME_INTERVAL, keyframes.size());
+        state = k ? keyframes[k - 1].second : start;
+        next = turns.data() + (k ? keyframes[k - 1].first : 0);
+        const char* end = turns.data() + turns.size();
+        ReplayTurn recorded;
+        for (uint32_t i = static_cast<uint32_t>(k * REPLAY_KEYFRAME_INTERVAL); i < turn; ++i) {
+            if (!decodeReplayTurn(next, end, recorded)) return false;
+            resimulateTurn(state, recorded);
+        }
+        return true;
+    }
+
+    // Re-simulates the whole battle from its seed and checks every turn and
+    // keyframe; returns the first turn that differs, or -1
+    long long verify() const {
+        ReplayState state = start;
+        const char* p = turns.data();
+        const char* end = turns.data() + turns.size();
+        ReplayTurn recorded;
+        for (uint32_t i = 0; i < turnCount; ++i) {
+            if (i > 0 && i % REPLAY_KEYFRAME_INTERVAL == 0) {
+                size_t k = i / REPLAY_KEYFRAME_INTERVAL - 1;
+                if (k < keyframes.size() && !sameState(state, keyframes[k].second)) return i;
+            }
+            if (!decodeReplayTurn(p, end, recorded)) return i;
+            if (!sameTurn(resimulateTurn(state, recorded), recorded)) return i;
+        }
+        return -1;
+    }
+};
+
+bool loadReplays(const string& path, vector<BattleReplay>& replays) {
+    string data;
+    if (!readWholeFile(path, data)) return false;
+    if (data.size() < sizeof(REPLAY_MAGIC) || memcmp(data.data(), REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) != 0) return false;
+    const char* p = data.data() + sizeof(REPLAY_MAGIC);
+    const char* end = data.data() + data.size();
+    uint64_t length;
+    while (p < end) {
+        if (!getVarint(p, end, length) || length > static_cast<uint64_t>(end - p)) break; // torn tail
+        BattleReplay replay;
+        if (!replay.parse(p, p + length)) return false;
+        replays.push_back(move(replay));
+        p += length;
+    }
+    return true;
+}
+
+// Records every Battle it observes and appends it to a replay file
+class ReplayRecorder : public BattleObserver {
+private:
+    ofstream file;
+    int room = 0;
+    const pmr::vector<Hero*>* heroes = nullptr;
+    const pmr::vector<Enemy*>* enemies = nullptr;
+    const Rng* rng = nullptr;
+    bool recording = false;
+    ReplayState startState;
+    ReplayState living; // only its living-hero set is tracked, turn by turn
+    string turns;
+    string keyframes;
+    uint32_t turnCount = 0;
+    uint32_t keyframeCount = 0;
+    string record;
+
+    static void captureUnit(ReplayCombatant& unit, const Character* c, const CharacterTemplate* roster, int rosterSize) {
+        unit.rosterIndex = -1;
+        for (int i = 0; i < rosterSize; ++i) {
+            if (c->getName() == roster[i].name) {
+                unit.rosterIndex = i;
+                break;
+            }
+        }
+        unit.hp = c->getHp();
+        unit.stats[STAT_HP] = c->getMaxHp();
+        unit.stats[STAT_ATK] = c->getAtk();
+        unit.stats[STAT_DEF] = c->getDef();
+        unit.stats[STAT_SPD] = c->getSpd();
+        unit.stats[STAT_LCK] = c->getLck();
+    }
+
+    void captureState(ReplayState& state) const {
+        state.heroCount = static_cast<int>(heroes->size());
+        state.enemyCount = static_cast<int>(enemies->size());
+        for (int i = 0; i < state.heroCount; ++i) {
+            captureUnit(state.heroes[i], (*heroes)[i], HERO_ROSTER, HERO_ROSTER_SIZE);
+        }
+        for (int i = 0; i < state.enemyCount; ++i) {
+            captureUnit(state.enemies[i], (*enemies)[i], ENEMY_ROSTER, ENEMY_ROSTER_SIZE);
+        }
+        state.livingCount = living.livingCount;
+        memcpy(state.livingHeroes, living.livingHeroes, sizeof(state.livingHeroes));
+        rng->getState(state.rngState);
+    }
+
+    void addTurn(const ReplayTurn& turn) {
+        if (!recording) return;
+        encodeReplayTurn(turns, turn);
+        if (++turnCount % REPLAY_KEYFRAME_INTERVAL == 0) {
+            ReplayState state;
+            captureState(state);
+            putVarint(keyframes, turns.size());
+            encodeReplayState(keyframes, state, false);
+            ++keyframeCount;
+        }
+    }
+
+public:
+    explicit ReplayRecorder(const string& path) : file(path, ios::binary | ios::trunc) {
+        file.write(REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+    }
+
+    bool isOpen() const { return file.is_open(); }
+
+    // Room of the battles that follow, kept in each record for bug reports
+    void setRoom(int roomNumber) { room = roomNumber; }
+
+    void battleStarted(const pmr::vector<Hero*>& battleHeroes, const pmr::vector<Enemy*>& battleEnemies,
+                       const Rng& battleRng) override {
+        recording = battleHeroes.size() <= REPLAY_MAX_SIDE && battleEnemies.size() <= REPLAY_MAX_SIDE;
+        heroes = &battleHeroes;
+        enemies = &battleEnemies;
+        rng = &battleRng;
+        turns.clear();
+        keyframes.clear();
+        turnCount = 0;
+        keyframeCount = 0;
+        if (recording) {
+            captureState(startState);
+            startState.resetLivingHeroes();
+            living = startState;
+        }
+    }
+
+    void attackResolved(bool enemyAttacks, int actor, int target, int hitRoll, int critRoll, int damage) override {
+        ReplayTurn turn = ReplayTurn();
+        turn.enemyActs = enemyAttacks;
+        turn.actor = static_cast<uint8_t>(actor);
+        turn.action = REPLAY_ATTACK;
+        turn.target = static_cast<uint8_t>(target);
+        turn.hitRoll = static_cast<uint8_t>(hitRoll);
+        turn.critRoll = static_cast<uint8_t>(critRoll);
+        turn.damage = damage;
+        if (recording && enemyAttacks && !(*heroes)[target]->isAlive()) living.heroFell(target);
+        addTurn(turn);
+    }
+
+    void potionUsed(int hero, int slot, const ItemModifiers& effect) override {
+        ReplayTurn turn = ReplayTurn();
+        turn.actor = static_cast<uint8_t>(hero);
+        turn.action = REPLAY_POTION;
+        turn.potionSlot = slot;
+        turn.effect = effect;
+        addTurn(turn);
+    }
+
+    void potionExpired(int hero, int slot, const ItemModifiers& effect) override {
+        ReplayTurn turn = ReplayTurn();
+        turn.actor = static_cast<uint8_t>(hero);
+        turn.action = REPLAY_EXPIRY;
+        turn.potionSlot = slot;
+        turn.effect = effect;
+        addTurn(turn);
+    }
+
+    void battleEnded(bool heroesWon) override {
+        if (!recording || !file.is_open()) return;
+        record.clear();
+        putVarint(record, room);
+        record.push_back(static_cast<char>(startState.heroCount));
+        record.push_back(static_cast<char>(startState.enemyCount));
+        encodeReplayState(record, startState, true);
+        putVarint(record, turnCount);
+        putVarint(record, turns.size());
+        record += turns;
+        putVarint(record, keyframeCount);
+        record += keyframes;
+        record.push_back(heroesWon ? 1 : 0);
+
+        string length;
+        putVarint(length, record.size());
+        file << length << record;
+        file.flush(); // a crash report still gets every finished battle
+        recording = false;
+    }
+};
+
+// ===== GAME CLASS (MAIN GAME LOGIC) =====
+class Game {
+private:
+    vector<Hero*> availableHeroes;
+    RunArena runArena; // owns playerTeam, the dungeon and everything in it
+    vector<Hero*> playerTeam;
+    vector<Room*> dungeon;
+    Inventory* inventory;
+    string playerName;
+    int currentRoomNumber;
+    ScoreManager* scoreManager;
+    bool ownsScoreManager;
+    RngService rngService; // Every random stream of the run derives from its master seed
+    Rng gen;
+    Rng battleRng;
+    Rng rewardRng;
+    ReplayRecorder* replayRecorder = nullptr;
+    HeroPolicy* heroPolicy = nullptr;
+    TurnOrder turnOrder = TURN_ORDER_INITIATIVE;
+    int potionActions = 0; // 0 = potions last the whole run
+    int hordeSize = 0; // enemies in the horde room, 0 = no horde
+    bool endless = false;
+    EndlessDungeon endlessDungeon; // rooms of endless runs, two at a time
+    uint64_t endlessRuns = 0;      // endless runs started by this game
+
+public:
+    // Games in one process can share a catalog; without one, the game rolls
+    // its own from its seed. An empty leaderboard path keeps scores in memory.
+    explicit Game(uint64_t seed, shared_ptr<const ItemCatalog> catalog = nullptr,
+                  const string& leaderboardPath = "leaderboard.txt")
+        : Game(seed, move(catalog), new ScoreManager(leaderboardPath), true) {}
+
+    // Server sessions: every game of the process saves to one leaderboard
+    Game(uint64_t seed, shared_ptr<const ItemCatalog> catalog, ScoreManager& scores)
+        : Game(seed, move(catalog), &scores, false) {}
+
+    ~Game() {
+        for (auto hero : availableHeroes) delete hero;
+        // playerTeam and dungeon go away with runArena
+        delete inventory;
+        if (ownsScoreManager) delete scoreManager;
+    }
+
+    void startGame() {
+        showMainMenu();
+    }
+
+    // One run, from the player's name to the leaderboard, without the main
+    // menu (server sessions)
+    void playRun() {
+        setupNewGame();
+        playGame();
+    }
+
+    // Records every battle of the following runs (nullptr stops recording)
+    void setReplayRecorder(ReplayRecorder* recorder) { replayRecorder = recorder; }
+
+    // Lets policy play the heroes' turns (nullptr gives them back to the player)
+    void setHeroPolicy(HeroPolicy* policy) { heroPolicy = policy; }
+
+    void setTurnOrder(TurnOrder order) { turnOrder = order; }
+
+    // Potions wear off after actions of the drinker's turns (0 = never)
+    void setPotionDuration(int actions) { potionActions = actions; }
+
+    // Following runs meet a horde of size enemies in room HORDE_ROOM (0 = none)
+    void setHordeSize(int size) { hordeSize = max(0, size); }
+
+    // Following runs go on room after room until the team falls
+    void setEndless(bool enabled) { endless = enabled; }
+
+    void showMainMenu() {
+        int choice;
+        do {
+            gameText() << "\n=== SISAS: Natal Combat ===" << '\n';
+            gameText() << "(Semilla: " << rngService.getMasterSeed() << ")" << '\n';
+            gameText() << "1. Empezar Nueva Partida" << '\n';
+            gameText() << "2. Ver Tabla de Clasificacion" << '\n';
+            gameText() << "3. Salir" << '\n';
+            gameText() << "Opción: ";
+            choice = getValidatedInput(1, 3);
+
+            switch (choice) {
+                case 1:
+                    playRun();
+                    break;
+                case 2:
+                    scoreManager->displayLeaderboard();
+                    break;
+                case 3:
+                    gameText() << "¡Gracias por jugar SISAS! ¡Nos vemos!" << '\n';
+                    break;
+            }
+        } while (choice != 3);
+    }
+
+private:
+    Game(uint64_t seed, shared_ptr<const ItemCatalog> catalog, ScoreManager* scores, bool ownsScores)
+        : inventory(nullptr), currentRoomNumber(0), scoreManager(scores), ownsScoreManager(ownsScores),
+          rngService(seed), gen(rngService.stream(STREAM_DUNGEON)), battleRng(rngService.stream(STREAM_BATTLE)),
+          rewardRng(rngService.stream(STREAM_REWARDS)), endlessDungeon(seed) {
+        initializeAvailableCharacters();
+        Rng inventoryRng = rngService.stream(STREAM_INVENTORY);
+        if (!catalog) catalog = make_shared<const ItemCatalog>(inventoryRng);
+        inventory = new Inventory(move(catalog), inventoryRng);
+    }
+
+    void initializeAvailableCharacters() {
+        for (const CharacterTemplate& t : HERO_ROSTER) {
+            availableHeroes.push_back(new Hero(t.name, t.hp, t.atk, t.def, t.spd, t.lck));
+        }
+    }
+    
+    void setupNewGame() {
+        TRACE_SPAN("Game::setupNewGame");
+        gameText() << "\n¡Bienvenido a SISAS!" << '\n';
+        gameText() << "¿Cuál es tu nombre, valiente aventurero? ";
+        playerName = getInputLine();
+        emitEvent(EVENT_RUN_STARTED, playerName, {}, static_cast<int>(rngService.getMasterSeed() & 0x7FFFFFFF));
+
+        // Drop everything the previous run allocated in one go
+        playerTeam.clear();
+        dungeon.clear();
+        runArena.reset();
+        inventory->startRun();
+
+        selectHeroes();
+        initialMarket();
+        initializeDungeon();
+        currentRoomNumber = 0; // Reset room counter for new game
+    }
+
+    void selectHeroes() {
+        gameText() << "\n--- Selección de Héroes ---" << '\n';
+        gameText() << "Elige a 3 héroes para tu equipo." << '\n';
+
+        vector<Hero*> tempAvailableHeroes = availableHeroes; // Copy to remove selected ones
         
-        // Create weapons (10 common, 10 rare)
-        for (int i = 0; i < 20; ++i) {
-            string rarity = (i < 10) ? "Common" : "Rare";
-            // Common: +4-5 ATK + boost menor = 6-7 points total
-            // Rare: +5-7 ATK + boost fuerte = 8-10 points total
-            int atkBoost = (rarity == "Common") ? (4 + (gen() % 2)) : (5 + (gen() % 3));
-            int secondaryBoost = (rarity == "Common") ? (2 + (gen() % 2)) : (3 + (gen() % 3));
-            
-            uniform_int_distribution<> statDis(0, secondaryStats.size() - 1);
-            string secondaryStat = secondaryStats[statDis(gen)];
+        for (int i = 0; i < 3; ++i) {
+            while (true) {
+                gameText() << "\nHéroe #" << (i + 1) << ":" << '\n';
+                for (size_t j = 0; j < tempAvailableHeroes.size(); ++j) {
+                    gameText() << (j + 1) << ". ";
+                    tempAvailableHeroes[j]->displayStats();
+                }
+                gameText() << "Elige un número: ";
+                int choice = getValidatedInput(1, tempAvailableHeroes.size());
+
+                // Create a deep copy of the hero to add to playerTeam
+                Hero* chosenHero = runArena.create<Hero>(
+                    tempAvailableHeroes[choice - 1]->getName(),
+                    tempAvailableHeroes[choice - 1]->getMaxHp(), // Use maxHp for initial HP
+                    tempAvailableHeroes[choice - 1]->getAtk(),
+                    tempAvailableHeroes[choice - 1]->getDef(),
+                    tempAvailableHeroes[choice - 1]->getSpd(),
+                    tempAvailableHeroes[choice - 1]->getLck(),
+                    &runArena
+                );
+                playerTeam.push_back(chosenHero);
+                
+                tempAvailableHeroes.erase(tempAvailableHeroes.begin() + choice - 1); // Remove selected hero
+                gameText() << chosenHero->getName() << " se ha unido a tu equipo." << '\n';
+                break;
+            }
+        }
+        gameText() << "\n¡Tu equipo está listo!" << '\n';
+        for (auto hero : playerTeam) {
+            hero->displayStats();
+        }
+    }
+
+    void initialMarket() {
+        gameText() << "\n--- Mercado Inicial ---" << '\n';
+        gameText() << "¡Bienvenido al mercado! Puedes equipar a tus héroes con algunas armas y armaduras básicas." << '\n';
+
+        for (Hero* hero : playerTeam) {
+            gameText() << "\nEquipando a " << hero->getName() << ":" << '\n';
             
-            weapons.push_back(new Weapon(weaponNames[i], rarity, atkBoost, secondaryBoost, secondaryStat));
+            // Offer a common weapon
+            const Weapon* weaponOffer = inventory->getRandomWeapon(RARITY_COMMON);
+            if (weaponOffer) {
+                gameText() << "¿Quieres equipar " << weaponOffer->getName() << " (ATK +" << weaponOffer->getStatBoost1() << ") en " << hero->getName() << "? (1. Sí / 2. No): ";
+                int choice = getValidatedInput(1, 2);
+                if (choice == 1) {
+                    hero->equipWeapon(weaponOffer);
+                    gameText() << hero->getName() << " equipa " << weaponOffer->getName() << "." << '\n';
+                    emitEvent(EVENT_ITEM_EQUIPPED, hero->getName(), weaponOffer->getName());
+                }
+            } else {
+                gameText() << "No hay armas comunes disponibles." << '\n';
+            }
+
+            // Offer a common armor
+            const Armor* armorOffer = inventory->getRandomArmor(RARITY_COMMON);
+            if (armorOffer) {
+                gameText() << "¿Quieres equipar " << armorOffer->getName() << " (DEF +" << armorOffer->getStatBoost1() << ") en " << hero->getName() << "? (1. Sí / 2. No): ";
+                int choice = getValidatedInput(1, 2);
+                if (choice == 1) {
+                    hero->equipArmor(armorOffer);
+                    gameText() << hero->getName() << " equipa " << armorOffer->getName() << "." << '\n';
+                    emitEvent(EVENT_ITEM_EQUIPPED, hero->getName(), armorOffer->getName());
+                }
+            } else {
+                gameText() << "No hay armaduras comunes disponibles." << '\n';
+            }
+
+        }
+        gameText() << "\nMercado inicial completado." << '\n';
+    }
+
+    void initializeDungeon() {
+        TRACE_SPAN("Game::initializeDungeon");
+        if (endless) { // rooms are built as the team reaches them
+            endlessDungeon.startRun(endlessRuns++);
+            return;
+        }
+        for (int i = 1; i <= 10; ++i) {
+            if (i == HORDE_ROOM && hordeSize > 0) {
+                buildRoomLayout(i, gen); // the other rooms still get their usual enemies
+                dungeon.push_back(buildHordeRoom(i, hordeSize, runArena));
+            } else {
+                dungeon.push_back(buildDungeonRoom(i, gen, runArena));
+            }
+        }
+    }
+
+    void playGame() {
+        gameText() << "\n--- ¡Comienza la Aventura en la Mazmorra! ---" << '\n';
+        for (currentRoomNumber = 0; endless || currentRoomNumber < dungeon.size(); ++currentRoomNumber) {
+            Room* currentRoom = endless ? endlessDungeon.enter(currentRoomNumber + 1) : dungeon[currentRoomNumber];
+            currentRoom->displayRoomInfo();
+            emitEvent(EVENT_ROOM_ENTERED, {}, {}, currentRoom->getRoomNumber());
+
+            // Battle in the room if there are enemies
+            if (!currentRoom->getEnemies().empty()) {
+                if (replayRecorder) replayRecorder->setRoom(currentRoom->getRoomNumber());
+                Battle battle(playerTeam, currentRoom->getEnemies(), battleRng, replayRecorder, heroPolicy);
+                battle.setTurnOrder(turnOrder);
+                battle.setPotionDuration(potionActions);
+                battle.setRoomNumber(currentRoom->getRoomNumber());
+                bool heroesWon = battle.startBattle();
+
+                if (!heroesWon) {
+                    gameText() << "\nTu equipo ha sido derrotado. Fin de la partida." << '\n';
+                    endGame();
+                    return;
+                } else {
+                    currentRoom->clearRoom();
+                    emitEvent(EVENT_ROOM_CLEARED, {}, {}, currentRoom->getRoomNumber());
+                    gameText() << "¡Has limpiado la Sala " << (currentRoomNumber + 1) << "!" << '\n';
+                    handlePostBattleRewards();
+                }
+            } else {
+                gameText() << "La sala " << (currentRoomNumber + 1) << " está vacía." << '\n';
+            }
+
+            handleSpecialEvents(currentRoom);
+
+            // Check if game ends (e.g. after Room 10)
+            if (!endless && currentRoomNumber == 9) { // Last room (index 9 is Room 10)
+                gameText() << "\n¡Has completado todas las salas de la mazmorra!" << '\n';
+                endGame();
+                return;
+            }
+
+            gameText() << "\n¿Listo para la siguiente sala? (Presiona Enter)";
+            waitForEnter();
+        }
+    }
+
+    void handlePostBattleRewards() {
+        gameText() << "\n--- Recompensas ---" << '\n';
+        // Heal heroes by a percentage of max HP
+        for (Hero* hero : playerTeam) {
+            hero->boostStats(2.0f); // 2% ATK/DEF boost
+        }
+
+        gameText() << "Todos los héroes han recibido un pequeño aumento de estadísticas." << '\n';
+    }
+
+
+    // Events go by the room's place in the ten-room cycle (endless runs repeat it)
+    void handleSpecialEvents(const Room* room) {
+        int roomNum = endlessCyclePosition(room->getRoomNumber());
+        if (roomNum == 3) {
+            gameText() << "\n--- EVENTO ESPECIAL: Sala " << room->getRoomNumber() << " ---" << '\n';
+            gameText() << "¡Parece que hay un cofre especial por aquí!" << '\n';
+            const Item* chestItem = room->getItemReward(inventory, rewardRng); // Guaranteed rare weapon
+            if (!chestItem) chestItem = inventory->getRandomArmor(RARITY_RARE);
+            if (!chestItem) chestItem = inventory->getRandomPotion();
+
+            if (chestItem) {
+                gameText() << "Has encontrado en el cofre: ";
+                chestItem->displayInfo();
+                gameText() << "¿A quién quieres darle este tesoro? (0 para no dar a nadie)" << '\n';
+                for (size_t i = 0; i < playerTeam.size(); ++i) {
+                    gameText() << (i + 1) << ". " << playerTeam[i]->getName() << '\n';
+                }
+                int heroChoice = getValidatedInput(0, playerTeam.size());
+                if (heroChoice > 0) {
+                    Hero* chosenHero = playerTeam[heroChoice - 1];
+                     if (const Weapon* w = dynamic_cast<const Weapon*>(chestItem)) {
+                        chosenHero->equipWeapon(w);
+                        gameText() << chosenHero->getName() << " equipa " << chestItem->getName() << "." << '\n';
+                        emitEvent(EVENT_ITEM_EQUIPPED, chosenHero->getName(), chestItem->getName());
+                    } else if (const Armor* a = dynamic_cast<const Armor*>(chestItem)) {
+                        chosenHero->equipArmor(a);
+                        gameText() << chosenHero->getName() << " equipa " << chestItem->getName() << "." << '\n';
+                        emitEvent(EVENT_ITEM_EQUIPPED, chosenHero->getName(), chestItem->getName());
+                    } else if (const Potion* p = dynamic_cast<const Potion*>(chestItem)) {
+                        chosenHero->addPotion(inventory->grantPotion(p, chosenHero));
+                        gameText() << chosenHero->getName() << " obtiene " << chestItem->getName() << "." << '\n';
+                        emitEvent(EVENT_ITEM_EQUIPPED, chosenHero->getName(), chestItem->getName());
+                    }
+                } else {
+                    gameText() << "Decides dejar el tesoro. Una pena." << '\n';
+                }
+            } else {
+                gameText() << "El cofre estaba vacío." << '\n';
+            }
+        } else if (roomNum == 6) {
+            gameText() << "\n--- EVENTO ESPECIAL: Sala " << room->getRoomNumber() << " ---" << '\n';
+            gameText() << "¡Un tesoro ancestral te espera!" << '\n';
+            const Item* treasureItem = room->getItemReward(inventory, rewardRng); // Guaranteed rare weapon
+            if (!treasureItem) treasureItem = inventory->getRandomArmor(RARITY_RARE);
+            if (!treasureItem) treasureItem = inventory->getRandomPotion();
+
+            if (treasureItem) {
+                gameText() << "Has descubierto un Tesoro: ";
+                treasureItem->displayInfo();
+                 gameText() << "¿A quién quieres darle este tesoro? (0 para no dar a nadie)" << '\n';
+                for (size_t i = 0; i < playerTeam.size(); ++i) {
+                    gameText() << (i + 1) << ". " << playerTeam[i]->getName() << '\n';
+                }
+                int heroChoice = getValidatedInput(0, playerTeam.size());
+                if (heroChoice > 0) {
+                    Hero* chosenHero = playerTeam[heroChoice - 1];
+                     if (const Weapon* w = dynamic_cast<const Weapon*>(treasureItem)) {
+                        chosenHero->equipWeapon(w);
+                        gameText() << chosenHero->getName() << " equipa " << treasureItem->getName() << "." << '\n';
+                        emitEvent(EVENT_ITEM_EQUIPPED, chosenHero->getName(), treasureItem->getName());
+                    } else if (const Armor* a = dynamic_cast<const Armor*>(treasureItem)) {
+                        chosenHero->equipArmor(a);
+                        gameText() << chosenHero->getName() << " equipa " << treasureItem->getName() << "." << '\n';
+                        emitEvent(EVENT_ITEM_EQUIPPED, chosenHero->getName(), treasureItem->getName());
+                    } else if (const Potion* p = dynamic_cast<const Potion*>(treasureItem)) {
+                        chosenHero->addPotion(inventory->grantPotion(p, chosenHero));
+                        gameText() << chosenHero->getName() << " obtiene " << treasureItem->getName() << "." << '\n';
+                        emitEvent(EVENT_ITEM_EQUIPPED, chosenHero->getName(), treasureItem->getName());
+                    }
+                } else {
+                    gameText() << "Decides dejar el tesoro. Una pena." << '\n';
+                }
+            } else {
+                gameText() << "El tesoro estaba vacío." << '\n';
+            }
+        } else if (roomNum == 8) {
+            gameText() << "\n--- EVENTO ESPECIAL: Sala " << room->getRoomNumber() << " ---" << '\n';
+            gameText() << "Un misterioso ermitaño te ofrece una bendición." << '\n';
+            gameText() << "Tus héroes recuperan su HP." << '\n';
+            for (Hero* hero : playerTeam) {
+                int healAmount = static_cast<int>(hero->getMaxHp()); // Full heal
+                hero->heal(healAmount);
+                gameText() << hero->getName() << " recupera " << healAmount << " HP. (HP: " << hero->getHp() << "/" << hero->getMaxHp() << ")" << '\n';
+            }
         }
-        
-        // Create armors (10 common, 10 rare)
-        for (int i = 0; i < 20; ++i) {
-            string rarity = (i < 10) ? "Common" : "Rare";
-            // Common: +4-5 DEF + boost menor = 6-7 points total
-            // Rare: +5-7 DEF + boost fuerte = 8-10 points total
-            int defBoost = (rarity == "Common") ? (4 + (gen() % 2)) : (5 + (gen() % 3));
-            int secondaryBoost = (rarity == "Common") ? (2 + (gen() % 2)) : (3 + (gen() % 3));
-            
-            uniform_int_distribution<> statDis(0, secondaryStats.size() - 1);
-            string secondaryStat = secondaryStats[statDis(gen)];
-            
-            armors.push_back(new Armor(armorNames[i], rarity, defBoost, secondaryBoost, secondaryStat));
+    }
+
+    void endGame() {
+        int totalHealthLost = 0;
+        for (Hero* hero : playerTeam) {
+            totalHealthLost += hero->getTotalHealthLost();
         }
+
+        size_t rank = scoreManager->saveScore(playerName, currentRoomNumber + 1, totalHealthLost); // +1 because currentRoomNumber is 0-indexed
+        gameText() << "Tu partida quedó en el puesto #" << rank << " de " << scoreManager->getScoreCount() << "." << '\n';
+        emitEvent(EVENT_RUN_ENDED, playerName, {}, currentRoomNumber + 1);
+        scoreManager->displayLeaderboard();
         
-        // Create potions
-        vector<string> potionStats = {"HP", "ATK", "DEF", "SPD", "LCK"};
-        for (int i = 0; i < 10; ++i) {
-            uniform_int_distribution<> statDis(0, potionStats.size() - 1);
-            uniform_int_distribution<> boostDis(3, 5); // 6-9 points total
-            
-            string stat1 = potionStats[statDis(gen)];
-            string stat2;
-            do {
-                stat2 = potionStats[statDis(gen)];
-            } while (stat2 == stat1); // Ensure two different stats
-            
-            int boost1 = boostDis(gen);
-            int boost2 = boostDis(gen);
-            
-            potions.push_back(new Potion(potionNames[i], boost1, boost2, stat1, stat2));
+        // Reset hero stats and potions for next game if starting again
+        for (Hero* hero : playerTeam) {
+            hero->resetPotionEffects(); // This should also reset stats if needed
+            hero->heal(hero->getMaxHp()); // Full heal
+        }
+    }
+};
+
+// Rule options every run of a process is played with, from the command
+// line: --alternate-turns, --potion-turns [N], --horde [N], --endless. The
+// console game and every server session take the same ones.
+struct GameOptions {
+    TurnOrder turnOrder = TURN_ORDER_INITIATIVE;
+    int potionActions = 0;
+    int hordeSize = 0;
+    bool endless = false;
+
+    // Takes the option at argv[i] and its optional number; false if argv[i]
+    // is not one of them
+    bool parse(int& i, int argc, char* argv[]) {
+        string arg = argv[i];
+        bool numberFollows = i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]));
+        if (arg == "--alternate-turns") {
+            turnOrder = TURN_ORDER_ALTERNATE;
+        } else if (arg == "--potion-turns") {
+            potionActions = numberFollows ? atoi(argv[++i]) : POTION_EFFECT_ACTIONS;
+        } else if (arg == "--endless") {
+            endless = true;
+        } else if (arg == "--horde") {
+            hordeSize = numberFollows ? atoi(argv[++i]) : HORDE_DEFAULT_SIZE;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void applyTo(Game& game) const {
+        game.setTurnOrder(turnOrder);
+        game.setPotionDuration(potionActions);
+        game.setHordeSize(hordeSize);
+        game.setEndless(endless);
+    }
+};
+
+// ===== BATCH CAMPAIGN RUNNER =====
+// Plays whole runs without a player, the way Game does from hero selection
+// to endGame: three heroes, a common weapon and armor offered to each in
+// the market, ten rooms from the dungeon stream, the 2% boost after every
+// won battle and the chest (room 3), treasure (room 6) and healer (room 8)
+// events. A CampaignScript stands in for the player's menu choices and a
+// GreedyHeroPolicy plays the heroes' turns. Every campaign has its own
+// RngService, so campaign i plays out the same on any thread.
+const int CAMPAIGN_TEAM_SIZE = 3;
+const int CAMPAIGN_HEALTH_BUCKET = 50;  // HP per totalHealthLost histogram bucket
+const int CAMPAIGN_HEALTH_BUCKETS = 21; // the last one is open-ended
+const uint64_t CAMPAIGN_CHUNK = 16;     // campaigns a worker takes from its range at a time
+
+struct CampaignScript {
+    int team[CAMPAIGN_TEAM_SIZE] = {-1, -1, -1}; // roster indices; -1 picks a random unused hero
+    bool takeMarketOffers = true;
+    bool takeTreasures = true; // chest and treasure items go to the first living hero
+    TurnOrder turnOrder = TURN_ORDER_INITIATIVE;
+    int potionActions = 0; // timed potions, see Battle::setPotionDuration
+};
+
+struct CampaignOutcome {
+    int roomReached;     // what endGame saves: 1-10
+    bool completed;      // cleared room 10
+    int totalHealthLost;
+    int team[CAMPAIGN_TEAM_SIZE];
+    bool survived[CAMPAIGN_TEAM_SIZE];
+};
+
+// Drinks the first unused potion below a third of max HP, otherwise hits the
+// living enemy with the least HP
+class GreedyHeroPolicy : public HeroPolicy {
+public:
+    HeroDecision decide(const pmr::vector<Hero*>& heroes, const pmr::vector<Enemy*>& enemies,
+                        int actingHero, size_t, size_t) override {
+        const Hero* hero = heroes[actingHero];
+        if (hero->getHp() * 3 < hero->getMaxHp()) {
+            const vector<PotionInstance*>& potions = hero->getPotions();
+            for (size_t i = 0; i < potions.size(); ++i) {
+                if (!potions[i]->used) return {true, static_cast<int>(i)};
+            }
+        }
+        int target = -1;
+        for (size_t i = 0; i < enemies.size(); ++i) {
+            if (enemies[i]->isAlive() && (target < 0 || enemies[i]->getHp() < enemies[target]->getHp())) {
+                target = static_cast<int>(i);
+            }
+        }
+        return {false, max(0, target)};
+    }
+};
+
+// One worker's reusable run state: arena, inventory and team keep their
+// memory from campaign to campaign
+class CampaignPlayer {
+private:
+    CampaignScript script;
+    RunArena arena;
+    Inventory inventory;
+    vector<Hero*> team;
+    Room* dungeon[10];
+    GreedyHeroPolicy policy;
+
+    void giveTreasure(const Item* item) {
+        if (!item || !script.takeTreasures) return;
+        Hero* hero = team[0];
+        for (Hero* h : team) {
+            if (h->isAlive()) {
+                hero = h;
+                break;
+            }
+        }
+        if (const Weapon* w = dynamic_cast<const Weapon*>(item)) {
+            hero->equipWeapon(w);
+        } else if (const Armor* a = dynamic_cast<const Armor*>(item)) {
+            hero->equipArmor(a);
+        } else if (const Potion* p = dynamic_cast<const Potion*>(item)) {
+            hero->addPotion(inventory.grantPotion(p, hero));
+        }
+    }
+
+public:
+    CampaignPlayer(shared_ptr<const ItemCatalog> catalog, const CampaignScript& script)
+        : script(script), inventory(move(catalog), Rng()) {}
+
+    CampaignOutcome play(uint64_t seed) {
+        RngService rngService(seed);
+        Rng gen = rngService.stream(STREAM_DUNGEON);
+        Rng battleRng = rngService.stream(STREAM_BATTLE);
+        Rng rewardRng = rngService.stream(STREAM_REWARDS);
+        Rng choiceRng = rngService.stream(STREAM_SIMULATION);
+        team.clear();
+        arena.reset();
+        inventory.startRun(rngService.stream(STREAM_INVENTORY));
+
+        // selectHeroes
+        CampaignOutcome outcome = {};
+        bool taken[HERO_ROSTER_SIZE] = {};
+        for (int i = 0; i < CAMPAIGN_TEAM_SIZE; ++i) {
+            int pick = script.team[i];
+            if (pick < 0 || pick >= HERO_ROSTER_SIZE || taken[pick]) {
+                int left = 0;
+                for (bool t : taken) left += !t;
+                int nth = choiceRng.below(left);
+                for (pick = 0; taken[pick] || nth-- > 0; ++pick) {}
+            }
+            taken[pick] = true;
+            outcome.team[i] = pick;
+            const CharacterTemplate& t = HERO_ROSTER[pick];
+            team.push_back(arena.create<Hero>(t.name, t.hp, t.atk, t.def, t.spd, t.lck, &arena));
+        }
+
+        // initialMarket: the offers are drawn whether or not they are taken
+        for (Hero* hero : team) {
+            const Weapon* weapon = inventory.getRandomWeapon(RARITY_COMMON);
+            if (weapon && script.takeMarketOffers) hero->equipWeapon(weapon);
+            const Armor* armor = inventory.getRandomArmor(RARITY_COMMON);
+            if (armor && script.takeMarketOffers) hero->equipArmor(armor);
+        }
+
+        // initializeDungeon + playGame
+        for (int i = 0; i < 10; ++i) dungeon[i] = buildDungeonRoom(i + 1, gen, arena);
+        for (int room = 1; room <= 10; ++room) {
+            Room* current = dungeon[room - 1];
+            outcome.roomReached = room;
+            if (!current->getEnemies().empty()) {
+                Battle battle(team, current->getEnemies(), battleRng, nullptr, &policy);
+                battle.setTurnOrder(script.turnOrder);
+                battle.setPotionDuration(script.potionActions);
+                battle.setRoomNumber(room);
+                if (!battle.startBattle()) break;
+                current->clearRoom();
+                emitEvent(EVENT_ROOM_CLEARED, {}, {}, room);
+                for (Hero* hero : team) hero->boostStats(2.0f);
+            }
+            if (room == 3 || room == 6) {
+                const Item* item = current->getItemReward(&inventory, rewardRng);
+                if (!item) item = inventory.getRandomArmor(RARITY_RARE);
+                if (!item) item = inventory.getRandomPotion();
+                giveTreasure(item);
+            } else if (room == 8) {
+                for (Hero* hero : team) hero->heal(hero->getMaxHp());
+            }
+            outcome.completed = (room == 10);
+        }
+
+        // endGame
+        for (int i = 0; i < CAMPAIGN_TEAM_SIZE; ++i) {
+            outcome.totalHealthLost += team[i]->getTotalHealthLost();
+            outcome.survived[i] = team[i]->isAlive();
+        }
+        return outcome;
+    }
+};
+
+// Totals of one worker, merged once all campaigns are done. Aligned to a
+// cache line so workers never write to a line another one is using.
+struct alignas(64) CampaignStats {
+    uint64_t campaigns = 0;
+    uint64_t completed = 0;
+    uint64_t roomReached[11] = {};
+    uint64_t healthLost[CAMPAIGN_HEALTH_BUCKETS] = {};
+    uint64_t healthLostSum = 0;
+    int healthLostMin = numeric_limits<int>::max();
+    int healthLostMax = 0;
+    uint64_t picked[HERO_ROSTER_SIZE] = {};
+    uint64_t survived[HERO_ROSTER_SIZE] = {};
+    uint64_t steals = 0;
+
+    void add(const CampaignOutcome& outcome) {
+        ++campaigns;
+        completed += outcome.completed;
+        ++roomReached[outcome.roomReached];
+        ++healthLost[min(outcome.totalHealthLost / CAMPAIGN_HEALTH_BUCKET, CAMPAIGN_HEALTH_BUCKETS - 1)];
+        healthLostSum += outcome.totalHealthLost;
+        healthLostMin = min(healthLostMin, outcome.totalHealthLost);
+        healthLostMax = max(healthLostMax, outcome.totalHealthLost);
+        for (int i = 0; i < CAMPAIGN_TEAM_SIZE; ++i) {
+            ++picked[outcome.team[i]];
+            survived[outcome.team[i]] += outcome.survived[i];
+        }
+    }
+
+    void merge(const CampaignStats& other) {
+        campaigns += other.campaigns;
+        completed += other.completed;
+        for (int i = 0; i <= 10; ++i) roomReached[i] += other.roomReached[i];
+        for (int i = 0; i < CAMPAIGN_HEALTH_BUCKETS; ++i) healthLost[i] += other.healthLost[i];
+        healthLostSum += other.healthLostSum;
+        healthLostMin = min(healthLostMin, other.healthLostMin);
+        healthLostMax = max(healthLostMax, other.healthLostMax);
+        for (int h = 0; h < HERO_ROSTER_SIZE; ++h) {
+            picked[h] += other.picked[h];
+            survived[h] += other.survived[h];
+        }
+        steals += other.steals;
+    }
+
+    // Lower bound of the bucket holding the given fraction of campaigns
+    int healthLostPercentile(double fraction) const {
+        uint64_t rank = static_cast<uint64_t>(fraction * campaigns);
+        uint64_t seen = 0;
+        for (int i = 0; i < CAMPAIGN_HEALTH_BUCKETS; ++i) {
+            seen += healthLost[i];
+            if (seen > rank) return i * CAMPAIGN_HEALTH_BUCKET;
+        }
+        return (CAMPAIGN_HEALTH_BUCKETS - 1) * CAMPAIGN_HEALTH_BUCKET;
+    }
+};
+
+// Hands out campaign indices. Each worker starts with an even, contiguous
+// share and takes CAMPAIGN_CHUNK at a time from its front; a worker that
+// runs dry steals the back half of the largest share left. Campaigns vary
+// from one battle to ten, so this keeps every core busy until the end
+// where a static split would leave the early finishers idle.
+class CampaignScheduler {
+private:
+    struct alignas(64) Share {
+        mutex lock;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+    };
+    unique_ptr<Share[]> shares;
+    int workers;
+
+    uint64_t remaining(int worker) {
+        lock_guard<mutex> guard(shares[worker].lock);
+        return shares[worker].end - shares[worker].begin;
+    }
+
+public:
+    CampaignScheduler(int workers, uint64_t total) : shares(new Share[workers]), workers(workers) {
+        for (int w = 0; w < workers; ++w) {
+            shares[w].begin = total * w / workers;
+            shares[w].end = total * (w + 1) / workers;
+        }
+    }
+
+    // Next [begin, end) for worker; false once every share is empty
+    bool next(int worker, uint64_t& begin, uint64_t& end, uint64_t& steals) {
+        Share& own = shares[worker];
+        while (true) {
+            {
+                lock_guard<mutex> guard(own.lock);
+                if (own.begin < own.end) {
+                    begin = own.begin;
+                    end = min(own.end, begin + CAMPAIGN_CHUNK);
+                    own.begin = end;
+                    return true;
+                }
+            }
+            int victim = -1;
+            uint64_t most = 0;
+            for (int w = 0; w < workers; ++w) {
+                if (w == worker) continue;
+                uint64_t left = remaining(w);
+                if (left > most) {
+                    most = left;
+                    victim = w;
+                }
+            }
+            if (victim < 0) return false;
+            uint64_t stolenBegin, stolenEnd;
+            {
+                lock_guard<mutex> guard(shares[victim].lock);
+                Share& share = shares[victim];
+                if (share.begin >= share.end) continue; // drained meanwhile, look again
+                uint64_t middle = share.begin + (share.end - share.begin) / 2;
+                stolenBegin = middle;
+                stolenEnd = share.end;
+                share.end = middle;
+            }
+            ++steals;
+            lock_guard<mutex> guard(own.lock);
+            own.begin = stolenBegin;
+            own.end = stolenEnd;
+        }
+    }
+};
+
+// Plays campaigns 0..count-1 (seeds derived from masterSeed) on pool and
+// returns the merged totals; perWorker receives each worker's own totals
+CampaignStats runCampaigns(uint64_t count, uint64_t masterSeed, const CampaignScript& script,
+                           shared_ptr<const ItemCatalog> catalog, SearchPool& pool, vector<CampaignStats>& perWorker) {
+    RngService seeds(masterSeed);
+    CampaignScheduler scheduler(pool.size(), count);
+    perWorker.assign(pool.size(), CampaignStats());
+    pool.run([&](int worker) {
+        CampaignPlayer player(catalog, script);
+        CampaignStats& stats = perWorker[worker];
+        uint64_t begin, end;
+        while (scheduler.next(worker, begin, end, stats.steals)) {
+            for (uint64_t i = begin; i < end; ++i) {
+                stats.add(player.play(seeds.streamSeed(STREAM_SIMULATION, i)));
+            }
+        }
+    });
+    CampaignStats total;
+    for (const CampaignStats& stats : perWorker) total.merge(stats);
+    return total;
+}
+
+// ===== GAME SERVER =====
+// --serve hosts many players in one process over a Unix-domain socket or
+// loopback TCP. Each connection is a session that plays one run of the real
+// Game (Game::playRun: name, heroes, market, rooms, events, the leaderboard)
+// with the process's rule options. The session is the run's InputProvider:
+// the game asks for answers through getValidatedInput and friends as usual,
+// and when the player's line has not arrived yet the run switches back to the
+// worker. Game's code is plain calls all the way down, so each run gets a
+// small stack of its own (a ucontext fiber) to be suspended on; an idle
+// session costs the stack pages its run has touched, its Game and its
+// buffers.
+//
+// Every worker thread runs its own epoll loop and owns the sessions it
+// accepts: a session never changes threads and nothing is locked on the
+// path from a player's line to the answer, except the shared leaderboard
+// when a run ends. While a session's run executes, the thread's sessionSink
+// and sessionInput point at it, so gameText() and events go to that
+// session's socket and the answers come from it.
+//
+// Protocol: plain text lines. Whenever the game waits for the player, the
+// server ends its output with a ">> " line: ">> 1-3" asks for a number in
+// that range, ">> texto" for any line (a name, or Enter to go on). The
+// connection closes when the run ends; a player who leaves mid-run ends it
+// there, unsaved, like the end of a script.
+#if SISAS_SERVER
+const int SERVER_MAX_EVENTS = 256;
+const int SERVER_ACCEPT_BATCH = 64;       // connections one wake-up accepts at most
+const size_t SERVER_READ_CHUNK = 4096;
+const size_t SERVER_MAX_LINE = 1024;      // longer input without a newline is dropped
+const size_t SERVER_IDLE_BUFFER = 4096;   // output capacity an idle session may keep
+const size_t SERVER_STACK_SIZE = 256 * 1024; // reserved per run; pages are committed as it touches them
+
+atomic<bool> serverStopping(false);
+
+void stopServer(int) { serverStopping.store(true); }
+
+// A run on its own stack: start() enters it, the run yield()s back to
+// whoever resumed it, and resume() continues it from there
+class SessionFiber {
+private:
+    ucontext_t fiber;
+    ucontext_t worker;
+    char* stack = nullptr;
+    function<void()> body;
+    bool running = false;
+    static inline thread_local SessionFiber* starting = nullptr;
+
+    static void entry() {
+        SessionFiber* self = starting;
+        self->body();
+        self->running = false; // returning switches to uc_link, the worker
+    }
+
+public:
+    SessionFiber() = default;
+    SessionFiber(const SessionFiber&) = delete;
+    SessionFiber& operator=(const SessionFiber&) = delete;
+
+    ~SessionFiber() {
+        if (stack) munmap(stack, SERVER_STACK_SIZE);
+    }
+
+    // Runs body up to its first yield; false if no stack could be mapped
+    bool start(function<void()> run) {
+        void* memory = mmap(nullptr, SERVER_STACK_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (memory == MAP_FAILED) return false;
+        stack = static_cast<char*>(memory);
+        mprotect(stack, static_cast<size_t>(sysconf(_SC_PAGESIZE)), PROT_NONE); // overflow faults instead of corrupting
+        body = move(run);
+        getcontext(&fiber);
+        fiber.uc_stack.ss_sp = stack;
+        fiber.uc_stack.ss_size = SERVER_STACK_SIZE;
+        fiber.uc_link = &worker;
+        makecontext(&fiber, entry, 0);
+        running = true;
+        starting = this;
+        swapcontext(&worker, &fiber);
+        return true;
+    }
+
+    void resume() {
+        if (running) swapcontext(&worker, &fiber);
+    }
+
+    // From inside the run: back to the worker until the next resume()
+    void yield() { swapcontext(&fiber, &worker); }
+
+    bool finished() const { return stack && !running; }
+};
+
+// Appends a session's game text to its pending output
+class SessionSink : public MessageSink, private streambuf {
+private:
+    string& out;
+    ostream stream;
+
+    int overflow(int c) override {
+        if (c != EOF) out.push_back(static_cast<char>(c));
+        return c;
+    }
+
+    streamsize xsputn(const char* s, streamsize n) override {
+        out.append(s, static_cast<size_t>(n));
+        return n;
+    }
+
+public:
+    explicit SessionSink(string& out) : out(out), stream(this) {}
+
+    ostream* text() override { return &stream; }
+};
+
+// One connection: its buffers, the run's fiber, and the answers the run asks
+// for. Numbers are read like ScriptInput reads them; getValidatedInput
+// complains about the ones out of range and asks again.
+class ServerSession : public InputProvider {
+private:
+    string input;                 // received bytes not consumed yet
+    bool closing = false;         // the connection is gone: the run is being ended
+    SessionFiber fiber;
+
+    void prompt(int min, int max) {
+        output += ">> ";
+        if (max < min) {
+            output += "texto";
+        } else {
+            output += to_string(min);
+            output += '-';
+            output += to_string(max);
+        }
+        output += '\n';
+    }
+
+    // Next complete line, waiting in the worker until one arrives; false
+    // once the connection is closing
+    bool takeLine(string& line) {
+        size_t end;
+        while ((end = input.find('\n')) == string::npos) {
+            if (closing) return false;
+            fiber.yield();
+        }
+        if (closing) return false;
+        line.assign(input, 0, end);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        input.erase(0, end + 1);
+        return true;
+    }
+
+    // Switches into the run with this session's output and input in place
+    template <typename Enter>
+    void inSession(Enter enter) {
+        MessageSink* previousSink = sessionSink;
+        InputProvider* previousInput = sessionInput;
+        sessionSink = &sink;
+        sessionInput = this;
+        enter();
+        sessionSink = previousSink;
+        sessionInput = previousInput;
+    }
+
+    void run() {
+        inSession([this] { fiber.resume(); });
+    }
+
+public:
+    int fd;
+    size_t slot = 0;              // index in the owning worker's session list
+    string output;                // to be sent
+    size_t outputSent = 0;
+    bool wantsWrite = false;      // EPOLLOUT registered
+    SessionSink sink;
+
+    explicit ServerSession(int fd) : fd(fd), sink(output) {}
+
+    ServerSession(const ServerSession&) = delete;
+    ServerSession& operator=(const ServerSession&) = delete;
+
+    // A run still waiting for input ends there (InputExhausted) and lets go
+    // of its Game before the fiber's stack goes away
+    ~ServerSession() override {
+        closing = true;
+        run();
+    }
+
+    bool nextChoice(int min, int max, int& choice) override {
+        prompt(min, max);
+        string line;
+        if (!takeLine(line)) return false;
+        char* parsed = nullptr;
+        long value = strtol(line.c_str(), &parsed, 10);
+        choice = (parsed != line.c_str() && *parsed == '\0') ? static_cast<int>(value) : min - 1;
+        return true;
+    }
+
+    bool nextLine(string& line) override {
+        prompt(0, -1);
+        return takeLine(line);
+    }
+
+    // Plays the new run up to its first question
+    bool start(function<void()> body) {
+        bool started = false;
+        inSession([&] { started = fiber.start(move(body)); });
+        return started;
+    }
+
+    // Bytes from the socket; resumes the run once they complete a line
+    void receive(const char* data, size_t size) {
+        input.append(data, size);
+        if (input.find('\n') != string::npos) {
+            run();
+        } else if (input.size() > SERVER_MAX_LINE) {
+            input.clear();
+        }
+    }
+
+    bool finished() const { return fiber.finished(); }
+};
+
+// The run of one session: the real Game, sharing the process's catalog and
+// leaderboard. A player who leaves mid-run ends it like the end of a script.
+void playServerSession(shared_ptr<const ItemCatalog> catalog, ScoreManager& scores, const GameOptions& options,
+                       uint64_t seed) {
+    Game game(seed, move(catalog), scores);
+    options.applyTo(game);
+    try {
+        game.playRun();
+    } catch (const InputExhausted&) {
+        // The connection closed (or the server is stopping)
+    }
+}
+
+// Counters one worker publishes for the status line
+struct alignas(64) ServerWorkerStats {
+    atomic<uint64_t> sessions{0};  // open right now
+    atomic<uint64_t> started{0};
+    atomic<uint64_t> inputs{0};    // reads that carried player input
+    atomic<uint64_t> busyNanos{0}; // spent handling them, output included
+};
+
+// One thread's epoll loop and the sessions it accepted
+class ServerWorker {
+private:
+    int epollFd = -1;
+    int listenFd;
+    shared_ptr<const ItemCatalog> catalog;
+    ScoreManager& scores;
+    const GameOptions& options;
+    const RngService& seeds;
+    atomic<uint64_t>& nextSession;
+    vector<unique_ptr<ServerSession>> sessions;
+    ServerWorkerStats& stats;
+
+    void watch(ServerSession* session, bool write) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP | (write ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        ev.data.ptr = session;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, session->fd, &ev);
+        session->wantsWrite = write;
+    }
+
+    void close(ServerSession* session) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, session->fd, nullptr);
+        ::close(session->fd);
+        size_t slot = session->slot;
+        sessions[slot] = move(sessions.back());
+        sessions[slot]->slot = slot;
+        sessions.pop_back();
+        stats.sessions.fetch_sub(1, memory_order_relaxed);
+    }
+
+    // Sends what the socket takes; false if the session is gone
+    bool flush(ServerSession* session) {
+        while (session->outputSent < session->output.size()) {
+            ssize_t n = send(session->fd, session->output.data() + session->outputSent,
+                             session->output.size() - session->outputSent, MSG_NOSIGNAL);
+            if (n > 0) {
+                session->outputSent += static_cast<size_t>(n);
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (!session->wantsWrite) watch(session, true);
+                return true;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                close(session);
+                return false;
+            }
+        }
+        session->outputSent = 0;
+        session->output.clear();
+        if (session->output.capacity() > SERVER_IDLE_BUFFER) string().swap(session->output);
+        if (session->wantsWrite) watch(session, false);
+        if (session->finished()) {
+            close(session);
+            return false;
+        }
+        return true;
+    }
+
+    void accept() {
+        for (int i = 0; i < SERVER_ACCEPT_BATCH; ++i) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on Unix sockets
+
+            sessions.push_back(make_unique<ServerSession>(fd));
+            ServerSession* session = sessions.back().get();
+            session->slot = sessions.size() - 1;
+            epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.ptr = session;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+            stats.sessions.fetch_add(1, memory_order_relaxed);
+            stats.started.fetch_add(1, memory_order_relaxed);
+
+            uint64_t seed = seeds.streamSeed(STREAM_SESSIONS, nextSession.fetch_add(1, memory_order_relaxed));
+            if (!session->start([this, seed] { playServerSession(catalog, scores, options, seed); })) {
+                close(session);
+                continue;
+            }
+            flush(session);
+        }
+    }
+
+    void read(ServerSession* session) {
+        auto started = chrono::steady_clock::now();
+        char buffer[SERVER_READ_CHUNK];
+        while (true) {
+            ssize_t n = recv(session->fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                session->receive(buffer, static_cast<size_t>(n));
+                if (static_cast<size_t>(n) < sizeof(buffer)) break;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else { // peer closed or failed
+                close(session);
+                return;
+            }
+        }
+        if (!flush(session)) return;
+        stats.inputs.fetch_add(1, memory_order_relaxed);
+        stats.busyNanos.fetch_add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count(),
+                                  memory_order_relaxed);
+    }
+
+public:
+    ServerWorker(int listenFd, shared_ptr<const ItemCatalog> catalog, ScoreManager& scores, const GameOptions& options,
+                 const RngService& seeds, atomic<uint64_t>& nextSession, ServerWorkerStats& stats)
+        : listenFd(listenFd), catalog(move(catalog)), scores(scores), options(options), seeds(seeds),
+          nextSession(nextSession), stats(stats) {}
+
+    ~ServerWorker() {
+        while (!sessions.empty()) close(sessions.back().get());
+        if (epollFd >= 0) ::close(epollFd);
+    }
+
+    // Until serverStopping; false if epoll could not be set up
+    bool run() {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) return false;
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE; // one worker wakes per new connection
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev) < 0) return false;
+
+        epoll_event events[SERVER_MAX_EVENTS];
+        while (!serverStopping.load(memory_order_relaxed)) {
+            int n = epoll_wait(epollFd, events, SERVER_MAX_EVENTS, 200);
+            for (int i = 0; i < n; ++i) {
+                ServerSession* session = static_cast<ServerSession*>(events[i].data.ptr);
+                if (!session) {
+                    accept();
+                } else if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    read(session); // a hang-up shows up as a read of 0 bytes
+                } else if (events[i].events & EPOLLOUT) {
+                    flush(session);
+                }
+            }
+        }
+        return true;
+    }
+};
+
+// "PATH" is a Unix-domain socket, "PORT" or "HOST:PORT" TCP (HOST defaults
+// to 127.0.0.1). Returns a listening or connected socket, or -1.
+bool isTcpAddress(const string& address) {
+    string port = address.substr(address.rfind(':') + 1); // whole address without a colon
+    return !port.empty() && all_of(port.begin(), port.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); });
+}
+
+int openGameSocket(const string& address, bool listen) {
+    size_t colon = address.rfind(':');
+    string port = address.substr(colon + 1);
+    int fd;
+    if (isTcpAddress(address)) {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(atoi(port.c_str())));
+        string host = (colon == string::npos || colon == 0) ? "127.0.0.1" : address.substr(0, colon);
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return -1;
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        int ok = listen ? bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+                        : connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        if (ok < 0) {
+            ::close(fd);
+            return -1;
         }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(addr.sun_path)) return -1;
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (listen) unlink(address.c_str()); // left over from an earlier server
+        int ok = listen ? bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+                        : connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        if (ok < 0) {
+            ::close(fd);
+            return -1;
+        }
+    }
+    if (listen && ::listen(fd, SOMAXCONN) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Thousands of sessions need more descriptors than the usual soft limit
+void raiseOpenFileLimit() {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Resident memory of this process, from /proc
+double residentMegabytes() {
+    ifstream statm("/proc/self/statm");
+    long long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+}
+#endif
+
+// ===== SIMULATION DRIVER =====
+// Default team (first three heroes of the roster) against the enemies of a room
+BattleSetup makeRoomSetup(int roomNumber, const RngService& rngService) {
+    Rng layoutGen = rngService.stream(STREAM_DUNGEON);
+    BattleSetup setup;
+    for (int i = 0; i < 3; ++i) {
+        setup.addHero(makeSimCombatant(HERO_ROSTER[i]));
+    }
+    for (const CharacterTemplate* t : buildRoomLayout(roomNumber, layoutGen)) {
+        setup.addEnemy(makeSimCombatant(*t));
+    }
+    return setup;
+}
+
+void printBatchTotals(const string& label, const BatchTotals& totals, double seconds) {
+    cout << label << ": victorias " << (100.0 * totals.heroWins / totals.battles) << "%"
+         << ", turnos " << (static_cast<double>(totals.turns) / totals.battles)
+         << ", vida perdida " << (static_cast<double>(totals.heroHpLost) / totals.battles)
+         << ", " << setprecision(0) << (totals.battles / seconds) << " batallas/s" << setprecision(2) << endl;
+}
+
+// Usage: --simulate [battles] [room] [seed]
+// Runs N battles against a room and reports win rate and throughput.
+int runSimulationCli(int argc, char* argv[]) {
+    long long battles = (argc > 2) ? atoll(argv[2]) : 1000000;
+    int roomNumber = (argc > 3) ? atoi(argv[3]) : 10;
+    uint64_t seed = (argc > 4) ? strtoull(argv[4], nullptr, 10) : 12345;
+    if (battles <= 0 || roomNumber < 1 || roomNumber > 10) {
+        cout << "Uso: --simulate [batallas] [sala 1-10] [semilla]" << endl;
+        return 1;
+    }
+
+    RngService rngService(seed);
+    BattleSetup setup = makeRoomSetup(roomNumber, rngService);
+    BattleSimulator simulator;
+    long long wins = 0;
+    long long totalTurns = 0;
+    long long totalHpLost = 0;
+    auto start = chrono::steady_clock::now();
+    for (long long i = 0; i < battles; ++i) {
+        BattleResult result = simulator.run(setup, rngService.streamSeed(STREAM_SIMULATION, i));
+        wins += result.heroesWon;
+        totalTurns += result.turns;
+        totalHpLost += result.heroHpLost;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << fixed << setprecision(2);
+    cout << "Sala " << roomNumber << ": " << battles << " batallas simuladas" << endl;
+    cout << "Victorias de los héroes: " << (100.0 * wins / battles) << "%" << endl;
+    cout << "Turnos promedio: " << (static_cast<double>(totalTurns) / battles) << endl;
+    cout << "Vida perdida promedio: " << (static_cast<double>(totalHpLost) / battles) << endl;
+    cout << "Tiempo: " << seconds << " s (" << setprecision(0) << (battles / seconds) << " batallas/s)" << endl;
+    return 0;
+}
+
+// Usage: --solve [epsilon] [seed] [states]
+// Win probability, expected HP lost and expected turns of the default team
+// against the boss room, computed from the battle's Markov chain instead of
+// sampled. States with less than epsilon probability are dropped (default
+// 1e-12; 0 keeps every reachable state), which makes the answer approximate
+// with the dropped probability as its error bound. Fails once more than
+// `states` HP vectors (default 2000000) would be needed. Regular rooms never
+// fit; --simulate covers them.
+int runSolverCli(int argc, char* argv[]) {
+    const int roomNumber = 10;
+    double epsilon = (argc > 2) ? atof(argv[2]) : 1e-12;
+    uint64_t seed = (argc > 3) ? strtoull(argv[3], nullptr, 10) : 12345;
+    long long maxStates = (argc > 4) ? atoll(argv[4]) : 2000000;
+    if (epsilon < 0 || maxStates <= 0) {
+        cout << "Uso: --solve [epsilon] [semilla] [estados]" << endl;
+        return 1;
     }
-    
-    Weapon* getRandomWeapon(const string& rarity) {
-        vector<Weapon*> availableWeapons;
-        for (auto weapon : weapons) {
-            if (weapon->getRarity() == rarity) {
-                availableWeapons.push_back(weapon);
-            }
-        }
-        
-        if (availableWeapons.empty()) return nullptr;
-        
-        uniform_int_distribution<> dis(0, availableWeapons.size() - 1);
-        return availableWeapons[dis(gen)];
+
+    RngService rngService(seed);
+    BattleSetup setup = makeRoomSetup(roomNumber, rngService);
+    BattleSolver solver;
+    auto start = chrono::steady_clock::now();
+    SolverResult result = solver.solve(setup, epsilon, static_cast<size_t>(maxStates));
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (result.keyOverflow) {
+        cout << "Sala " << roomNumber << ": sin solución, los puntos de vida no caben en la clave de estado" << endl;
+        return 1;
     }
-    
-    Armor* getRandomArmor(const string& rarity) {
-        vector<Armor*> availableArmors;
-        for (auto armor : armors) {
-            if (armor->getRarity() == rarity) {
-                availableArmors.push_back(armor);
-            }
-        }
-        
-        if (availableArmors.empty()) return nullptr;
-        
-        uniform_int_distribution<> dis(0, availableArmors.size() - 1);
-        return availableArmors[dis(gen)];
+    if (result.stateLimitHit) {
+        cout << "Sala " << roomNumber << ": sin solución, se alcanzó el límite de " << maxStates << " estados" << endl;
+        cout << scientific << setprecision(2) << "Probabilidad sin resolver: " << result.prunedMass << endl;
+        cout << fixed << setprecision(2) << "Tiempo: " << (seconds * 1000) << " ms" << endl;
+        cout << "Usa --simulate para esta sala." << endl;
+        return 1;
     }
-    
-    Potion* getRandomPotion() {
-        vector<Potion*> availablePotions;
-        for (auto potion : potions) {
-            if (!potion->isUsed()) { // Only return unused potions
-                availablePotions.push_back(potion);
-            }
+    cout << fixed << setprecision(6);
+    cout << "Sala " << roomNumber << ": " << (result.prunedMass == 0 ? "solución exacta" : "solución aproximada") << endl;
+    cout << "Victorias de los héroes: " << (100.0 * result.heroWin) << "%" << endl;
+    cout << "Turnos esperados: " << result.turns << endl;
+    cout << "Vida perdida esperada: " << result.heroHpLost << endl;
+    cout << scientific << setprecision(2) << "Probabilidad descartada (cota de error): " << result.prunedMass << endl;
+    cout << fixed << "Estados: " << result.states << ", tiempo: " << (seconds * 1000) << " ms" << endl;
+    return 0;
+}
+
+// Plays one headless battle from start, asking choose(state) for every hero
+// turn; returns the final state
+template <typename Choose>
+SearchState playSearchBattle(SearchState s, const SearchRules& rules, Rng& rng, Choose choose) {
+    int maxHeroSpd = -1;
+    int maxEnemySpd = -1;
+    for (int i = 0; i < s.heroCount; ++i) {
+        if (s.heroes[i].hp > 0) maxHeroSpd = max(maxHeroSpd, s.heroes[i].spd);
+    }
+    for (int i = 0; i < s.enemyCount; ++i) {
+        if (s.enemies[i].hp > 0) maxEnemySpd = max(maxEnemySpd, s.enemies[i].spd);
+    }
+    s.heroesTurn = maxHeroSpd >= maxEnemySpd;
+    while (!SearchRules::over(s)) {
+        if (s.heroesTurn) {
+            rules.heroTurn(s, choose(s), rng);
+        } else {
+            SearchRules::enemyTurn(s, rng);
         }
+    }
+    return s;
+}
 
-        if (availablePotions.empty()) return nullptr;
-        
-        uniform_int_distribution<> dis(0, availablePotions.size() - 1);
-        return availablePotions[dis(gen)];
+struct PolicyTotals {
+    int battles = 0;
+    int wins = 0;
+    long long heroHpLost = 0;
+    double enemyHpRemoved = 0; // share of the room's HP, summed over battles
+};
+
+void printPolicyTotals(const string& label, const PolicyTotals& totals) {
+    cout << label << ": victorias " << (100.0 * totals.wins / totals.battles) << "%"
+         << ", vida perdida " << (static_cast<double>(totals.heroHpLost) / totals.battles)
+         << ", vida enemiga quitada " << (100.0 * totals.enemyHpRemoved / totals.battles) << "%" << endl;
+}
+
+// Usage: --bench-mcts [battles] [room] [threads] [ms] [seed]
+// The default team, each hero carrying two potions, plays the same battles
+// (same seeds) choosing uniformly among its legal actions and with MCTS;
+// prints both results and the time taken per MCTS decision.
+int runMctsBenchmarkCli(int argc, char* argv[]) {
+    int battles = (argc > 2) ? atoi(argv[2]) : 100;
+    int roomNumber = (argc > 3) ? atoi(argv[3]) : 6;
+    int threads = (argc > 4) ? atoi(argv[4]) : 8;
+    int ms = (argc > 5) ? atoi(argv[5]) : 10;
+    uint64_t seed = (argc > 6) ? strtoull(argv[6], nullptr, 10) : 12345;
+    if (battles <= 0 || roomNumber < 1 || roomNumber > 10 || threads <= 0 || ms <= 0) {
+        cout << "Uso: --bench-mcts [batallas] [sala 1-10] [hilos] [ms] [semilla]" << endl;
+        return 1;
     }
 
-    vector<Weapon*> getAllWeapons() const { return weapons; }
-    vector<Armor*> getAllArmors() const { return armors; }
-    vector<Potion*> getAllPotions() const { return potions; }
+    RngService rngService(seed);
+    BattleSetup setup = makeRoomSetup(roomNumber, rngService);
+    Rng inventoryRng = rngService.stream(STREAM_INVENTORY);
+    ItemCatalog catalog(inventoryRng);
+    const vector<const Potion*>& potions = catalog.getPotions();
+    SearchState start;
+    SearchRules rules;
+    for (int i = 0; i < setup.heroCount; ++i) {
+        start.heroes[start.heroCount++] = setup.heroes[i];
+        for (int slot = 0; slot < 2; ++slot) {
+            const Potion* potion = potions[(2 * i + slot) % potions.size()];
+            rules.setPotion(i, slot, potion->getModifiers());
+            start.potionsLeft[i] |= 1u << slot;
+        }
+    }
+    for (int i = 0; i < setup.enemyCount; ++i) start.enemies[start.enemyCount++] = setup.enemies[i];
+    int startEnemyHp = 0;
+    for (int i = 0; i < start.enemyCount; ++i) startEnemyHp += start.enemies[i].hp;
 
-    // This method is for "giving" an item to a hero, not for removing from global pool.
-    // The current design implies the Inventory *owns* all items, and heroes get pointers.
-    // If an item is truly "taken" from the market, it would need to be removed from Inventory's vectors.
-    // For now, heroes just get pointers to existing items.
-};
+    auto record = [&](PolicyTotals& totals, const SearchState& end) {
+        ++totals.battles;
+        totals.wins += !SearchRules::anyAlive(end.enemies, end.enemyCount);
+        int enemyHp = 0;
+        for (int i = 0; i < end.heroCount; ++i) totals.heroHpLost += start.heroes[i].hp - end.heroes[i].hp;
+        for (int i = 0; i < end.enemyCount; ++i) enemyHp += end.enemies[i].hp;
+        totals.enemyHpRemoved += static_cast<double>(startEnemyHp - enemyHp) / startEnemyHp;
+    };
 
-//Battle class
+    PolicyTotals random;
+    for (int b = 0; b < battles; ++b) {
+        Rng rng(rngService.streamSeed(STREAM_SIMULATION, b));
+        Rng chooser(rngService.streamSeed(STREAM_SIMULATION, battles + b));
+        record(random, playSearchBattle(start, rules, rng, [&](const SearchState& s) {
+            int actions[SEARCH_MAX_ACTIONS];
+            int n = SearchRules::legalActions(s, SearchRules::actingHero(s), actions);
+            return actions[chooser.below(n)];
+        }));
+    }
 
-class Battle {
-private:
-    vector<Hero*> heroes;
-    vector<Enemy*> enemies;
-    mt19937 rng; 
+    PolicyTotals mcts;
+    MctsHeroPolicy policy(threads, chrono::milliseconds(ms), seed);
+    int decisions = 0;
+    double totalSeconds = 0;
+    vector<double> decisionSeconds;
+    uint64_t iterations = 0;
+    for (int b = 0; b < battles; ++b) {
+        Rng rng(rngService.streamSeed(STREAM_SIMULATION, b));
+        record(mcts, playSearchBattle(start, rules, rng, [&](const SearchState& s) {
+            auto begin = chrono::steady_clock::now();
+            int action = policy.search(s, rules);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+            ++decisions;
+            totalSeconds += seconds;
+            decisionSeconds.push_back(seconds);
+            iterations += policy.lastIterations();
+            return action;
+        }));
+    }
 
-    size_t heroIndex = 0;
-    size_t enemyIndex = 0;
-    bool heroesTurn = true; // Indica qué equipo ataca ahora
+    cout << fixed << setprecision(2);
+    cout << "Sala " << roomNumber << ", " << battles << " batallas, " << threads << " hilos, " << ms << " ms por decisión" << endl;
+    printPolicyTotals("Aleatorio", random);
+    printPolicyTotals("MCTS", mcts);
+    sort(decisionSeconds.begin(), decisionSeconds.end());
+    double p99 = decisionSeconds.empty() ? 0 : decisionSeconds[decisionSeconds.size() * 99 / 100];
+    double slowest = decisionSeconds.empty() ? 0 : decisionSeconds.back();
+    size_t overBudget = decisionSeconds.end() - upper_bound(decisionSeconds.begin(), decisionSeconds.end(), ms / 1000.0);
+    cout << "Decisiones: " << decisions << ", media " << (1000 * totalSeconds / max(1, decisions)) << " ms, p99 "
+         << (1000 * p99) << " ms, máxima " << (1000 * slowest) << " ms, " << overBudget << " sobre el presupuesto, "
+         << setprecision(0) << (static_cast<double>(iterations) / max(1, decisions)) << " simulaciones por decisión" << endl;
+    return 0;
+}
 
-public:
-    Battle(vector<Hero*> heroes, vector<Enemy*> enemies)
-        : heroes(heroes), enemies(enemies) {
-        random_device rd;
-        rng.seed(rd());
+void printBalanceCandidate(const BalanceCandidate& c) {
+    for (int h = 0; h < HERO_ROSTER_SIZE; ++h) {
+        const int* s = c.stats[h];
+        cout << "    {\"" << HERO_ROSTER[h].name << "\", " << s[STAT_HP] << ", " << s[STAT_ATK] << ", " << s[STAT_DEF]
+             << ", " << s[STAT_SPD] << ", " << s[STAT_LCK] << "}  // total "
+             << (s[STAT_HP] + s[STAT_ATK] + s[STAT_DEF] + s[STAT_SPD] + s[STAT_LCK]) << endl;
+    }
+    cout << "    Escala de enemigos (HP, ATK y DEF):";
+    for (int tier = 0; tier < BALANCE_TIERS; ++tier) cout << " " << BALANCE_TIER_NAMES[tier] << " x" << c.tierScale[tier];
+    cout << endl << "    Victorias por sala (objetivo):";
+    for (int room = 0; room < 10; ++room) {
+        cout << " " << (room + 1) << ":" << setprecision(0) << (100 * c.winRate[room]) << "% ("
+             << (100 * BALANCE_TARGETS[room]) << ")";
     }
+    cout << setprecision(2) << endl;
+}
 
-    bool startBattle() {
-        cout << "\n--- ¡Una batalla ha comenzado! ---" << endl;
+// Usage: --balance [generations] [population] [threads] [battles] [seed]
+// Searches hero stat lines (total 100-115 each) and enemy tier scales for the
+// target win rate of every room; battles is per team and room. Prints the
+// progress and a ranked report of the best candidates.
+int runBalanceCli(int argc, char* argv[]) {
+    int generations = (argc > 2) ? atoi(argv[2]) : 30;
+    int populationSize = (argc > 3) ? atoi(argv[3]) : 32;
+    int threads = (argc > 4) ? atoi(argv[4]) : max(1u, thread::hardware_concurrency());
+    int battles = (argc > 5) ? atoi(argv[5]) : 100;
+    uint64_t seed = (argc > 6) ? strtoull(argv[6], nullptr, 10) : 12345;
+    if (generations < 0 || populationSize < 4 || threads <= 0 || battles <= 0) {
+        cout << "Uso: --balance [generaciones] [población >= 4] [hilos] [batallas] [semilla]" << endl;
+        return 1;
+    }
 
-        // Decide quién inicia (más SPD entre héroes y enemigos vivos)
-        heroesTurn = decideFirstTurn();
+    SearchPool pool(threads);
+    StatBalancer balancer(BALANCE_MIN_TOTAL, BALANCE_MAX_TOTAL, battles, seed, pool);
+    cout << fixed << setprecision(2);
+    BalanceCandidate shipped = balancer.current();
+    balancer.evaluate(shipped);
+    cout << "Plantel actual ajustado al presupuesto: error " << (100 * sqrt(shipped.fitness)) << " puntos" << endl;
 
-        heroIndex = 0;
-        enemyIndex = 0;
+    auto start = chrono::steady_clock::now();
+    vector<BalanceCandidate> ranked = balancer.run(generations, populationSize, [](int generation, const BalanceCandidate& best) {
+        cout << "Generación " << generation << ": error " << (100 * sqrt(best.fitness)) << " puntos" << endl;
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-        while (!checkBattleEnd()) {
-            cout << "\n--- TURNO ---" << endl;
+    long long simulated = static_cast<long long>(populationSize + generations * (populationSize - 2)) * 10 * BALANCE_TEAM_COUNT * battles;
+    cout << "\n=== Mejores candidatos (error = desviación media de la victoria objetivo) ===" << endl;
+    for (int i = 0; i < min<int>(3, ranked.size()); ++i) {
+        cout << "#" << (i + 1) << ": error " << (100 * sqrt(ranked[i].fitness)) << " puntos" << endl;
+        printBalanceCandidate(ranked[i]);
+    }
+    cout << simulated << " batallas en " << seconds << " s con " << threads << " hilos" << endl;
+    return 0;
+}
 
-            if (heroesTurn) {
-                if (!performHeroTurn()) break;
-            } else {
-                if (!performEnemyTurn()) break;
+// Usage: --campaigns [count] [threads] [seed] [team]
+// Plays count full ten-room campaigns across threads (work stealing) and
+// prints how far they got, the totalHealthLost distribution and how often
+// each hero survived. team is three roster indices like 0,1,2; without it
+// every campaign picks a random team.
+int runCampaignsCli(int argc, char* argv[]) {
+    long long count = (argc > 2) ? atoll(argv[2]) : 100000;
+    int threads = (argc > 3) ? atoi(argv[3]) : max(1u, thread::hardware_concurrency());
+    uint64_t seed = (argc > 4) ? strtoull(argv[4], nullptr, 10) : 12345;
+    CampaignScript script;
+    bool validTeam = true;
+    if (argc > 5) {
+        stringstream ss(argv[5]);
+        string index;
+        for (int i = 0; i < CAMPAIGN_TEAM_SIZE; ++i) {
+            if (!getline(ss, index, ',') || index.empty()) {
+                validTeam = false;
+                break;
             }
-
-            heroesTurn = !heroesTurn;
+            script.team[i] = atoi(index.c_str());
+            validTeam = validTeam && script.team[i] >= 0 && script.team[i] < HERO_ROSTER_SIZE;
         }
+    }
+    if (count <= 0 || threads <= 0 || !validTeam) {
+        cout << "Uso: --campaigns [partidas] [hilos] [semilla] [equipo, p. ej. 0,1,2]" << endl;
+        return 1;
+    }
 
-        displayBattleStatus();
+    NullSink nullSink;
+    setMessageSink(&nullSink);
+    Rng catalogRng = RngService(seed).stream(STREAM_INVENTORY);
+    auto catalog = make_shared<const ItemCatalog>(catalogRng);
+    SearchPool pool(threads);
+    vector<CampaignStats> perWorker;
+    auto start = chrono::steady_clock::now();
+    CampaignStats total = runCampaigns(count, seed, script, catalog, pool, perWorker);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    setMessageSink(nullptr);
 
-        if (getWinner() == "Heroes") {
-            cout << "\n¡Los héroes han ganado la batalla!" << endl;
-            return true;
-        } else {
-            cout << "\n¡Los enemigos han ganado la batalla! Has perdido la partida." << endl;
-            return false;
-        }
+    cout << fixed << setprecision(2);
+    cout << total.campaigns << " partidas en " << seconds << " s con " << threads << " hilos ("
+         << (total.campaigns / seconds) << " partidas/s, " << total.steals << " robos de trabajo)" << endl;
+    cout << "Partidas por hilo:";
+    for (const CampaignStats& stats : perWorker) cout << " " << stats.campaigns;
+    cout << endl;
+
+    cout << "\nSala alcanzada:" << endl;
+    for (int room = 1; room <= 10; ++room) {
+        double share = 100.0 * total.roomReached[room] / total.campaigns;
+        cout << "  Sala " << setw(2) << room << ": " << setw(6) << share << "% " << string(static_cast<int>(share / 2), '#') << endl;
     }
-    
-    // Displays current HP status of all combatants
-    void displayBattleStatus() const { //Muestra en consola el estado actual de la batalla: Vida y estadísticas de héroes y enemigos.
-        cout << "\n--- Estado de la Batalla ---" << endl;
-        cout << "Héroes:" << endl;
-        for (Hero* hero : heroes) {
-            hero->displayStats();
-        }
-        cout << "Enemigos:" << endl;
-        for (Enemy* enemy : enemies) {
-            enemy->displayStats();
-        }
-        cout << "--------------------------" << endl;
+    cout << "  Mazmorra completada: " << (100.0 * total.completed / total.campaigns) << "%" << endl;
+
+    cout << "\nVida perdida: media " << (static_cast<double>(total.healthLostSum) / total.campaigns)
+         << ", mínima " << total.healthLostMin << ", máxima " << total.healthLostMax
+         << ", p50 >= " << total.healthLostPercentile(0.5) << ", p90 >= " << total.healthLostPercentile(0.9) << endl;
+    for (int i = 0; i < CAMPAIGN_HEALTH_BUCKETS; ++i) {
+        if (!total.healthLost[i]) continue;
+        double share = 100.0 * total.healthLost[i] / total.campaigns;
+        string range = to_string(i * CAMPAIGN_HEALTH_BUCKET) + (i + 1 < CAMPAIGN_HEALTH_BUCKETS ? "-" + to_string((i + 1) * CAMPAIGN_HEALTH_BUCKET - 1) : "+");
+        cout << "  " << setw(9) << range << ": " << setw(6) << share << "% " << string(static_cast<int>(share / 2), '#') << endl;
     }
 
-private:
-    bool decideFirstTurn() {
-        // Encuentra el héroe más rápido vivo
-        int maxHeroSpd = -1;
-        for (auto h : heroes) {
-            if (h->isAlive() && h->getSpd() > maxHeroSpd)
-                maxHeroSpd = h->getSpd();
+    cout << "\nSupervivencia por héroe:" << endl;
+    for (int h = 0; h < HERO_ROSTER_SIZE; ++h) {
+        if (!total.picked[h]) continue;
+        cout << "  " << left << setw(12) << HERO_ROSTER[h].name << right << setw(10) << total.picked[h] << " partidas, sobrevive "
+             << (100.0 * total.survived[h] / total.picked[h]) << "%" << endl;
+    }
+    return 0;
+}
+
+// Usage: --telemetry-watch FILE [all]
+// Follows the telemetry ring a game writes with --telemetry FILE, printing
+// one line per event from now on (with all: from the oldest record still in
+// the ring). Waits for the file to appear and stops once the writer exits.
+int runTelemetryWatchCli(int argc, char* argv[]) {
+    TelemetryRing ring;
+    while (!ring.attach(argv[2])) {
+#ifdef _WIN32
+        cout << "La telemetría necesita mmap (no disponible en Windows)" << endl;
+        return 1;
+#endif
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    bool fromStart = argc > 3 && string(argv[3]) == "all";
+    uint64_t cursor = ring.published();
+    if (fromStart) cursor = cursor > ring.capacity() ? cursor - ring.capacity() : 0;
+    uint64_t shown = 0;
+    uint64_t lost = 0;
+    TelemetryEvent e;
+    while (true) {
+        uint64_t published = ring.published();
+        if (published < cursor) cursor = 0; // the game recreated the ring
+        if (published - cursor > ring.capacity()) {
+            lost += published - ring.capacity() - cursor;
+            cursor = published - ring.capacity();
         }
-        // Encuentra el enemigo más rápido vivo
-        int maxEnemySpd = -1;
-        for (auto e : enemies) {
-            if (e->isAlive() && e->getSpd() > maxEnemySpd)
-                maxEnemySpd = e->getSpd();
+        if (cursor == published) {
+            if (ring.writerClosed()) break;
+            this_thread::sleep_for(chrono::milliseconds(5));
+            continue;
         }
-        // Empieza el equipo con mayor SPD
-        return maxHeroSpd >= maxEnemySpd;
+        for (; cursor < published; ++cursor) {
+            if (!ring.read(cursor, e)) {
+                ++lost; // overwritten while we were reading
+                continue;
+            }
+            ++shown;
+            cout << '#' << e.index << ' ' << EVENT_NAMES[e.type];
+            if (!e.actor.empty()) cout << ' ' << e.actor;
+            if (!e.target.empty()) cout << " -> " << e.target;
+            cout << " (" << e.value << ")\n";
+        }
+        cout.flush();
+    }
+    cout << shown << " eventos, " << lost << " perdidos por ir detrás del juego" << endl;
+    return 0;
+}
+
+// Usage: --serve ADDRESS [threads] [seed] [game options]
+// Hosts game sessions on ADDRESS (a Unix socket path, PORT or HOST:PORT; see
+// GAME SERVER) with one epoll worker per thread until SIGINT/SIGTERM. Every
+// session plays by the game options (see GameOptions) and saves to the usual
+// leaderboard. Prints open sessions, answered inputs and resident memory
+// every few seconds.
+int runServerCli(int argc, char* argv[]) {
+#if !SISAS_SERVER
+    (void)argc;
+    (void)argv;
+    cout << "El modo servidor necesita Linux." << endl;
+    return 1;
+#else
+    string address = argv[2];
+    int threads = max(1u, thread::hardware_concurrency());
+    uint64_t seed = RngService::randomSeed();
+    int arg = 3;
+    if (arg < argc && argv[arg][0] != '-') threads = atoi(argv[arg++]);
+    if (arg < argc && argv[arg][0] != '-') seed = strtoull(argv[arg++], nullptr, 10);
+    GameOptions options;
+    bool optionsOk = true;
+    for (; arg < argc && optionsOk; ++arg) optionsOk = options.parse(arg, argc, argv);
+    if (threads <= 0 || !optionsOk) {
+        cout << "Uso: --serve DIRECCION [hilos] [semilla] [--alternate-turns] [--potion-turns [N]] [--horde [N]] [--endless]" << endl;
+        return 1;
     }
 
-    bool performHeroTurn() {
-        Hero* currentHero = getNextAliveHero();
-        if (!currentHero) return false; // No quedan héroes vivos
+    raiseOpenFileLimit();
+    int listenFd = openGameSocket(address, true);
+    if (listenFd < 0) {
+        cout << "No se pudo escuchar en " << address << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
 
-        cout << "\nEs el turno de " << currentHero->getName() << "." << endl;
-        heroAction(currentHero);
+    RngService seeds(seed);
+    Rng catalogRng = seeds.stream(STREAM_INVENTORY);
+    auto catalog = make_shared<const ItemCatalog>(catalogRng);
+    ScoreManager scores;
+    flushMessages();
+    atomic<uint64_t> nextSession(0);
+    unique_ptr<ServerWorkerStats[]> stats(new ServerWorkerStats[threads]);
+    vector<thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            ServerWorker worker(listenFd, catalog, scores, options, seeds, nextSession, stats[i]);
+            if (!worker.run()) serverStopping.store(true);
+        });
+    }
+    cout << "Servidor en " << address << " con " << threads << " hilos (semilla " << seed << ")" << endl;
 
-        return true;
+    uint64_t lastInputs = 0;
+    uint64_t lastNanos = 0;
+    auto last = chrono::steady_clock::now();
+    cout << fixed << setprecision(1);
+    while (!serverStopping.load()) {
+        this_thread::sleep_for(chrono::milliseconds(200));
+        auto now = chrono::steady_clock::now();
+        double seconds = chrono::duration<double>(now - last).count();
+        if (seconds < 5.0 && !serverStopping.load()) continue;
+        uint64_t open = 0, started = 0, inputs = 0, nanos = 0;
+        for (int i = 0; i < threads; ++i) {
+            open += stats[i].sessions.load(memory_order_relaxed);
+            started += stats[i].started.load(memory_order_relaxed);
+            inputs += stats[i].inputs.load(memory_order_relaxed);
+            nanos += stats[i].busyNanos.load(memory_order_relaxed);
+        }
+        uint64_t newInputs = inputs - lastInputs;
+        cout << "Sesiones abiertas " << open << " (" << started << " en total), " << (newInputs / seconds)
+             << " entradas/s, " << (newInputs ? (nanos - lastNanos) / 1000.0 / newInputs : 0.0)
+             << " us por entrada, RSS " << residentMegabytes() << " MB" << endl;
+        lastInputs = inputs;
+        lastNanos = nanos;
+        last = now;
     }
+    for (thread& worker : workers) worker.join();
+    close(listenFd);
+    if (!isTcpAddress(address)) unlink(address.c_str());
+    cout << "Servidor detenido." << endl;
+    return 0;
+#endif
+}
 
-    bool performEnemyTurn() {
-        Enemy* currentEnemy = getNextAliveEnemy();
-        if (!currentEnemy) return false; // No quedan enemigos vivos
+// Usage: --serve-load ADDRESS [sessions] [seconds] [idle]
+// Load generator for --serve: keeps sessions connections playing (a random
+// valid answer to every ">>" prompt, a new game when one ends) for seconds,
+// then prints games, answers per second and the time from each answer to the
+// server's next prompt. With idle it connects and never answers, to measure
+// what parked sessions cost the server.
+int runServerLoadCli(int argc, char* argv[]) {
+#if !SISAS_SERVER
+    (void)argc;
+    (void)argv;
+    cout << "El modo servidor necesita Linux." << endl;
+    return 1;
+#else
+    string address = argv[2];
+    int sessions = (argc > 3) ? atoi(argv[3]) : 100;
+    double seconds = (argc > 4) ? atof(argv[4]) : 10.0;
+    bool idle = argc > 5 && string(argv[5]) == "idle";
+    if (sessions <= 0 || seconds <= 0) {
+        cout << "Uso: --serve-load DIRECCION [sesiones] [segundos] [idle]" << endl;
+        return 1;
+    }
+    raiseOpenFileLimit();
 
-        cout << "\nEs el turno de " << currentEnemy->getName() << "." << endl;
-        enemyAction(currentEnemy);
+    struct LoadConnection {
+        int fd = -1;
+        string pending; // received text not yet scanned for prompts
+        chrono::steady_clock::time_point answeredAt;
+        bool waiting = false; // answered, waiting for the next prompt
+    };
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    vector<LoadConnection> connections(sessions);
+    Rng rng(RngService::randomSeed());
+    vector<uint32_t> latencies; // microseconds
+    long long games = 0, answers = 0, failures = 0;
 
+    auto connectSlot = [&](int slot) {
+        LoadConnection& c = connections[slot];
+        c = LoadConnection();
+        c.fd = openGameSocket(address, false);
+        if (c.fd < 0) {
+            ++failures;
+            return false;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.u32 = static_cast<uint32_t>(slot);
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, c.fd, &ev);
         return true;
+    };
+    for (int i = 0; i < sessions; ++i) {
+        if (!connectSlot(i)) {
+            cout << "No se pudo conectar a " << address << ": " << strerror(errno) << endl;
+            return 1;
+        }
     }
 
-    Hero* getNextAliveHero() {
-        size_t startIndex = heroIndex;
-        do {
-            if (heroes[heroIndex]->isAlive()) {
-                Hero* h = heroes[heroIndex];
-                heroIndex = (heroIndex + 1) % heroes.size();
-                return h;
+    vector<epoll_event> events(SERVER_MAX_EVENTS);
+    char buffer[SERVER_READ_CHUNK];
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    while (chrono::steady_clock::now() < deadline) {
+        int n = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), 100);
+        for (int i = 0; i < n; ++i) {
+            int slot = static_cast<int>(events[i].data.u32);
+            LoadConnection& c = connections[slot];
+            ssize_t got;
+            bool closed = false;
+            while ((got = recv(c.fd, buffer, sizeof(buffer), 0)) > 0) {
+                if (!idle) c.pending.append(buffer, static_cast<size_t>(got));
+            }
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) closed = true;
+            if (closed) { // the game is over (or the server went away)
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, c.fd, nullptr);
+                close(c.fd);
+                ++games;
+                if (c.waiting) {
+                    latencies.push_back(static_cast<uint32_t>(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - c.answeredAt).count()));
+                }
+                connectSlot(slot);
+                continue;
+            }
+            // Answer the last prompt received; earlier ones were already answered
+            size_t prompt = c.pending.rfind(">> ");
+            if (prompt == string::npos || c.pending.find('\n', prompt) == string::npos) continue;
+            string_view request(c.pending.data() + prompt + 3, c.pending.find('\n', prompt) - prompt - 3);
+            string answer = "Bot\n";
+            size_t dash = request.find('-');
+            if (dash != string_view::npos) {
+                int min = atoi(string(request.substr(0, dash)).c_str());
+                int max = atoi(string(request.substr(dash + 1)).c_str());
+                answer = to_string(min + rng.below(max - min + 1)) + "\n";
             }
-            heroIndex = (heroIndex + 1) % heroes.size();
-        } while (heroIndex != startIndex);
-        return nullptr; // No hay héroes vivos
+            c.pending.clear();
+            if (c.waiting) {
+                latencies.push_back(static_cast<uint32_t>(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - c.answeredAt).count()));
+            }
+            send(c.fd, answer.data(), answer.size(), MSG_NOSIGNAL);
+            c.answeredAt = chrono::steady_clock::now();
+            c.waiting = true;
+            ++answers;
+        }
     }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (LoadConnection& c : connections) {
+        if (c.fd >= 0) close(c.fd);
+    }
+    close(epollFd);
 
-    Enemy* getNextAliveEnemy() {
-        size_t startIndex = enemyIndex;
-        do {
-            if (enemies[enemyIndex]->isAlive()) {
-                Enemy* e = enemies[enemyIndex];
-                enemyIndex = (enemyIndex + 1) % enemies.size();
-                return e;
-            }
-            enemyIndex = (enemyIndex + 1) % enemies.size();
-        } while (enemyIndex != startIndex);
-        return nullptr; // No hay enemigos vivos
+    cout << fixed << setprecision(1);
+    cout << sessions << " sesiones durante " << elapsed << " s: " << games << " partidas terminadas, " << answers
+         << " respuestas (" << (answers / elapsed) << "/s), " << failures << " conexiones fallidas" << endl;
+    if (!latencies.empty()) {
+        sort(latencies.begin(), latencies.end());
+        auto at = [&](double q) { return latencies[static_cast<size_t>(q * (latencies.size() - 1))]; };
+        cout << "Latencia respuesta -> siguiente pregunta: p50 " << at(0.5) << " us, p99 " << at(0.99)
+             << " us, máxima " << latencies.back() << " us" << endl;
     }
+    return 0;
+#endif
+}
 
-    void heroAction(Hero* hero) {
-        int choice; //Método que maneja la decisión del jugador con su héroe (atacar o usar poción).
-        while (true) {
-            cout << hero->getName() << ", ¿qué quieres hacer?" << endl;
-            cout << "1. Atacar" << endl;
-            cout << "2. Usar poción" << endl;
-            cout << "Opción: ";
-            choice = getValidatedInput(1, 2); //Imprime opciones y obtiene la elección del jugador (entrada validada).
+// Hashes every event (FNV-1a), so whole playthroughs compare by one number
+class FingerprintSink : public MessageSink {
+private:
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint64_t events = 0;
 
-            if (choice == 1) {
-                // Si elige atacar, primero busca enemigos vivos.
-                vector<Enemy*> aliveEnemies;
-                for(Enemy* e : enemies) {
-                    if (e->isAlive()) {
-                        aliveEnemies.push_back(e);
-                    }
-                }
+    void mix(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ULL;
+        }
+    }
 
-                if (aliveEnemies.empty()) { //Si no hay enemigos vivos, lo informa y reinicia la elección.
-                    cout << "No hay enemigos a quien atacar." << endl;
-                    continue; // Re-prompt hero action
-                }
+public:
+    void event(const GameEvent& e) override {
+        ++events;
+        mix(&e.type, sizeof(e.type));
+        mix(e.actor.data(), e.actor.size());
+        mix("|", 1);
+        mix(e.target.data(), e.target.size());
+        mix(&e.value, sizeof(e.value));
+    }
 
-                cout << "Selecciona un enemigo para atacar:" << endl;
-                for (size_t i = 0; i < aliveEnemies.size(); ++i) {
-                    cout << (i + 1) << ". " << aliveEnemies[i]->getName() << " (HP: " << aliveEnemies[i]->getHp() << ")" << endl;
-                }
-                int targetIndex;
-                cout << "Objetivo: ";
-                targetIndex = getValidatedInput(1, aliveEnemies.size()); //Muestra los enemigos disponibles y pide al usuario seleccionar uno.
+    uint64_t fingerprint() const { return hash; }
+    uint64_t eventCount() const { return events; }
+};
 
-                Enemy* targetEnemy = aliveEnemies[targetIndex - 1];
-                if (hero->calculateHitChance(targetEnemy)) {
-                    int damage = hero->calculateDamage(targetEnemy);
-                    targetEnemy->takeDamage(damage);
-                    cout << hero->getName() << " ataca a " << targetEnemy->getName() << " por " << damage << " de daño." << endl;
-                    if (!targetEnemy->isAlive()) {
-                        cout << targetEnemy->getName() << " ha sido derrotado!" << endl;
-                    }
-                } else {
-                    cout << hero->getName() << " falló el ataque a " << targetEnemy->getName() << "." << endl;
-                }
-                break; // Ejecuta el ataque: calcula si acierta y el daño. Si el enemigo muere, lo informa. Finaliza el turno del héroe.
+// Usage: --play-scripts FILE...
+// Plays session scripts (see --record-input) back to back in this process
+// at full speed: no text, no terminal and scores kept in memory. Prints
+// sessions per second and one fingerprint of all their events; a different
+// fingerprint from another build means some session played out differently.
+int runScriptsCli(int argc, char* argv[]) {
+    vector<string> scripts;
+    for (int i = 2; i < argc; ++i) {
+        string text;
+        if (!readWholeFile(argv[i], text)) {
+            cout << "Error con el archivo: " << argv[i] << endl;
+            return 1;
+        }
+        if (!ScriptInput(text).hasSeed()) {
+            cout << "El guion no dice su semilla (#seed N): " << argv[i] << endl;
+            return 1;
+        }
+        scripts.push_back(move(text));
+    }
+    if (scripts.empty()) {
+        cout << "Uso: --play-scripts ARCHIVO..." << endl;
+        return 1;
+    }
 
-            } else if (choice == 2) { //Revisa qué pociones no han sido usadas por el héroe.
-                // Use potion logic
-                vector<Potion*> availablePotions;
-                for (Potion* p : hero->getPotions()) {
-                    if (!p->isUsed()) {
-                        availablePotions.push_back(p);
-                    }
-                }
+    FingerprintSink sink;
+    setMessageSink(&sink);
+    long long cutShort = 0; // scripts that ran out before the player quit
+    auto start = chrono::steady_clock::now();
+    for (const string& text : scripts) {
+        ScriptInput input(text);
+        setInputProvider(&input);
+        Game game(input.seed(), nullptr, "");
+        try {
+            game.startGame();
+        } catch (const InputExhausted&) {
+            ++cutShort;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    setInputProvider(nullptr);
+    setMessageSink(nullptr);
 
-                if (availablePotions.empty()) { //Si no hay ninguna disponible, vuelve a pedir una acción.
-                    cout << "No tienes pociones disponibles para usar." << endl;
-                    continue; // Re-prompt hero action
-                }
+    cout << fixed << setprecision(1);
+    cout << scripts.size() << " sesiones en " << seconds * 1000 << " ms (" << (scripts.size() / seconds)
+         << " sesiones/s), " << sink.eventCount() << " eventos, " << cutShort << " terminadas por fin de guion" << endl;
+    cout << "Huella: " << hex << setw(16) << setfill('0') << sink.fingerprint() << dec << endl;
+    return 0;
+}
 
-                cout << "Selecciona una poción para usar:" << endl;
-                for (size_t i = 0; i < availablePotions.size(); ++i) {
-                    cout << (i + 1) << ". ";
-                    availablePotions[i]->displayInfo();
-                }
-                int potionIndex;
-                cout << "Poción: ";
-                potionIndex = getValidatedInput(1, availablePotions.size()); //Muestra la lista de pociones disponibles y deja al jugador elegir una.
+// Usage: --bench-batch [battles] [room] [lanes] [seed]
+// Runs the same battles through the scalar simulator and the SoA batch engine
+// and compares results and throughput on one core. The batch engine uses its
+// AVX2 kernel when the CPU has AVX2 and the scalar simulator otherwise.
+int runBatchBenchmarkCli(int argc, char* argv[]) {
+    long long battles = (argc > 2) ? atoll(argv[2]) : 1000000;
+    int roomNumber = (argc > 3) ? atoi(argv[3]) : 6;
+    int lanes = (argc > 4) ? atoi(argv[4]) : 64;
+    uint64_t seed = (argc > 5) ? strtoull(argv[5], nullptr, 10) : 12345;
+    if (battles <= 0 || roomNumber < 1 || roomNumber > 10 || lanes <= 0) {
+        cout << "Uso: --bench-batch [batallas] [sala 1-10] [carriles] [semilla]" << endl;
+        return 1;
+    }
 
-                // Find the original index of the potion in the hero's main potions vector
-                // This is necessary because hero->usePotion expects the original index
-                int originalIndex = -1;
-                for (size_t i = 0; i < hero->getPotions().size(); ++i) {
-                    if (hero->getPotions()[i] == availablePotions[potionIndex - 1]) {
-                        originalIndex = i;
-                        break; //Busca el índice original de la poción elegida en el vector del héroe (porque usePotion necesita ese índice).
-                    }
-                }
-                if (originalIndex != -1) {
-                     hero->usePotion(originalIndex);
-                     break; // Action completed
-                } else {
-                    cout << "Error interno al usar poción." << endl; // Should not happen
-                    continue; //Si encuentra el índice, la poción es usada. Si no, se indica error y vuelve a empezar.
-                }
-            }
-        }
+    RngService rngService(seed);
+    BattleSetup setup = makeRoomSetup(roomNumber, rngService);
+
+    BatchTotals scalar;
+    BattleSimulator simulator;
+    auto start = chrono::steady_clock::now();
+    for (long long i = 0; i < battles; ++i) {
+        BattleResult result = simulator.run(setup, rngService.streamSeed(STREAM_SIMULATION, i));
+        ++scalar.battles;
+        scalar.heroWins += result.heroesWon;
+        scalar.turns += result.turns;
+        scalar.heroHpLost += result.heroHpLost;
     }
+    double scalarSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
+    BatchBattleEngine engine(lanes);
+    start = chrono::steady_clock::now();
+    BatchTotals batch = engine.run(setup, battles, rngService);
+    double batchSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    void enemyAction(Enemy* enemy) { //Busca héroes vivos para atacar.
-        // Find a random alive hero to attack
-        vector<Hero*> aliveHeroes;
-        for (Hero* hero : heroes) {
-            if (hero->isAlive()) { 
-                aliveHeroes.push_back(hero);
-            }
-        }
+    cout << fixed << setprecision(2);
+    cout << "Sala " << roomNumber << ", " << battles << " batallas, " << lanes << " carriles, kernel " << BatchBattleEngine::kernelName() << endl;
+    printBatchTotals("Escalar", scalar, scalarSeconds);
+    printBatchTotals("Lote SoA", batch, batchSeconds);
+    cout << "Aceleración: " << (scalarSeconds / batchSeconds) << "x" << endl;
+    return 0;
+}
 
-        if (aliveHeroes.empty()) {
-            // This should ideally not happen if checkBattleEnd works correctly
-            return; //Si no hay héroes vivos, termina sin hacer nada.
-        }
-        
-        uniform_int_distribution<> dis(0, aliveHeroes.size() - 1);
-        Hero* targetHero = aliveHeroes[dis(rng)]; //Elige un héroe aleatoriamente como objetivo.
-        
-        if (enemy->calculateHitChance(targetHero)) {
-            int damage = enemy->calculateDamage(targetHero);
-            targetHero->takeDamage(damage);
-            cout << enemy->getName() << " ataca a " << targetHero->getName() << " por " << damage << " de daño." << endl;
-            if (!targetHero->isAlive()) {
-                cout << targetHero->getName() << " ha sido derrotado!" << endl;
-            }
-        } else {
-            cout << enemy->getName() << " falló el ataque a " << targetHero->getName() << "." << endl;
-        } //Ataca con la misma lógica que el héroe: calcula si acierta, daño, aplica daño y muestra resultado.
+// Builds the run-scoped objects of one game (team, ten rooms, one Battle per
+// room) from arena, the way Game does between the menu and the first battle.
+// team keeps its capacity between runs, like Game::playerTeam.
+void buildRunFromArena(RunArena& arena, vector<Hero*>& team, Rng& gen, Rng& battleRng) {
+    team.clear();
+    for (int i = 0; i < 3; ++i) {
+        const CharacterTemplate& t = HERO_ROSTER[i];
+        team.push_back(arena.create<Hero>(t.name, t.hp, t.atk, t.def, t.spd, t.lck, &arena));
     }
-    bool checkBattleEnd() const {
-        bool heroesAlive = false;
-        for (auto h : heroes)
-            if (h->isAlive()) {
-                heroesAlive = true;
-                break;
-            }
+    for (int i = 1; i <= 10; ++i) {
+        Room* room = buildDungeonRoom(i, gen, arena);
+        arena.create<Battle>(team, room->getEnemies(), battleRng);
+    }
+}
 
-        bool enemiesAlive = false;
-        for (auto e : enemies)
-            if (e->isAlive()) {
-                enemiesAlive = true;
-                break;
-            }
+// Same objects the way Game used to make them: one new/delete per object
+void buildRunFromHeap(Rng& gen, Rng& battleRng) {
+    vector<Hero*> team;
+    for (int i = 0; i < 3; ++i) {
+        const CharacterTemplate& t = HERO_ROSTER[i];
+        team.push_back(new Hero(t.name, t.hp, t.atk, t.def, t.spd, t.lck));
+    }
+    for (int i = 1; i <= 10; ++i) {
+        Room* room = new Room(i, "Normal");
+        for (const CharacterTemplate* t : buildRoomLayout(i, gen)) {
+            room->addEnemy(new Enemy(t->name, t->hp, t->atk, t->def, t->spd, t->lck, t->type));
+        }
+        Battle* battle = new Battle(team, room->getEnemies(), battleRng);
+        delete battle;
+        for (Enemy* enemy : room->getEnemies()) delete enemy;
+        delete room;
+    }
+    for (Hero* hero : team) delete hero;
+}
 
-        return !(heroesAlive && enemiesAlive);
+// Usage: --bench-arena [runs] [seed]
+// Builds and tears down N runs and reports heap allocations per run after a
+// warm-up run, with the run arena and with plain new/delete.
+int runArenaBenchmarkCli(int argc, char* argv[]) {
+    long long runs = (argc > 2) ? atoll(argv[2]) : 100000;
+    uint64_t seed = (argc > 3) ? strtoull(argv[3], nullptr, 10) : 12345;
+    if (runs <= 0) {
+        cout << "Uso: --bench-arena [partidas] [semilla]" << endl;
+        return 1;
     }
 
+    RngService rngService(seed);
+    Rng gen = rngService.stream(STREAM_DUNGEON);
+    Rng battleRng = rngService.stream(STREAM_BATTLE);
 
-    string getWinner() const {
-        bool heroesAlive = false;
-        for (auto h : heroes)
-            if (h->isAlive()) {
-                heroesAlive = true;
-                break;
-            }
-        bool enemiesAlive = false;
-        for (auto e : enemies)
-            if (e->isAlive()) {
-                enemiesAlive = true;
-                break;
-            }
-        if (heroesAlive && !enemiesAlive) return "Heroes";
-        if (!heroesAlive && enemiesAlive) return "Enemies";
-        return "Ongoing";
+    countHeapAllocations = true;
+    RunArena arena;
+    vector<Hero*> team;
+    buildRunFromArena(arena, team, gen, battleRng); // warm-up: the arena grabs its chunks
+    arena.reset();
+    uint64_t allocationsBefore = heapAllocations.load();
+    auto start = chrono::steady_clock::now();
+    for (long long i = 0; i < runs; ++i) {
+        buildRunFromArena(arena, team, gen, battleRng);
+        arena.reset();
     }
-};
+    double arenaSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t arenaAllocations = heapAllocations.load() - allocationsBefore;
 
+    allocationsBefore = heapAllocations.load();
+    start = chrono::steady_clock::now();
+    for (long long i = 0; i < runs; ++i) {
+        buildRunFromHeap(gen, battleRng);
+    }
+    double heapSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t heapAllocationsUsed = heapAllocations.load() - allocationsBefore;
 
-// ===== ROOM CLASS =====
-class Room {
-private:
-    int roomNumber;
-    vector<Enemy*> enemies;
-    string roomType;
-    bool isCleared;
-    random_device rd;
-    mt19937 gen;
+    cout << fixed << setprecision(2);
+    cout << runs << " partidas (equipo, 10 salas y sus batallas)" << endl;
+    cout << "Arena: " << (static_cast<double>(arenaAllocations) / runs) << " asignaciones de heap por partida, "
+         << (arenaSeconds * 1e9 / runs) << " ns por partida, " << arena.chunkCount() << " bloques ("
+         << arena.bytesReserved() << " bytes)" << endl;
+    cout << "new/delete: " << (static_cast<double>(heapAllocationsUsed) / runs) << " asignaciones de heap por partida, "
+         << (heapSeconds * 1e9 / runs) << " ns por partida" << endl;
+    return 0;
+}
 
-public:
-    Room(int number, const string& type) 
-        : roomNumber(number), roomType(type), isCleared(false) {
-        gen.seed(rd());
-    }
+string replayUnitName(const ReplayCombatant& unit, bool enemy) {
+    if (unit.rosterIndex < 0) return "?";
+    return enemy ? ENEMY_ROSTER[unit.rosterIndex].name : HERO_ROSTER[unit.rosterIndex].name;
+}
 
-    ~Room() {
-        for (auto enemy : enemies) {
-            delete enemy; // Rooms own their enemies
+void printReplayTurn(uint32_t index, const ReplayState& before, const ReplayTurn& turn) {
+    const ReplayCombatant* actors = turn.enemyActs ? before.enemies : before.heroes;
+    const ReplayCombatant* targets = turn.enemyActs ? before.heroes : before.enemies;
+    string actor = replayUnitName(actors[turn.actor], turn.enemyActs);
+    cout << "Turno " << index << ": ";
+    if (turn.action != REPLAY_ATTACK) {
+        bool drinks = turn.action == REPLAY_POTION;
+        cout << actor << (drinks ? " usa la poción " : ": se acaba la poción ") << (turn.potionSlot + 1) << " (";
+        for (const StatModifier& mod : turn.effect) {
+            if (mod.delta) cout << " " << statName(mod.stat) << (drinks ? " +" : " -") << mod.delta;
         }
+        cout << " )" << endl;
+        return;
+    }
+    const ReplayCombatant& target = targets[turn.target];
+    cout << actor << " ataca a " << replayUnitName(target, !turn.enemyActs)
+         << " (tirada " << int(turn.hitRoll) << "/" << Character::hitChance(actors[turn.actor].stats[STAT_LCK], target.stats[STAT_LCK]);
+    if (turn.critRoll) {
+        bool critical = turn.critRoll <= actors[turn.actor].stats[STAT_LCK];
+        cout << ", crítico " << int(turn.critRoll) << "/" << actors[turn.actor].stats[STAT_LCK] << "): "
+             << turn.damage << " de daño" << (critical ? " crítico" : "") << endl;
+    } else {
+        cout << "): falla" << endl;
     }
+}
 
-    void addEnemy(Enemy* enemy) {
-        enemies.push_back(enemy);
+void printReplayState(const ReplayState& state) {
+    for (int side = 0; side < 2; ++side) {
+        const ReplayCombatant* units = side ? state.enemies : state.heroes;
+        int count = side ? state.enemyCount : state.heroCount;
+        for (int i = 0; i < count; ++i) {
+            cout << "  " << replayUnitName(units[i], side == 1) << " - HP: " << units[i].hp << "/" << units[i].stats[STAT_HP]
+                 << " ATK: " << units[i].stats[STAT_ATK] << " DEF: " << units[i].stats[STAT_DEF]
+                 << " SPD: " << units[i].stats[STAT_SPD] << " LCK: " << units[i].stats[STAT_LCK] << endl;
+        }
     }
+}
 
-    vector<Enemy*> getEnemies() const { return enemies; }
-    int getRoomNumber() const { return roomNumber; }
-    string getRoomType() const { return roomType; }
-    bool isRoomCleared() const { return isCleared; }
-    void clearRoom() { isCleared = true; }
+// Usage: --replay FILE [battle] [turn]
+// Without a battle: size summary and re-simulation check of every battle.
+// With a battle: every turn re-simulated from the recorded seed. With a turn
+// too: jumps there through the nearest keyframe and shows the state and turn.
+int runReplayCli(int argc, char* argv[]) {
+    vector<BattleReplay> replays;
+    if (!loadReplays(argv[2], replays)) {
+        cout << "Error con el archivo: " << argv[2] << endl;
+        return 1;
+    }
 
-    void displayRoomInfo() const {
-        cout << "\n--- Estás en la Sala " << roomNumber << " ---" << endl;
-        cout << "Tipo de sala: " << roomType << endl;
-        if (!enemies.empty()) {
-            cout << "¡Enemigos a la vista!" << endl;
-            for (const auto& enemy : enemies) {
-                if (enemy->isAlive()) {
-                    enemy->displayStats();
-                }
+    if (argc <= 3) {
+        uint64_t turns = 0;
+        uint64_t turnBytes = 0;
+        uint64_t totalBytes = sizeof(REPLAY_MAGIC);
+        long long mismatches = 0;
+        for (size_t b = 0; b < replays.size(); ++b) {
+            const BattleReplay& replay = replays[b];
+            turns += replay.turnCount;
+            turnBytes += replay.turns.size();
+            totalBytes += replay.recordBytes + 1;
+            long long bad = replay.verify();
+            if (bad >= 0 && mismatches++ < 10) {
+                cout << "Batalla " << b << " (sala " << replay.room << "): el turno " << bad << " no coincide con la re-simulación" << endl;
             }
-        } else {
-            cout << "La sala parece tranquila por ahora..." << endl;
         }
+        cout << fixed << setprecision(2);
+        cout << replays.size() << " batallas, " << turns << " turnos, " << totalBytes << " bytes" << endl;
+        if (turns > 0) {
+            cout << "Bytes por turno: " << (static_cast<double>(totalBytes) / turns) << " en total, "
+                 << (static_cast<double>(turnBytes) / turns) << " solo turnos" << endl;
+        }
+        cout << "Verificación: " << (mismatches ? to_string(mismatches) + " batallas difieren" : string("todas coinciden")) << endl;
+        return mismatches ? 1 : 0;
+    }
+
+    size_t battle = strtoull(argv[3], nullptr, 10);
+    if (battle >= replays.size()) {
+        cout << "Solo hay " << replays.size() << " batallas" << endl;
+        return 1;
+    }
+    const BattleReplay& replay = replays[battle];
+    cout << "Batalla " << battle << ", sala " << replay.room << ", " << replay.turnCount << " turnos, "
+         << (replay.heroesWon ? "ganan los héroes" : "ganan los enemigos") << endl;
+
+    uint32_t first = 0;
+    uint32_t last = replay.turnCount;
+    if (argc > 4) {
+        first = static_cast<uint32_t>(min<uint64_t>(strtoull(argv[4], nullptr, 10), replay.turnCount));
+        last = min(first + 1, replay.turnCount);
+    }
+    ReplayState state;
+    const char* next;
+    if (!replay.stateBefore(first, state, next)) {
+        cout << "Réplica dañada" << endl;
+        return 1;
+    }
+    if (argc > 4) {
+        cout << "Estado antes del turno " << first << ":" << endl;
+        printReplayState(state);
+    }
+    const char* end = replay.turns.data() + replay.turns.size();
+    ReplayTurn recorded;
+    for (uint32_t i = first; i < last; ++i) {
+        if (!decodeReplayTurn(next, end, recorded)) {
+            cout << "Réplica dañada en el turno " << i << endl;
+            return 1;
+        }
+        ReplayState before = state;
+        ReplayTurn played = resimulateTurn(state, recorded);
+        printReplayTurn(i, before, played);
+        if (!sameTurn(played, recorded)) {
+            cout << "  ¡El turno grabado no coincide con la re-simulación!" << endl;
+        }
+    }
+    return 0;
+}
+
+// Usage: --bench-leaderboard [scores] [seed]
+// Fills a ScoreRanking with synthetic runs and reports insert, rank and
+// top-10 latency (mean over all operations, p99 over individually timed ones).
+int runLeaderboardBenchmarkCli(int argc, char* argv[]) {
+    long long count = (argc > 2) ? atoll(argv[2]) : 10000000;
+    uint64_t seed = (argc > 3) ? strtoull(argv[3], nullptr, 10) : 12345;
+    if (count <= 0 || count > UINT32_MAX) {
+        cout << "Uso: --bench-leaderboard [puntuaciones] [semilla]" << endl;
+        return 1;
     }
 
-    // Example for getting a random item reward (needs an Inventory instance)
-    // This method would typically be called by the Game class
-    Item* getItemReward(Inventory* inventory, const string& rarity = "Common") {
-        uniform_int_distribution<> dis(0, 2); // 0: Weapon, 1: Armor, 2: Potion
-        int itemType = dis(gen);
-
-        if (itemType == 0) {
-            return inventory->getRandomWeapon(rarity);
-        } else if (itemType == 1) {
-            return inventory->getRandomArmor(rarity);
+    Rng rng(seed);
+    ScoreRanking ranking;
+    ranking.reserve(count);
+    const long long sampleEvery = max(1LL, count / 100000);
+    vector<double> insertSamples, rankSamples;
+
+    auto start = chrono::steady_clock::now();
+    for (long long i = 0; i < count; ++i) {
+        int room = rng.between(1, 10);
+        int health = rng.between(0, 1000);
+        if (i % sampleEvery == 0) {
+            auto t0 = chrono::steady_clock::now();
+            ranking.insert(room, health, static_cast<uint32_t>(i));
+            insertSamples.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count());
         } else {
-            return inventory->getRandomPotion();
+            ranking.insert(room, health, static_cast<uint32_t>(i));
         }
     }
-};
-
-// ===== SCORE CLASS =====
-struct Score {
-    string playerName;
-    int roomReached;
-    int totalHealthLost;
-    string timestamp;
+    double insertSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    Score(string name = "", int room = 0, int health = 0, string ts = "") 
-        : playerName(name), roomReached(room), totalHealthLost(health), timestamp(ts) {}
+    const long long queries = min(count, 1000000LL);
+    size_t checksum = 0;
+    start = chrono::steady_clock::now();
+    for (long long i = 0; i < queries; ++i) {
+        int room = rng.between(1, 10);
+        checksum += ranking.rankOf(room, rng.between(0, 1000));
+    }
+    double rankSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (int i = 0; i < 100000; ++i) {
+        int room = rng.between(1, 10);
+        int health = rng.between(0, 1000);
+        auto t0 = chrono::steady_clock::now();
+        checksum += ranking.rankOf(room, health);
+        rankSamples.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count());
+    }
 
-    // Operator for sorting: higher roomReached is better. If same room, lower healthLost is better.
-    bool operator<(const Score& other) const {
-        if (roomReached != other.roomReached) {
-            return roomReached > other.roomReached; // Descending order for roomReached
-        }
-        return totalHealthLost < other.totalHealthLost; // Ascending order for totalHealthLost
+    vector<uint32_t> top;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < 10000; ++i) {
+        ranking.topK(10, top);
+        checksum += top[0];
     }
+    double topSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    auto p99 = [](vector<double>& samples) {
+        sort(samples.begin(), samples.end());
+        return samples[samples.size() * 99 / 100];
+    };
+    cout << fixed << setprecision(1);
+    cout << "Puntuaciones: " << ranking.size() << " (" << ranking.distinctResults() << " resultados distintos)" << endl;
+    cout << "Inserción: " << (insertSeconds * 1e9 / count) << " ns promedio, p99 " << p99(insertSamples) << " ns" << endl;
+    cout << "Puesto: " << (rankSeconds * 1e9 / queries) << " ns promedio, p99 " << p99(rankSamples) << " ns" << endl;
+    cout << "Top 10: " << (topSeconds * 1e9 / 10000) << " ns" << endl;
+    cout << "(control " << checksum % 1000 << ")" << endl;
+    return 0;
+}
+
+// ===== BENCHMARK SUITE =====
+// --bench times the engine's hot paths under one harness. A benchmark body
+// runs n operations; the harness grows n until one run takes at least the
+// minimum time and reports that run's time, heap allocations (from the
+// operator new counter) and throughput per operation. Results can be saved
+// as JSON and a later run compared against them to catch regressions. Game
+// text goes to a NullSink while benchmarks run.
+struct BenchResult {
+    string name;
+    uint64_t ops;
+    double nsPerOp;
+    double allocsPerOp;
+    double opsPerSec;
 };
 
-// ===== SCOREMANAGER CLASS =====
-class ScoreManager {
+volatile uint64_t benchSink; // keeps the optimizer from dropping benchmark results
+
+class BenchSuite {
 private:
-    vector<Score> scores;
-    string filename;
+    string filter;
+    double minSeconds;
+    vector<BenchResult> results;
 
-public:
-    ScoreManager(const string& fn = "leaderboard.txt") : filename(fn) {
-        loadScores();
+    static void printResult(const BenchResult& r) {
+        cout << left << setw(26) << r.name << right << fixed
+             << setw(14) << setprecision(1) << r.nsPerOp << " ns/op"
+             << setw(12) << setprecision(2) << r.allocsPerOp << " asig/op"
+             << setw(14) << setprecision(0) << r.opsPerSec << " op/s" << endl;
     }
 
-    void loadScores() {
-        scores.clear();
-        ifstream file(filename);
-        if (file.is_open()) {
-            string line;
-            while (getline(file, line)) {
-                stringstream ss(line);
-                string name, roomStr, healthStr, ts;
-                getline(ss, name, ',');
-                getline(ss, roomStr, ',');
-                getline(ss, healthStr, ',');
-                getline(ss, ts);
-
-                scores.emplace_back(name, stoi(roomStr), stoi(healthStr), ts);
-            }
-            file.close();
-            sortScores();
-        } else {
-            cout << "Advertencia: No se pudo abrir el archivo de leaderboard. Se creará uno nuevo si se guarda una puntuación." << endl;
-        }
-    }
+public:
+    BenchSuite(const string& filter, double minSeconds) : filter(filter), minSeconds(minSeconds) {}
 
-    void saveScore(const string& playerName, int roomReached, int healthLost) {
-        time_t now = time(0);
-        char buffer[80];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&now));
-        string timestamp(buffer);
+    const vector<BenchResult>& getResults() const { return results; }
 
-        scores.emplace_back(playerName, roomReached, healthLost, timestamp);
-        sortScores();
+    bool wants(const string& name) const { return filter.empty() || name.find(filter) != string::npos; }
 
-        ofstream file(filename);
-        if (file.is_open()) {
-            for (const auto& score : scores) {
-                file << score.playerName << "," 
-                     << score.roomReached << "," 
-                     << score.totalHealthLost << "," 
-                     << score.timestamp << endl;
+    // maxOps caps benchmarks whose operations are slow no matter what (fsync)
+    template <typename Body>
+    void run(const string& name, Body body, uint64_t maxOps = UINT64_MAX) {
+        if (!wants(name)) return;
+        body(1); // warm-up: caches, lazily grown buffers
+        uint64_t n = 1;
+        for (;;) {
+            uint64_t allocationsBefore = heapAllocations.load();
+            auto start = chrono::steady_clock::now();
+            body(n);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            uint64_t allocations = heapAllocations.load() - allocationsBefore;
+            if (seconds >= minSeconds || n >= maxOps) {
+                results.push_back({name, n, seconds * 1e9 / n, static_cast<double>(allocations) / n,
+                                   seconds > 0 ? n / seconds : 0});
+                printResult(results.back());
+                return;
             }
-            file.close();
-            cout << "Puntuación guardada exitosamente." << endl;
-        } else {
-            cout << "Error: No se pudo guardar la puntuación en el archivo." << endl;
+            // Aim for the minimum time directly, growing at most 10x per step
+            double scale = seconds > 0 ? min(10.0, minSeconds * 1.2 / seconds) : 10.0;
+            n = min(maxOps, max(n + 1, static_cast<uint64_t>(n * scale)));
         }
     }
 
-    void displayLeaderboard(int limit = 10) const {
-        cout << "\n--- TABLA DE CLASIFICACIÓN ---" << endl;
-        if (scores.empty()) {
-            cout << "No hay puntuaciones registradas aún." << endl;
-            return;
+    bool writeJson(const string& path, uint64_t seed) const {
+        ofstream file(path);
+        if (!file.is_open()) return false;
+        file << fixed << setprecision(3);
+        file << "{\n  \"seed\": " << seed << ",\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+            file << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.ops
+                 << ", \"ns_per_op\": " << r.nsPerOp << ", \"allocs_per_op\": " << r.allocsPerOp
+                 << ", \"ops_per_sec\": " << r.opsPerSec << "}" << (i + 1 < results.size() ? "," : "") << '\n';
         }
-        
-        cout << left << setw(3) << "#"
-             << setw(20) << "Jugador"
-             << setw(10) << "Salas"
-             << setw(15) << "Vida Perdida"
-             << setw(20) << "Fecha" << endl;
-        cout << string(68, '-') << endl;
+        file << "  ]\n}\n";
+        return static_cast<bool>(file);
+    }
+};
+
+// Reads back the files writeJson produces (not a general JSON parser)
+bool loadBenchBaseline(const string& path, vector<BenchResult>& baseline) {
+    ifstream file(path);
+    if (!file.is_open()) return false;
+    stringstream buffer;
+    buffer << file.rdbuf();
+    string text = buffer.str();
+    auto number = [&](size_t from, size_t to, const char* key) {
+        size_t at = text.find(key, from);
+        return (at == string::npos || at > to) ? 0.0 : strtod(text.c_str() + at + strlen(key), nullptr);
+    };
+    const string nameKey = "\"name\": \"";
+    for (size_t at = text.find(nameKey); at != string::npos;) {
+        size_t start = at + nameKey.size();
+        size_t end = text.find('"', start);
+        if (end == string::npos) break;
+        size_t next = text.find(nameKey, end);
+        size_t limit = (next == string::npos) ? text.size() : next;
+        BenchResult r;
+        r.name = text.substr(start, end - start);
+        r.ops = static_cast<uint64_t>(number(end, limit, "\"iterations\":"));
+        r.nsPerOp = number(end, limit, "\"ns_per_op\":");
+        r.allocsPerOp = number(end, limit, "\"allocs_per_op\":");
+        r.opsPerSec = number(end, limit, "\"ops_per_sec\":");
+        baseline.push_back(r);
+        at = next;
+    }
+    return true;
+}
 
-        for (size_t i = 0; i < min((size_t)limit, scores.size()); ++i) {
-            cout << left << setw(3) << (i + 1)
-                 << setw(20) << scores[i].playerName
-                 << setw(10) << scores[i].roomReached
-                 << setw(15) << scores[i].totalHealthLost
-                 << setw(20) << scores[i].timestamp << endl;
+// Prints current vs baseline; a benchmark regresses when it got slower by
+// more than thresholdPercent or allocates more per operation. Returns the
+// number of regressions.
+int compareBenchResults(const vector<BenchResult>& current, const vector<BenchResult>& baseline, double thresholdPercent) {
+    int regressions = 0;
+    cout << "\n" << left << setw(26) << "Comparación" << right << setw(14) << "base ns/op" << setw(14) << "ahora ns/op"
+         << setw(10) << "cambio" << setw(14) << "asig/op" << endl;
+    for (const BenchResult& now : current) {
+        auto base = find_if(baseline.begin(), baseline.end(), [&](const BenchResult& b) { return b.name == now.name; });
+        if (base == baseline.end()) {
+            cout << left << setw(26) << now.name << right << "  (sin base)" << endl;
+            continue;
         }
-        cout << "------------------------------" << endl;
+        double change = base->nsPerOp > 0 ? (now.nsPerOp / base->nsPerOp - 1.0) * 100.0 : 0.0;
+        bool moreAllocations = now.allocsPerOp > base->allocsPerOp * 1.01 + 0.01;
+        bool regressed = change > thresholdPercent || moreAllocations;
+        regressions += regressed;
+        cout << left << setw(26) << now.name << right << fixed << setprecision(1)
+             << setw(14) << base->nsPerOp << setw(14) << now.nsPerOp
+             << setw(9) << showpos << change << "%" << noshowpos
+             << setw(10) << setprecision(2) << base->allocsPerOp << " -> " << now.allocsPerOp
+             << (regressed ? "  REGRESIÓN" : "") << endl;
     }
+    return regressions;
+}
 
-    void sortScores() {
-        sort(scores.begin(), scores.end());
+// Attacks the first living enemy; lets Battle run without the console
+class FirstTargetPolicy : public HeroPolicy {
+public:
+    HeroDecision decide(const pmr::vector<Hero*>&, const pmr::vector<Enemy*>& enemies,
+                        int, size_t, size_t) override {
+        int target = 0;
+        while (target + 1 < static_cast<int>(enemies.size()) && !enemies[target]->isAlive()) ++target;
+        return {false, target};
     }
 };
 
-// ===== GAME CLASS (MAIN GAME LOGIC) =====
-class Game {
-private:
-    vector<Hero*> availableHeroes;
-    vector<Hero*> playerTeam;
-    vector<Enemy*> availableEnemies;
-    vector<Room*> dungeon;
-    Inventory* inventory;
-    string playerName;
-    int currentRoomNumber;
-    ScoreManager* scoreManager;
-    random_device rd;
-    mt19937 gen;
-
+// Attacks whichever enemy the battle hands out first; O(1) for any room size
+class AnyTargetPolicy : public HeroPolicy {
 public:
-    Game() : inventory(nullptr), currentRoomNumber(0) {
-        gen.seed(rd());
-        initializeAvailableCharacters();
-        inventory = new Inventory(); // Initialize global inventory
-        scoreManager = new ScoreManager();
+    HeroDecision decide(const pmr::vector<Hero*>&, const pmr::vector<Enemy*>&, int, size_t, size_t) override {
+        return {false, HeroDecision::ANY_ENEMY};
     }
+};
 
-    ~Game() {
-        for (auto hero : availableHeroes) delete hero;
-        for (auto hero : playerTeam) delete hero; // Ensure playerTeam heroes are also deleted if they were copied
-        for (auto enemy : availableEnemies) delete enemy;
-        // Dungeon rooms own their enemies, so deleting rooms deletes enemies.
-        for (auto room : dungeon) delete room; 
-        delete inventory;
-        delete scoreManager;
-    }
+void runCombatBenchmarks(BenchSuite& suite, RngService& rngService) {
+    const CharacterTemplate& h = HERO_ROSTER[0];
+    const CharacterTemplate& e = ENEMY_ROSTER[0];
+    Hero hero(h.name, h.hp, h.atk, h.def, h.spd, h.lck);
+    Enemy enemy(e.name, e.hp, e.atk, e.def, e.spd, e.lck, e.type);
+    Rng rng = rngService.stream(STREAM_SIMULATION, 1);
 
-    void startGame() {
-        showMainMenu();
-    }
+    suite.run("combat/hit_chance", [&](uint64_t n) {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < n; ++i) hits += hero.calculateHitChance(&enemy, rng);
+        benchSink = hits;
+    });
+    suite.run("combat/damage", [&](uint64_t n) {
+        uint64_t total = 0;
+        for (uint64_t i = 0; i < n; ++i) total += hero.calculateDamage(&enemy, rng);
+        benchSink = total;
+    });
+}
 
-    void showMainMenu() {
-        int choice;
-        do {
-            cout << "\n=== SISAS: Natal Combat ===" << endl;
-            cout << "1. Empezar Nueva Partida" << endl;
-            cout << "2. Ver Tabla de Clasificacion" << endl;
-            cout << "3. Salir" << endl;
-            cout << "Opción: ";
-            choice = getValidatedInput(1, 3);
+void runInventoryBenchmarks(BenchSuite& suite, RngService& rngService) {
+    Rng inventoryRng = rngService.stream(STREAM_INVENTORY);
+    auto catalog = make_shared<const ItemCatalog>(inventoryRng);
+    Inventory inventory(catalog, inventoryRng);
+    vector<const Weapon*> weapons = catalog->getAllWeapons();
+    vector<const Armor*> armors = catalog->getAllArmors();
+    const CharacterTemplate& h = HERO_ROSTER[0];
+    Hero hero(h.name, h.hp, h.atk, h.def, h.spd, h.lck);
 
-            switch (choice) {
-                case 1:
-                    setupNewGame();
-                    playGame();
-                    break;
-                case 2:
-                    scoreManager->displayLeaderboard();
-                    break;
-                case 3:
-                    cout << "¡Gracias por jugar SISAS! ¡Nos vemos!" << endl;
-                    break;
-            }
-        } while (choice != 3);
-    }
+    // One operation swaps both the weapon and the armor
+    suite.run("hero/equip_churn", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            hero.equipWeapon(weapons[i % weapons.size()]);
+            hero.equipArmor(armors[i % armors.size()]);
+        }
+        benchSink = hero.getAtk();
+    });
+    suite.run("catalog/build", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            Rng rng = rngService.stream(STREAM_INVENTORY);
+            ItemCatalog fresh(rng);
+            benchSink = fresh.getPotions().size();
+        }
+    });
+    suite.run("inventory/random_weapon", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) benchSink = reinterpret_cast<uintptr_t>(inventory.getRandomWeapon(RARITY_COMMON));
+    });
+    suite.run("inventory/random_armor", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) benchSink = reinterpret_cast<uintptr_t>(inventory.getRandomArmor(RARITY_RARE));
+    });
+    suite.run("inventory/random_potion", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) benchSink = reinterpret_cast<uintptr_t>(inventory.getRandomPotion());
+    });
+}
 
-private:
-    void initializeAvailableCharacters() {
-        // Hero base stats (HP, ATK, DEF, SPD, LCK)
-        availableHeroes.push_back(new Hero("Caleño", 100, 15, 10, 8, 7));
-        availableHeroes.push_back(new Hero("Costeño", 110, 12, 12, 6, 9));
-        availableHeroes.push_back(new Hero("Paisa", 90, 18, 8, 10, 5));
-        availableHeroes.push_back(new Hero("Amazonas", 95, 14, 11, 7, 8));
-        availableHeroes.push_back(new Hero("Llanero", 120, 13, 13, 5, 6));
-        availableHeroes.push_back(new Hero("Chocoano", 85, 17, 9, 9, 7));
-
-        // Available enemies (these will be copied for each room)
-        // Soldier (HP, ATK, DEF, SPD, LCK)
-        availableEnemies.push_back(new Enemy("El Mindo", 40, 8, 5, 7, 6, "Soldado"));
-        availableEnemies.push_back(new Enemy("Betty la Fea", 45, 7, 6, 8, 7, "Soldado"));
-        availableEnemies.push_back(new Enemy("Carlos Vives", 50, 9, 6, 6, 5, "Soldado"));
-        availableEnemies.push_back(new Enemy("Diva Jessurum", 42, 9, 4, 9, 8, "Soldado"));
-        availableEnemies.push_back(new Enemy("Falcao García", 55, 11, 7, 7, 6, "Soldado"));
-        availableEnemies.push_back(new Enemy("Shakira", 48, 10, 5, 8, 7, "Soldado"));
-        availableEnemies.push_back(new Enemy("Juanes", 52, 10, 6, 7, 6, "Soldado"));
-        availableEnemies.push_back(new Enemy("Maluma", 47, 8, 7, 9, 5, "Soldado"));
-        availableEnemies.push_back(new Enemy("J Balvin", 49, 9, 6, 8, 6, "Soldado"));
-        availableEnemies.push_back(new Enemy("Karol G", 46, 10, 5, 7, 8, "Soldado"));
-        availableEnemies.push_back(new Enemy("Gabo", 44, 8, 6, 9, 7, "Soldado"));
-        availableEnemies.push_back(new Enemy("El Pibe Valderrama", 51, 10, 7, 6, 5, "Soldado"));
-
-
-        // Mini-Boss (HP, ATK, DEF, SPD, LCK)
-        availableEnemies.push_back(new Enemy("Pablo Escobar", 80, 25, 10,18,25, "Mini-Jefe"));
-        availableEnemies.push_back(new Enemy("Alias Tiro Fijo", 75, 24, 11, 7,16, "Mini-Jefe"));
-        availableEnemies.push_back(new Enemy("La Liendra", 90, 23, 9, 9,17, "Mini-Jefe"));
-
-        // Final Boss (HP, ATK, DEF, SPD, LCK)
-        availableEnemies.push_back(new Enemy("PETRO", 150, 35, 15, 10, 20, "Jefe Final"));
-        availableEnemies.push_back(new Enemy("Gozo con Gonzo",90,45,25,18,16, "Jefe Final"));
+// Cost the game pays per event with --telemetry (nobody reading)
+void runTelemetryBenchmarks(BenchSuite& suite) {
+    if (!suite.wants("telemetry/publish")) return;
+    const string path = "bench-telemetry.ring";
+    {
+        TelemetryRing ring;
+        if (!ring.create(path)) return;
+        const GameEvent e = {EVENT_ATTACK, HERO_ROSTER[0].name, ENEMY_ROSTER[0].name, 12};
+        suite.run("telemetry/publish", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) ring.publish(e);
+        });
     }
-    
-    void setupNewGame() {
-        cout << "\n¡Bienvenido a SISAS!" << endl;
-        cout << "¿Cuál es tu nombre, valiente aventurero? ";
-        getline(cin, playerName);
+    remove(path.c_str());
+}
 
-        selectHeroes();
-        initialMarket();
-        initializeDungeon();
-        currentRoomNumber = 0; // Reset room counter for new game
+// One full Battle per operation against the room's layout from the dungeon
+// generator, with the first three heroes rebuilt fresh in a RunArena.
+void runBattleBenchmarks(BenchSuite& suite, RngService& rngService) {
+    Rng roomGens[11];
+    Rng gen = rngService.stream(STREAM_DUNGEON);
+    for (int r = 1; r <= 10; ++r) {
+        roomGens[r] = gen;
+        buildRoomLayout(r, gen); // advance like Game::initializeDungeon does
     }
+    Rng battleRng = rngService.stream(STREAM_BATTLE);
+    FirstTargetPolicy policy;
+    RunArena arena;
+    vector<Hero*> team;
 
-    void selectHeroes() {
-        playerTeam.clear(); // Clear previous team if any
-        cout << "\n--- Selección de Héroes ---" << endl;
-        cout << "Elige a 3 héroes para tu equipo." << endl;
-
-        vector<Hero*> tempAvailableHeroes = availableHeroes; // Copy to remove selected ones
-        
-        for (int i = 0; i < 3; ++i) {
-            while (true) {
-                cout << "\nHéroe #" << (i + 1) << ":" << endl;
-                for (size_t j = 0; j < tempAvailableHeroes.size(); ++j) {
-                    cout << (j + 1) << ". ";
-                    tempAvailableHeroes[j]->displayStats();
+    for (int r = 1; r <= 10; ++r) {
+        suite.run("battle/room_" + to_string(r), [&](uint64_t n) {
+            uint64_t wins = 0;
+            for (uint64_t i = 0; i < n; ++i) {
+                arena.reset();
+                team.clear();
+                for (int h = 0; h < 3; ++h) {
+                    const CharacterTemplate& t = HERO_ROSTER[h];
+                    team.push_back(arena.create<Hero>(t.name, t.hp, t.atk, t.def, t.spd, t.lck, &arena));
                 }
-                cout << "Elige un número: ";
-                int choice = getValidatedInput(1, tempAvailableHeroes.size());
+                Rng roomGen = roomGens[r];
+                Room* room = buildDungeonRoom(r, roomGen, arena);
+                Battle* battle = arena.create<Battle>(team, room->getEnemies(), battleRng, nullptr, &policy);
+                battle->setRoomNumber(r);
+                wins += battle->startBattle();
+            }
+            benchSink = wins;
+        });
+    }
 
-                // Create a deep copy of the hero to add to playerTeam
-                Hero* chosenHero = new Hero(
-                    tempAvailableHeroes[choice - 1]->getName(),
-                    tempAvailableHeroes[choice - 1]->getMaxHp(), // Use maxHp for initial HP
-                    tempAvailableHeroes[choice - 1]->getAtk(),
-                    tempAvailableHeroes[choice - 1]->getDef(),
-                    tempAvailableHeroes[choice - 1]->getSpd(),
-                    tempAvailableHeroes[choice - 1]->getLck()
-                );
-                playerTeam.push_back(chosenHero);
-                
-                tempAvailableHeroes.erase(tempAvailableHeroes.begin() + choice - 1); // Remove selected hero
-                cout << chosenHero->getName() << " se ha unido a tu equipo." << endl;
-                break;
+    // 10,000 combatants: 1,000 heroes against a horde of 9,000, one whole
+    // battle per operation
+    AnyTargetPolicy anyTarget;
+    suite.run("battle/horde_10k", [&](uint64_t n) {
+        uint64_t wins = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            arena.reset();
+            team.clear();
+            for (int h = 0; h < 1000; ++h) {
+                const CharacterTemplate& t = HERO_ROSTER[h % HERO_ROSTER_SIZE];
+                team.push_back(arena.create<Hero>(t.name, t.hp, t.atk, t.def, t.spd, t.lck, &arena));
             }
+            Room* room = buildHordeRoom(HORDE_ROOM, 9000, arena);
+            Battle* battle = arena.create<Battle>(team, room->getEnemies(), battleRng, nullptr, &anyTarget);
+            battle->setRoomNumber(HORDE_ROOM);
+            wins += battle->startBattle();
         }
-        cout << "\n¡Tu equipo está listo!" << endl;
-        for (auto hero : playerTeam) {
-            hero->displayStats();
-        }
-    }
+        benchSink = wins;
+    }, 64);
+    team.clear();
+    arena.reset();
+}
 
-    void initialMarket() {
-        cout << "\n--- Mercado Inicial ---" << endl;
-        cout << "¡Bienvenido al mercado! Puedes equipar a tus héroes con algunas armas y armaduras básicas." << endl;
+// Leaderboards of 10^3..10^6 rows, written as CSV and imported once. load_N
+// reads the snapshot and log back; save_N appends (and fsyncs) one score, so
+// it is capped at a few operations.
+void runScoreBenchmarks(BenchSuite& suite, RngService& rngService) {
+    Rng rng = rngService.stream(STREAM_SIMULATION, 2);
+    for (long long rows = 1000; rows <= 1000000; rows *= 10) {
+        string suffix = to_string(rows);
+        if (!suite.wants("scores/load_" + suffix) && !suite.wants("scores/save_" + suffix)) continue;
 
-        for (Hero* hero : playerTeam) {
-            cout << "\nEquipando a " << hero->getName() << ":" << endl;
-            
-            // Offer a common weapon
-            Weapon* weaponOffer = inventory->getRandomWeapon("Common");
-            if (weaponOffer) {
-                cout << "¿Quieres equipar " << weaponOffer->getName() << " (ATK +" << weaponOffer->getStatBoost1() << ") en " << hero->getName() << "? (1. Sí / 2. No): ";
-                int choice = getValidatedInput(1, 2);
-                if (choice == 1) {
-                    hero->equipWeapon(weaponOffer);
-                    cout << hero->getName() << " equipa " << weaponOffer->getName() << "." << endl;
-                }
-            } else {
-                cout << "No hay armas comunes disponibles." << endl;
+        string csvPath = "bench-leaderboard-" + suffix + ".csv";
+        {
+            ofstream csv(csvPath);
+            long long now = static_cast<long long>(time(0));
+            for (long long i = 0; i < rows; ++i) {
+                csv << "Jugador" << (i % 1000) << "," << rng.between(1, 10) << "," << rng.between(0, 1000) << ","
+                    << formatTimestamp(now - rows + i) << '\n';
             }
-
-            // Offer a common armor
-            Armor* armorOffer = inventory->getRandomArmor("Common");
-            if (armorOffer) {
-                cout << "¿Quieres equipar " << armorOffer->getName() << " (DEF +" << armorOffer->getStatBoost1() << ") en " << hero->getName() << "? (1. Sí / 2. No): ";
-                int choice = getValidatedInput(1, 2);
-                if (choice == 1) {
-                    hero->equipArmor(armorOffer);
-                    cout << hero->getName() << " equipa " << armorOffer->getName() << "." << endl;
-                }
-            } else {
-                cout << "No hay armaduras comunes disponibles." << endl;
+            if (!csv) {
+                cout << "Error con el archivo: " << csvPath << endl;
+                continue;
             }
-
         }
-        cout << "\nMercado inicial completado." << endl;
-    }
-
-    void initializeDungeon() {
-        dungeon.clear(); // Clear previous dungeon if any
-        for (int i = 1; i <= 10; ++i) {
-            Room* room = new Room(i, "Normal"); // Default room type
-
-            // Populate enemies based on room number and type
-            if (i == 3) { // Special event room: Mini-boss
-                room->clearRoom(); // Clear existing generic enemies if any
-                room->addEnemy(createEnemyCopy("Pablo Escobar"));
-                room->addEnemy(createEnemyCopy("La Liendra"));
-                // Add more enemies to make it a mini-boss fight if desired
-            } else if (i == 6) { // Special event room: Mini-boss
-                room->clearRoom();
-                room->addEnemy(createEnemyCopy("Alias Tiro Fijo"));
-                room->addEnemy(createEnemyCopy("El Mindo"));
-                room->addEnemy(createEnemyCopy("Betty la Fea"));
-            } else if (i == 8) { // Special event room: Reward room
-                room->clearRoom(); // No enemies in this specific reward room example
-                room->addEnemy(createEnemyCopy("Carlos Vives")); // Example: still have enemies
-                room->addEnemy(createEnemyCopy("Diva Jessurum"));
-            } else if (i == 10) { // Final boss room
-                room->clearRoom();
-                room->addEnemy(createEnemyCopy("Gozo con Gonzo"));
-                room->addEnemy(createEnemyCopy("PETRO")); // Final boss
-            } else { // Regular rooms
-                // Random number of enemies for regular rooms (1 to 3)
-                uniform_int_distribution<> numEnemiesDis(2,3);
-                int numEnemies = numEnemiesDis(gen);
-                for (int e = 0; e < numEnemies; ++e) {
-                    uniform_int_distribution<> enemyTypeDis(0, availableEnemies.size() - 4); // Exclude mini-bosses and final boss for regular rooms
-                    room->addEnemy(createEnemyCopy(availableEnemies[enemyTypeDis(gen)]->getName()));
-                }
-            }
-            dungeon.push_back(room);
+        {
+            ScoreManager scores(csvPath); // first load imports the CSV into snapshot + log
+            suite.run("scores/load_" + suffix, [&](uint64_t n) {
+                for (uint64_t i = 0; i < n; ++i) scores.loadScores();
+                benchSink = scores.getScoreCount();
+            });
+            suite.run("scores/save_" + suffix, [&](uint64_t n) {
+                for (uint64_t i = 0; i < n; ++i) benchSink = scores.saveScore("Bench", rng.between(1, 10), rng.between(0, 1000));
+            }, 32);
         }
+        string base = csvPath.substr(0, csvPath.size() - 4);
+        remove(csvPath.c_str());
+        remove((base + ".snap").c_str());
+        remove((base + ".log").c_str());
     }
+}
 
-    Enemy* createEnemyCopy(const string& name) {
-        for (Enemy* enemy : availableEnemies) {
-            if (enemy->getName() == name) {
-                // Return a new instance, deeply copied
-                return new Enemy(enemy->getName(), enemy->getMaxHp(), enemy->getAtk(), 
-                                 enemy->getDef(), enemy->getSpd(), enemy->getLck(), enemy->getType());
-            }
+// Usage: --bench [filter] [--json FILE] [--compare FILE] [--threshold PCT] [--min-time S] [--seed N]
+// Runs every benchmark whose name contains filter. --json saves the results,
+// --compare checks them against a saved file and exits with 1 when any
+// benchmark got more than PCT percent slower (default 10) or allocates more.
+int runBenchmarkSuiteCli(int argc, char* argv[]) {
+    string filter, jsonPath, comparePath;
+    double thresholdPercent = 10.0;
+    double minSeconds = 0.5;
+    uint64_t seed = 12345;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--compare" && i + 1 < argc) {
+            comparePath = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            thresholdPercent = atof(argv[++i]);
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            minSeconds = atof(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg[0] != '-' && filter.empty()) {
+            filter = arg;
+        } else {
+            cout << "Uso: --bench [filtro] [--json archivo] [--compare archivo] [--threshold %] [--min-time s] [--seed N]" << endl;
+            return 1;
         }
-        return nullptr; // Should not happen
+    }
+    vector<BenchResult> baseline;
+    if (!comparePath.empty() && !loadBenchBaseline(comparePath, baseline)) {
+        cout << "Error con el archivo: " << comparePath << endl;
+        return 1;
     }
 
-    void playGame() {
-        cout << "\n--- ¡Comienza la Aventura en la Mazmorra! ---" << endl;
-        for (currentRoomNumber = 0; currentRoomNumber < dungeon.size(); ++currentRoomNumber) {
-            Room* currentRoom = dungeon[currentRoomNumber];
-            currentRoom->displayRoomInfo();
-
-            // Battle in the room if there are enemies
-            if (!currentRoom->getEnemies().empty()) {
-                Battle battle(playerTeam, currentRoom->getEnemies());
-                bool heroesWon = battle.startBattle();
-
-                if (!heroesWon) {
-                    cout << "\nTu equipo ha sido derrotado. Fin de la partida." << endl;
-                    endGame();
-                    return;
-                } else {
-                    currentRoom->clearRoom();
-                    cout << "¡Has limpiado la Sala " << (currentRoomNumber + 1) << "!" << endl;
-                    handlePostBattleRewards();
-                }
-            } else {
-                cout << "La sala " << (currentRoomNumber + 1) << " está vacía." << endl;
-            }
-
-            handleSpecialEvents(currentRoomNumber + 1); // Room numbers are 1-indexed for display
+    NullSink nullSink;
+    setMessageSink(&nullSink);
+    RngService rngService(seed);
+    countHeapAllocations = true;
+    BenchSuite suite(filter, minSeconds);
+    runCombatBenchmarks(suite, rngService);
+    runInventoryBenchmarks(suite, rngService);
+    runTelemetryBenchmarks(suite);
+    runBattleBenchmarks(suite, rngService);
+    runScoreBenchmarks(suite, rngService);
+    setMessageSink(nullptr);
 
-            // Check if game ends (e.g. after Room 10)
-            if (currentRoomNumber == 9) { // Last room (index 9 is Room 10)
-                cout << "\n¡Has completado todas las salas de la mazmorra!" << endl;
-                endGame();
-                return;
-            }
+    if (!jsonPath.empty() && !suite.writeJson(jsonPath, seed)) {
+        cout << "Error con el archivo: " << jsonPath << endl;
+        return 1;
+    }
+    if (!comparePath.empty()) {
+        int regressions = compareBenchResults(suite.getResults(), baseline, thresholdPercent);
+        cout << regressions << " regresiones (umbral " << setprecision(1) << thresholdPercent << "%)" << endl;
+        return regressions ? 1 : 0;
+    }
+    return 0;
+}
 
-            cout << "\n¿Listo para la siguiente sala? (Presiona Enter)";
-            cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Consume pending newline
-            cin.get(); // Wait for user to press enter
+// Removes "flag VALUE" from the arguments and returns VALUE (empty if the
+// flag is absent), so options that go with any mode leave the mode's own
+// arguments positional
+string takeGlobalOption(int& argc, char* argv[], const string& flag) {
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (flag == argv[i]) {
+            string value = argv[i + 1];
+            for (int j = i; j + 2 <= argc; ++j) argv[j] = argv[j + 2];
+            argc -= 2;
+            return value;
         }
     }
+    return {};
+}
 
-    void handlePostBattleRewards() {
-        cout << "\n--- Recompensas ---" << endl;
-        // Heal heroes by a percentage of max HP
-        for (Hero* hero : playerTeam) {
-            hero->boostStats(2.0f); // 2% ATK/DEF boost
+int main(int argc, char* argv[]) {
+    // --metrics FILE goes with any mode: combat counters are collected and
+    // written when main returns (JSON for *.json, Prometheus text otherwise)
+    CombatMetricsFile metricsFile(takeGlobalOption(argc, argv, "--metrics"));
+
+    // --trace FILE names the trace of a -DSISAS_TRACE build (default
+    // sisas_trace.json), written when main returns
+    string tracePath = takeGlobalOption(argc, argv, "--trace");
+#if defined(SISAS_TRACE)
+    struct TraceFile {
+        string path;
+        ~TraceFile() {
+            if (!traceRegistry.write(path)) cout << "Error con el archivo: " << path << endl;
         }
+    } traceFile{tracePath.empty() ? "sisas_trace.json" : tracePath};
+#else
+    if (!tracePath.empty()) cout << "--trace necesita compilar con -DSISAS_TRACE; no se grabará traza." << endl;
+#endif
 
-        cout << "Todos los héroes han recibido un pequeño aumento de estadísticas." << endl;
+    if (argc > 1 && string(argv[1]) == "--simulate") {
+        return runSimulationCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--solve") {
+        return runSolverCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-mcts") {
+        return runMctsBenchmarkCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--balance") {
+        return runBalanceCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--campaigns") {
+        return runCampaignsCli(argc, argv);
+    }
+    if (argc > 2 && string(argv[1]) == "--telemetry-watch") {
+        return runTelemetryWatchCli(argc, argv);
+    }
+    if (argc > 2 && string(argv[1]) == "--serve") {
+        return runServerCli(argc, argv);
+    }
+    if (argc > 2 && string(argv[1]) == "--serve-load") {
+        return runServerLoadCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--play-scripts") {
+        return runScriptsCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-batch") {
+        return runBatchBenchmarkCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-arena") {
+        return runArenaBenchmarkCli(argc, argv);
+    }
+    if (argc > 2 && string(argv[1]) == "--replay") {
+        return runReplayCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-leaderboard") {
+        return runLeaderboardBenchmarkCli(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        return runBenchmarkSuiteCli(argc, argv);
     }
 
+    // Leaderboard CSV import/export: --export-csv [file] / --import-csv [file]
+    if (argc > 1 && (string(argv[1]) == "--export-csv" || string(argv[1]) == "--import-csv")) {
+        string path = (argc > 2) ? argv[2] : "leaderboard.csv";
+        ScoreManager scores;
+        bool ok = (string(argv[1]) == "--export-csv") ? scores.exportCsv(path) : scores.importCsv(path);
+        flushMessages();
+        cout << (ok ? "Listo: " : "Error con el archivo: ") << path << " (" << scores.getScoreCount() << " puntuaciones)" << endl;
+        return ok ? 0 : 1;
+    }
 
-    void handleSpecialEvents(int roomNum) {
-        if (roomNum == 3) {
-            cout << "\n--- EVENTO ESPECIAL: Sala 3 ---" << endl;
-            cout << "¡Parece que hay un cofre especial por aquí!" << endl;
-            Item* chestItem = inventory->getRandomWeapon("Rare"); // Guaranteed rare weapon
-            if (!chestItem) chestItem = inventory->getRandomArmor("Rare");
-            if (!chestItem) chestItem = inventory->getRandomPotion();
-
-            if (chestItem) {
-                cout << "Has encontrado en el cofre: ";
-                chestItem->displayInfo();
-                cout << "¿A quién quieres darle este tesoro? (0 para no dar a nadie)" << endl;
-                for (size_t i = 0; i < playerTeam.size(); ++i) {
-                    cout << (i + 1) << ". " << playerTeam[i]->getName() << endl;
-                }
-                int heroChoice = getValidatedInput(0, playerTeam.size());
-                if (heroChoice > 0) {
-                    Hero* chosenHero = playerTeam[heroChoice - 1];
-                     if (Weapon* w = dynamic_cast<Weapon*>(chestItem)) {
-                        chosenHero->equipWeapon(w);
-                        cout << chosenHero->getName() << " equipa " << chestItem->getName() << "." << endl;
-                    } else if (Armor* a = dynamic_cast<Armor*>(chestItem)) {
-                        chosenHero->equipArmor(a);
-                        cout << chosenHero->getName() << " equipa " << chestItem->getName() << "." << endl;
-                    } else if (Potion* p = dynamic_cast<Potion*>(chestItem)) {
-                        chosenHero->addPotion(p);
-                        cout << chosenHero->getName() << " obtiene " << chestItem->getName() << "." << endl;
-                    }
-                } else {
-                    cout << "Decides dejar el tesoro. Una pena." << endl;
-                }
-            } else {
-                cout << "El cofre estaba vacío." << endl;
+    // One master seed for the whole program; --seed N replays a previous run.
+    // --quiet drops all game text (scripted playthroughs), --events FILE
+    // records the run as JSON lines instead of printing it, --record FILE
+    // saves every battle as a binary replay (see --replay), --autoplay [ms]
+    // lets MCTS play the heroes' turns with ms per decision (default 10),
+    // --telemetry FILE publishes every event to a shared-memory ring for
+    // --telemetry-watch or other tools, --alternate-turns brings back the
+    // classic turn order (teams alternate) instead of the SPD timeline,
+    // --potion-turns [N] makes potions wear off after N of the drinker's turns
+    // (default 3) instead of lasting the whole run,
+    // --horde [N] turns room 5 into a horde of N enemies (default 24),
+    // --endless plays rooms on and on, harder every room, until the team falls,
+    // --input FILE takes the answers from a session script (and its seed,
+    // unless --seed is given), --record-input FILE writes one for this session.
+    uint64_t seed = RngService::randomSeed();
+    bool seedGiven = false;
+    unique_ptr<ScriptInput> scriptInput;
+    ofstream inputRecord;
+    NullSink nullSink;
+    ofstream eventFile;
+    unique_ptr<EventSink> eventSink;
+    unique_ptr<ReplayRecorder> replayRecorder;
+    int autoplayMs = 0;
+    GameOptions gameOptions;
+    TelemetryRing telemetryRing;
+    unique_ptr<TelemetrySink> telemetrySink;
+    for (int i = 1; i < argc; ++i) {
+        if (gameOptions.parse(i, argc, argv)) continue;
+        string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+            seedGiven = true;
+        } else if (arg == "--input" && i + 1 < argc) {
+            string script;
+            if (!readWholeFile(argv[++i], script)) {
+                cout << "Error con el archivo: " << argv[i] << endl;
+                return 1;
             }
-        } else if (roomNum == 6) {
-            cout << "\n--- EVENTO ESPECIAL: Sala 6 ---" << endl;
-            cout << "¡Un tesoro ancestral te espera!" << endl;
-            Item* treasureItem = inventory->getRandomWeapon("Rare"); // Guaranteed rare weapon
-            if (!treasureItem) treasureItem = inventory->getRandomArmor("Rare");
-            if (!treasureItem) treasureItem = inventory->getRandomPotion();
-
-            if (treasureItem) {
-                cout << "Has descubierto un Tesoro: ";
-                treasureItem->displayInfo();
-                 cout << "¿A quién quieres darle este tesoro? (0 para no dar a nadie)" << endl;
-                for (size_t i = 0; i < playerTeam.size(); ++i) {
-                    cout << (i + 1) << ". " << playerTeam[i]->getName() << endl;
-                }
-                int heroChoice = getValidatedInput(0, playerTeam.size());
-                if (heroChoice > 0) {
-                    Hero* chosenHero = playerTeam[heroChoice - 1];
-                     if (Weapon* w = dynamic_cast<Weapon*>(treasureItem)) {
-                        chosenHero->equipWeapon(w);
-                        cout << chosenHero->getName() << " equipa " << treasureItem->getName() << "." << endl;
-                    } else if (Armor* a = dynamic_cast<Armor*>(treasureItem)) {
-                        chosenHero->equipArmor(a);
-                        cout << chosenHero->getName() << " equipa " << treasureItem->getName() << "." << endl;
-                    } else if (Potion* p = dynamic_cast<Potion*>(treasureItem)) {
-                        chosenHero->addPotion(p);
-                        cout << chosenHero->getName() << " obtiene " << treasureItem->getName() << "." << endl;
-                    }
-                } else {
-                    cout << "Decides dejar el tesoro. Una pena." << endl;
-                }
-            } else {
-                cout << "El tesoro estaba vacío." << endl;
+            scriptInput.reset(new ScriptInput(move(script)));
+        } else if (arg == "--record-input" && i + 1 < argc) {
+            inputRecord.open(argv[++i]);
+            if (!inputRecord.is_open()) {
+                cout << "Error con el archivo: " << argv[i] << endl;
+                return 1;
             }
-        } else if (roomNum == 8) {
-            cout << "\n--- EVENTO ESPECIAL: Sala 8 ---" << endl;
-            cout << "Un misterioso ermitaño te ofrece una bendición." << endl;
-            cout << "Tus héroes recuperan su HP." << endl;
-            for (Hero* hero : playerTeam) {
-                int healAmount = static_cast<int>(hero->getMaxHp()); // Full heal
-                hero->heal(healAmount);
-                cout << hero->getName() << " recupera " << healAmount << " HP. (HP: " << hero->getHp() << "/" << hero->getMaxHp() << ")" << endl;
+        } else if (arg == "--quiet") {
+            setMessageSink(&nullSink);
+        } else if (arg == "--events" && i + 1 < argc) {
+            eventFile.open(argv[++i]);
+            if (!eventFile.is_open()) {
+                cout << "Error con el archivo: " << argv[i] << endl;
+                return 1;
+            }
+            eventSink.reset(new EventSink(eventFile));
+            setMessageSink(eventSink.get());
+        } else if (arg == "--record" && i + 1 < argc) {
+            replayRecorder.reset(new ReplayRecorder(argv[++i]));
+            if (!replayRecorder->isOpen()) {
+                cout << "Error con el archivo: " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--autoplay") {
+            autoplayMs = (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) ? atoi(argv[++i]) : 10;
+            autoplayMs = max(1, autoplayMs);
+        } else if (arg == "--telemetry" && i + 1 < argc) {
+            if (!telemetryRing.create(argv[++i])) {
+                cout << "Error con el archivo: " << argv[i] << endl;
+                return 1;
             }
         }
     }
+    if (telemetryRing.isOpen()) {
+        telemetrySink.reset(new TelemetrySink(*activeSink, telemetryRing));
+        setMessageSink(telemetrySink.get());
+    }
+    if (scriptInput) {
+        if (scriptInput->hasSeed() && !seedGiven) seed = scriptInput->seed();
+        setInputProvider(scriptInput.get());
+    }
+    unique_ptr<RecordingInput> recordingInput;
+    if (inputRecord.is_open()) {
+        recordingInput.reset(new RecordingInput(*activeInput, inputRecord, seed));
+        setInputProvider(recordingInput.get());
+    }
 
-    void endGame() {
-        int totalHealthLost = 0;
-        for (Hero* hero : playerTeam) {
-            totalHealthLost += hero->getTotalHealthLost();
+    {
+        unique_ptr<MctsHeroPolicy> autoplay;
+        if (autoplayMs > 0) {
+            int threads = max(1u, thread::hardware_concurrency());
+            autoplay.reset(new MctsHeroPolicy(threads, chrono::milliseconds(autoplayMs), seed));
         }
-
-        scoreManager->saveScore(playerName, currentRoomNumber + 1, totalHealthLost); // +1 because currentRoomNumber is 0-indexed
-        scoreManager->displayLeaderboard();
-        
-        // Reset hero stats and potions for next game if starting again
-        for (Hero* hero : playerTeam) {
-            hero->resetPotionEffects(); // This should also reset stats if needed
-            hero->heal(hero->getMaxHp()); // Full heal
+        Game game(seed);
+        game.setReplayRecorder(replayRecorder.get());
+        game.setHeroPolicy(autoplay.get());
+        gameOptions.applyTo(game);
+        try {
+            game.startGame();
+        } catch (const InputExhausted&) {
+            // Input closed (end of a script): nothing more to play
         }
     }
-};
-
-int main() {
-    // Seed the random number generator once for the whole program
-    srand(time(0)); 
-
-    Game game;
-    game.startGame();
+    setInputProvider(nullptr);
+    setMessageSink(nullptr);
+    flushMessages();
 
     return 0;
 }